@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bitmap.h"
+
+#define BITMAP_BENCH_ALLOCS 1000
+#define BITMAP_BENCH_ROUNDS 100
+#define BITMAP_BENCH_RESERVED_PERCENT 90
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// Reserves the head of the map and then allocates and frees short runs behind it,
+// so every search has to skip the reserved region first.
+static double bench_bitmap(uint32_t num_bits) {
+  bitmap_t *bitmap = bitmap_create(num_bits);
+  uint32_t reserved = (uint32_t) ((uint64_t) num_bits * BITMAP_BENCH_RESERVED_PERCENT / 100);
+  bitmap_set_bits(bitmap, 0, reserved, 0);
+
+  int64_t index[BITMAP_BENCH_ALLOCS];
+  uint32_t size[BITMAP_BENCH_ALLOCS];
+  uint64_t elapsed = 0;
+  uint64_t num_allocs = 0;
+  srand(1);
+
+  for (int round = 0; round < BITMAP_BENCH_ROUNDS; round++) {
+    uint64_t start = bench_now_ns();
+    int count = 0;
+    for (; count < BITMAP_BENCH_ALLOCS; count++) {
+      size[count] = 1 + rand() % 16;
+      index[count] = bitmap_get_bit_run(bitmap, size[count]);
+      if (index[count] < 0) break;
+      bitmap_set_bits(bitmap, 0, size[count], (uint32_t) index[count]);
+    }
+    elapsed += bench_now_ns() - start;
+    num_allocs += count;
+    for (int i = 0; i < count; i++) {
+      bitmap_set_bits(bitmap, 1, size[i], (uint32_t) index[i]);
+    }
+  }
+  bitmap_free(bitmap);
+  return num_allocs ? (double) elapsed / (double) num_allocs : 0.0;
+}
+
+int main() {
+  const uint32_t sizes[] = {1000, 10000, 100000, 1000000, 10000000, 100000000};
+  printf("%12s %14s\n", "blocks", "ns/alloc");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    printf("%12u %14.1f\n", sizes[i], bench_bitmap(sizes[i]));
+  }
+  return 0;
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+
+#define FS_BENCH_IMAGE "fs_bench.img"
+#define FS_BENCH_MIN_IMAGE_SIZE (64ull << 20)
+#define FS_BENCH_MAX_PATH 4096
+#define FS_BENCH_LS_CALLS 100
+
+typedef enum {
+  FS_BENCH_MKDIR,
+  FS_BENCH_LOOKUP,
+  FS_BENCH_CREATE,
+  FS_BENCH_OPEN,
+  FS_BENCH_WRITE,
+  FS_BENCH_APPEND,
+  FS_BENCH_READ,
+  FS_BENCH_CLOSE,
+  FS_BENCH_TRUNCATE,
+  FS_BENCH_LINK,
+  FS_BENCH_LS,
+  FS_BENCH_RMDIR,
+  FS_BENCH_UNLINK,
+  FS_BENCH_NUM_OPS
+} fs_bench_op_t;
+
+static const char *fs_bench_op_names[FS_BENCH_NUM_OPS] = {
+    "mkdir", "lookup", "create", "open", "write", "append", "read", "close", "truncate", "link", "ls", "rmdir",
+    "unlink"};
+
+typedef struct {
+  uint32_t num_files; // files and subdirectories per directory
+  uint32_t depth; // directories between root and the one the files go to
+  uint32_t file_size; // bytes written to every file, appended once more
+  uint32_t block_size;
+  uint32_t commit_interval_us;
+  const char *json_path; // NULL prints no JSON
+} fs_bench_config_t;
+
+// latencies of every call of one operation
+typedef struct {
+  uint64_t *samples; // ns
+  uint32_t count;
+  uint32_t errors;
+  uint64_t total_ns;
+} fs_bench_result_t;
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void fs_bench_record(fs_bench_result_t *result, uint64_t start, bool failed) {
+  uint64_t elapsed = bench_now_ns() - start;
+  result->samples[result->count++] = elapsed;
+  result->total_ns += elapsed;
+  result->errors += failed;
+}
+
+static int fs_bench_compare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+// nearest rank percentile of sorted samples
+static uint64_t fs_bench_percentile(const fs_bench_result_t *result, double percentile) {
+  if (!result->count) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) (percentile * result->count + 0.999999);
+  return result->samples[rank ? rank - 1 : 0];
+}
+
+static double fs_bench_ops_per_second(const fs_bench_result_t *result) {
+  return result->total_ns ? (double) result->count * 1e9 / (double) result->total_ns : 0.0;
+}
+
+static void fs_bench_usage(const char *program) {
+  fprintf(stderr, "usage: %s [-n files per directory] [-d depth] [-s file size] [-b block size]\n"
+                  "       [-c commit interval us] [-j json output path]\n", program);
+}
+
+static bool fs_bench_parse(fs_bench_config_t *config, int argc, char **argv) {
+  config->num_files = 10000;
+  config->depth = 4;
+  config->file_size = 4096;
+  config->block_size = 4096;
+  config->commit_interval_us = 0;
+  config->json_path = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "n:d:s:b:c:j:")) != -1) {
+    switch (option) {
+      case 'n':
+        config->num_files = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        config->depth = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        config->file_size = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'b':
+        config->block_size = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        config->commit_interval_us = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      case 'j':
+        config->json_path = optarg;
+        break;
+      default:
+        return false;
+    }
+  }
+  // every level adds "/dN" to the paths
+  return config->num_files && config->file_size && config->file_size <= INT32_MAX / 2 &&
+         config->depth < FS_BENCH_MAX_PATH / 16;
+}
+
+// the image holds every file at twice its size, a directory per file and room for the tables
+static void fs_bench_mkfs_options(const fs_bench_config_t *config, fs_mkfs_options_t *options) {
+  fs_mkfs_options_init(options);
+  options->image_path = FS_BENCH_IMAGE;
+  uint64_t blocks_per_file = (2ull * config->file_size + config->block_size - 1) / config->block_size + 1;
+  uint64_t image_size = 2 * (uint64_t) config->num_files * blocks_per_file * config->block_size;
+  options->image_size = image_size > FS_BENCH_MIN_IMAGE_SIZE ? image_size : FS_BENCH_MIN_IMAGE_SIZE;
+  options->block_size = config->block_size;
+  options->num_inodes = 2ull * config->num_files + config->depth + 16;
+}
+
+static void fs_bench_print(const fs_bench_result_t *results) {
+  printf("%-10s %10s %8s %12s %10s %10s %10s\n", "op", "calls", "errors", "ops/s", "p50 ns", "p99 ns", "p999 ns");
+  for (uint32_t i = 0; i < FS_BENCH_NUM_OPS; i++) {
+    const fs_bench_result_t *result = &results[i];
+    printf("%-10s %10u %8u %12.0f %10llu %10llu %10llu\n", fs_bench_op_names[i], result->count, result->errors,
+           fs_bench_ops_per_second(result), (unsigned long long) fs_bench_percentile(result, 0.5),
+           (unsigned long long) fs_bench_percentile(result, 0.99),
+           (unsigned long long) fs_bench_percentile(result, 0.999));
+  }
+}
+
+static bool fs_bench_write_json(const fs_bench_config_t *config, const fs_bench_result_t *results) {
+  FILE *out = fopen(config->json_path, "w");
+  if (!out) {
+    return false;
+  }
+  fprintf(out, "{\n  \"config\": {\"files_per_dir\": %u, \"depth\": %u, \"file_size\": %u, \"block_size\": %u, "
+               "\"commit_interval_us\": %u},\n  \"ops\": [\n", config->num_files, config->depth, config->file_size,
+          config->block_size, config->commit_interval_us);
+  for (uint32_t i = 0; i < FS_BENCH_NUM_OPS; i++) {
+    const fs_bench_result_t *result = &results[i];
+    fprintf(out, "    {\"name\": \"%s\", \"calls\": %u, \"errors\": %u, \"ops_per_sec\": %.1f, "
+                 "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}%s\n",
+            fs_bench_op_names[i], result->count, result->errors, fs_bench_ops_per_second(result),
+            (unsigned long long) fs_bench_percentile(result, 0.5),
+            (unsigned long long) fs_bench_percentile(result, 0.99),
+            (unsigned long long) fs_bench_percentile(result, 0.999), i + 1 < FS_BENCH_NUM_OPS ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+  return fclose(out) == 0;
+}
+
+// Builds root/d0/d1/... depth levels down and runs every operation on num_files files and
+// subdirectories there, one call at a time, each phase after the one before it.
+static void fs_bench_run(fs_ctx_t *ctx, const fs_bench_config_t *config, fs_bench_result_t *results) {
+  uint32_t num_files = config->num_files;
+  char dir[FS_BENCH_MAX_PATH] = "root";
+  for (uint32_t i = 0; i < config->depth; i++) {
+    size_t length = strlen(dir);
+    snprintf(dir + length, sizeof(dir) - length, "/d%u", i);
+    fs_mkdir(ctx, dir);
+  }
+  char path[FS_BENCH_MAX_PATH + 32];
+  char *buffer = malloc(config->file_size);
+  memset(buffer, 'x', config->file_size);
+  int *fds = malloc(num_files * sizeof(int));
+  uint64_t start;
+
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/s%u", dir, i);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_MKDIR], start, fs_mkdir(ctx, path) != 0);
+  }
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/s%u", dir, i);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_LOOKUP], start, fs_cd(ctx, path) != 0);
+  }
+  fs_cd(ctx, dir);
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/f%u", dir, i);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_CREATE], start, fs_create(ctx, path) != 0);
+  }
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/f%u", dir, i);
+    start = bench_now_ns();
+    fds[i] = fs_open(ctx, path);
+    fs_bench_record(&results[FS_BENCH_OPEN], start, fds[i] == FS_INVALID_FD);
+  }
+  for (uint32_t i = 0; i < num_files; i++) {
+    start = bench_now_ns();
+    ssize_t written = fs_pwrite(ctx, fds[i], buffer, config->file_size, 0);
+    fs_bench_record(&results[FS_BENCH_WRITE], start, written != (ssize_t) config->file_size);
+  }
+  for (uint32_t i = 0; i < num_files; i++) {
+    start = bench_now_ns();
+    ssize_t written = fs_pwrite(ctx, fds[i], buffer, config->file_size, config->file_size);
+    fs_bench_record(&results[FS_BENCH_APPEND], start, written != (ssize_t) config->file_size);
+  }
+  // writes whose end wraps around fail rather than landing at the start of the file
+  struct iovec wrapping[2] = {{.iov_base = buffer, .iov_len = SIZE_MAX}, {.iov_base = buffer, .iov_len = 2}};
+  uint64_t near_end = UINT64_MAX - config->file_size / 2;
+  results[FS_BENCH_APPEND].errors += num_files && (fs_pwrite(ctx, fds[0], buffer, 8, UINT64_MAX - 3) != -1 ||
+                                                   fs_pwrite(ctx, fds[0], buffer, config->file_size, near_end) != -1 ||
+                                                   fs_writev(ctx, fds[0], wrapping, 2, 0) != -1);
+  for (uint32_t i = 0; i < num_files; i++) {
+    start = bench_now_ns();
+    ssize_t read = fs_pread(ctx, fds[i], buffer, config->file_size, 0);
+    fs_bench_record(&results[FS_BENCH_READ], start, read != (ssize_t) config->file_size);
+  }
+  // a read past the end fails before it allocates a buffer of its size
+  results[FS_BENCH_READ].errors += num_files && fs_read(ctx, fds[0], 0, UINT32_MAX) == 0;
+  for (uint32_t i = 0; i < num_files; i++) {
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_CLOSE], start, fs_close(ctx, fds[i]) != 0);
+  }
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/f%u", dir, i);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_TRUNCATE], start, fs_truncate(ctx, path, config->file_size / 2) != 0);
+  }
+  char link_path[FS_BENCH_MAX_PATH + 32];
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/f%u", dir, i);
+    snprintf(link_path, sizeof(link_path), "%s/l%u", dir, i);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_LINK], start, fs_link(ctx, link_path, path) != 0);
+  }
+  // the directory holds every file and subdirectory by now
+  for (uint32_t i = 0; i < FS_BENCH_LS_CALLS; i++) {
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_LS], start, fs_ls(ctx) != 0);
+  }
+  for (uint32_t i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/s%u", dir, i);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_RMDIR], start, fs_rmdir(ctx, path) != 0);
+  }
+  // the first name goes alone, the file and its blocks go with the second
+  for (uint32_t i = 0; i < 2 * num_files; i++) {
+    snprintf(path, sizeof(path), "%s/%c%u", dir, i < num_files ? 'f' : 'l', i % num_files);
+    start = bench_now_ns();
+    fs_bench_record(&results[FS_BENCH_UNLINK], start, fs_unlink(ctx, path) != 0);
+  }
+  free(fds);
+  free(buffer);
+}
+
+// Runs every fs_* operation on a fresh image, prints calls, ops/s and p50/p99/p999 latency
+// per operation, and writes the same as JSON with -j.
+int main(int argc, char **argv) {
+  fs_bench_config_t config;
+  if (!fs_bench_parse(&config, argc, argv)) {
+    fs_bench_usage(argv[0]);
+    return 1;
+  }
+  fs_mkfs_options_t options;
+  fs_bench_mkfs_options(&config, &options);
+  fs_ctx_t *ctx = fs_ctx_new();
+  fs_ctx_set_quiet(ctx, true);
+  if (fs_mkfs(ctx, &options) || fs_mount(ctx, NULL)) {
+    fprintf(stderr, "cannot create %s\n", FS_BENCH_IMAGE);
+    return 1;
+  }
+  fs_set_commit_interval(ctx, config.commit_interval_us);
+
+  fs_bench_result_t results[FS_BENCH_NUM_OPS];
+  for (uint32_t i = 0; i < FS_BENCH_NUM_OPS; i++) {
+    uint32_t capacity = i == FS_BENCH_LS ? FS_BENCH_LS_CALLS : i == FS_BENCH_UNLINK ? 2 * config.num_files : config.num_files;
+    results[i].samples = malloc(capacity * sizeof(uint64_t));
+    results[i].count = 0;
+    results[i].errors = 0;
+    results[i].total_ns = 0;
+  }
+  fs_bench_run(ctx, &config, results);
+  fs_ctx_free(ctx);
+  unlink(FS_BENCH_IMAGE);
+
+  for (uint32_t i = 0; i < FS_BENCH_NUM_OPS; i++) {
+    qsort(results[i].samples, results[i].count, sizeof(uint64_t), fs_bench_compare);
+  }
+  fs_bench_print(results);
+  bool written = !config.json_path || fs_bench_write_json(&config, results);
+  if (!written) {
+    fprintf(stderr, "cannot write %s\n", config.json_path);
+  }
+  for (uint32_t i = 0; i < FS_BENCH_NUM_OPS; i++) {
+    free(results[i].samples);
+  }
+  return written ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+
+#define JOURNAL_BENCH_IMAGE "journal_bench.img"
+#define JOURNAL_BENCH_IMAGE_SIZE (64ull << 20)
+#define JOURNAL_BENCH_MAX_THREADS 16
+#define JOURNAL_BENCH_OPS 2000 // per thread, every op changes metadata
+
+static const uint32_t journal_bench_intervals[] = {0, 1000, 10000, 100000}; // commit intervals in microseconds
+
+typedef struct {
+  fs_ctx_t *ctx;
+  pthread_barrier_t *barrier;
+  uint32_t index;
+} journal_thread_t;
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// creates files in the thread's own directory and gives every other one a size
+static void *journal_thread_run(void *arg) {
+  journal_thread_t *thread = (journal_thread_t *) arg;
+  char path[48];
+  pthread_barrier_wait(thread->barrier);
+  for (uint32_t i = 0; i < JOURNAL_BENCH_OPS; i++) {
+    snprintf(path, sizeof(path), "root/t%u/f%u", thread->index, i / 2);
+    if (i % 2) {
+      fs_truncate(thread->ctx, path, i);
+    } else {
+      fs_create(thread->ctx, path);
+    }
+  }
+  return NULL;
+}
+
+// Runs the metadata workload for every commit interval with 1, 2, 4, ... threads on a fresh
+// image and prints the throughput and how many records each journal commit carried.
+int main(int argc, char **argv) {
+  uint32_t max_threads = argc > 1 ? (uint32_t) atoi(argv[1]) : 4;
+  if (!max_threads || max_threads > JOURNAL_BENCH_MAX_THREADS) {
+    max_threads = JOURNAL_BENCH_MAX_THREADS;
+  }
+  fs_mkfs_options_t options;
+  fs_mkfs_options_init(&options);
+  options.image_path = JOURNAL_BENCH_IMAGE;
+  options.image_size = JOURNAL_BENCH_IMAGE_SIZE;
+
+  printf("%-10s %8s %12s %10s %14s\n", "interval", "threads", "ops/s", "commits", "records/commit");
+  for (size_t k = 0; k < sizeof(journal_bench_intervals) / sizeof(journal_bench_intervals[0]); k++) {
+    for (uint32_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+      fs_ctx_t *ctx = fs_ctx_new();
+      fs_ctx_set_quiet(ctx, true);
+      if (fs_mkfs(ctx, &options) || fs_mount(ctx, NULL)) {
+        fprintf(stderr, "cannot create %s\n", JOURNAL_BENCH_IMAGE);
+        return 1;
+      }
+      fs_set_commit_interval(ctx, journal_bench_intervals[k]);
+      journal_thread_t threads[JOURNAL_BENCH_MAX_THREADS];
+      pthread_t ids[JOURNAL_BENCH_MAX_THREADS];
+      pthread_barrier_t barrier;
+      pthread_barrier_init(&barrier, NULL, num_threads + 1);
+      for (uint32_t i = 0; i < num_threads; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "root/t%u", i);
+        fs_mkdir(ctx, path);
+        threads[i].ctx = fs_ctx_session(ctx);
+        threads[i].barrier = &barrier;
+        threads[i].index = i;
+      }
+      journal_stats_t before;
+      fs_journal_stats(ctx, &before);
+      for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_create(&ids[i], NULL, journal_thread_run, &threads[i]);
+      }
+      pthread_barrier_wait(&barrier);
+      uint64_t start = bench_now_ns();
+      for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(ids[i], NULL);
+      }
+      // what is still pending counts, the last group commit belongs to the run
+      fs_sync(ctx);
+      double seconds = (double) (bench_now_ns() - start) / 1e9;
+      pthread_barrier_destroy(&barrier);
+      journal_stats_t after;
+      fs_journal_stats(ctx, &after);
+      uint64_t commits = after.commits - before.commits;
+      uint64_t records = after.records - before.records;
+      printf("%-10u %8u %12.0f %10llu %14.1f\n", journal_bench_intervals[k], num_threads,
+             (double) num_threads * JOURNAL_BENCH_OPS / seconds, (unsigned long long) commits,
+             commits ? (double) records / (double) commits : 0.0);
+      for (uint32_t i = 0; i < num_threads; i++) {
+        fs_ctx_free(threads[i].ctx);
+      }
+      fs_ctx_free(ctx);
+    }
+  }
+  unlink(JOURNAL_BENCH_IMAGE);
+  return 0;
+}
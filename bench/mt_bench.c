@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+
+#define MT_BENCH_IMAGE "mt_bench.img"
+#define MT_BENCH_IMAGE_SIZE (512ull << 20)
+#define MT_BENCH_MAX_THREADS 16
+#define MT_BENCH_OPS 100000 // per thread
+#define MT_BENCH_IO_SIZE 4096
+#define MT_BENCH_FILE_SIZE (256 * MT_BENCH_IO_SIZE)
+#define MT_BENCH_APPEND_SIZE 512
+#define MT_BENCH_APPEND_LIMIT (1u << 20) // appended files are truncated back to zero here
+
+typedef enum {
+  MT_LOOKUP,      // resolve a shared path
+  MT_READ_SHARED, // all threads read the same file
+  MT_WRITE,       // every thread overwrites its own file in place
+  MT_APPEND,      // every thread appends to its own file
+  MT_NUM_WORKLOADS
+} mt_workload_t;
+
+static const char *mt_workload_names[MT_NUM_WORKLOADS] = {"lookup", "read-shared", "write", "append"};
+
+typedef struct {
+  fs_ctx_t *ctx;
+  pthread_barrier_t *barrier;
+  mt_workload_t workload;
+  int shared_fd;
+  int own_fd;
+  char own_path[32];
+  uint32_t seed;
+} mt_thread_t;
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t mt_random_offset(uint32_t *seed) {
+  *seed = *seed * 1103515245u + 12345u;
+  return ((*seed >> 8) % (MT_BENCH_FILE_SIZE / MT_BENCH_IO_SIZE)) * MT_BENCH_IO_SIZE;
+}
+
+static void *mt_thread_run(void *arg) {
+  mt_thread_t *thread = (mt_thread_t *) arg;
+  char buffer[MT_BENCH_IO_SIZE];
+  memset(buffer, 'x', sizeof(buffer));
+  uint32_t appended = MT_BENCH_APPEND_LIMIT;
+  pthread_barrier_wait(thread->barrier);
+  for (uint32_t i = 0; i < MT_BENCH_OPS; i++) {
+    switch (thread->workload) {
+      case MT_LOOKUP:
+        fs_cd(thread->ctx, "root/d0/d1/d2/d3");
+        break;
+      case MT_READ_SHARED:
+        fs_read(thread->ctx, thread->shared_fd, mt_random_offset(&thread->seed), MT_BENCH_IO_SIZE);
+        break;
+      case MT_WRITE:
+        fs_write(thread->ctx, thread->own_fd, buffer, mt_random_offset(&thread->seed), MT_BENCH_IO_SIZE);
+        break;
+      case MT_APPEND:
+        if (appended == MT_BENCH_APPEND_LIMIT) {
+          fs_truncate(thread->ctx, thread->own_path, 0);
+          appended = 0;
+        }
+        fs_write(thread->ctx, thread->own_fd, buffer, appended, MT_BENCH_APPEND_SIZE);
+        appended += MT_BENCH_APPEND_SIZE;
+        break;
+      default:
+        break;
+    }
+  }
+  return NULL;
+}
+
+static int mt_open_filled(fs_ctx_t *ctx, char *path) {
+  char buffer[MT_BENCH_IO_SIZE];
+  memset(buffer, 'y', sizeof(buffer));
+  fs_create(ctx, path);
+  int fd = fs_open(ctx, path);
+  for (uint32_t offset = 0; offset < MT_BENCH_FILE_SIZE; offset += MT_BENCH_IO_SIZE) {
+    fs_write(ctx, fd, buffer, offset, MT_BENCH_IO_SIZE);
+  }
+  return fd;
+}
+
+// Runs every workload with 1, 2, 4, ... threads, one session per thread, and prints
+// the throughput against the single thread run.
+int main(int argc, char **argv) {
+  uint32_t max_threads = argc > 1 ? (uint32_t) atoi(argv[1]) : MT_BENCH_MAX_THREADS;
+  if (!max_threads || max_threads > MT_BENCH_MAX_THREADS) {
+    max_threads = MT_BENCH_MAX_THREADS;
+  }
+  fs_ctx_t *ctx = fs_ctx_new();
+  fs_ctx_set_quiet(ctx, true);
+  fs_mkfs_options_t options;
+  fs_mkfs_options_init(&options);
+  options.image_path = MT_BENCH_IMAGE;
+  options.image_size = MT_BENCH_IMAGE_SIZE;
+  if (fs_mkfs(ctx, &options) || fs_mount(ctx, NULL)) {
+    fprintf(stderr, "cannot create %s\n", MT_BENCH_IMAGE);
+    return 1;
+  }
+  fs_mkdir(ctx, "root/d0");
+  fs_mkdir(ctx, "root/d0/d1");
+  fs_mkdir(ctx, "root/d0/d1/d2");
+  fs_mkdir(ctx, "root/d0/d1/d2/d3");
+  int shared_fd = mt_open_filled(ctx, "root/shared");
+
+  mt_thread_t threads[MT_BENCH_MAX_THREADS];
+  for (uint32_t i = 0; i < max_threads; i++) {
+    threads[i].ctx = fs_ctx_session(ctx);
+    threads[i].shared_fd = shared_fd;
+    snprintf(threads[i].own_path, sizeof(threads[i].own_path), "root/t%u", i);
+    threads[i].own_fd = mt_open_filled(ctx, threads[i].own_path);
+    threads[i].seed = i + 1;
+  }
+
+  printf("%-12s %8s %12s %8s\n", "workload", "threads", "ops/s", "speedup");
+  for (mt_workload_t workload = 0; workload < MT_NUM_WORKLOADS; workload++) {
+    double base = 0;
+    for (uint32_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+      pthread_barrier_t barrier;
+      pthread_barrier_init(&barrier, NULL, num_threads + 1);
+      pthread_t ids[MT_BENCH_MAX_THREADS];
+      for (uint32_t i = 0; i < num_threads; i++) {
+        threads[i].barrier = &barrier;
+        threads[i].workload = workload;
+        pthread_create(&ids[i], NULL, mt_thread_run, &threads[i]);
+      }
+      pthread_barrier_wait(&barrier);
+      uint64_t start = bench_now_ns();
+      for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(ids[i], NULL);
+      }
+      double seconds = (double) (bench_now_ns() - start) / 1e9;
+      pthread_barrier_destroy(&barrier);
+      double rate = (double) num_threads * MT_BENCH_OPS / seconds;
+      if (num_threads == 1) {
+        base = rate;
+      }
+      printf("%-12s %8u %12.0f %7.2fx\n", mt_workload_names[workload], num_threads, rate, rate / base);
+    }
+  }
+
+  for (uint32_t i = 0; i < max_threads; i++) {
+    fs_ctx_free(threads[i].ctx);
+  }
+  fs_ctx_free(ctx);
+  unlink(MT_BENCH_IMAGE);
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "file_path.h"
+#include "linked_list.h"
+
+#define PATH_BENCH_ITERATIONS 1000000
+
+// The strtok based parser file_path_parse replaced, kept here as the baseline.
+// It copies the path and allocates a token and a list node per component.
+
+typedef struct {
+  path_type_t type;
+  char *value;
+  bool is_last;
+} legacy_path_token_t;
+
+typedef struct {
+  linked_list_t *token_types;
+  char *buffer;
+  char *name;
+  bool is_absolute;
+} legacy_path_parse_t;
+
+static legacy_path_token_t *legacy_path_token_new(char *token) {
+  legacy_path_token_t *path_token = malloc(sizeof(legacy_path_token_t));
+  if (strcmp(token, ".") == 0) {
+    path_token->type = PATH_RELATIVE;
+  } else if (strcmp(token, "..") == 0) {
+    path_token->type = PATH_PARENT;
+  } else {
+    path_token->type = PATH_FILE;
+  }
+  path_token->value = token;
+  path_token->is_last = false;
+  return path_token;
+}
+
+static legacy_path_parse_t *legacy_file_path_parse(char *path) {
+  char *buffer = malloc(strlen(path) + 1);
+  strcpy(buffer, path);
+  char *token = strtok(buffer, "/"); // NOLINT
+  if (token == NULL) {
+    free(buffer);
+    return NULL;
+  }
+  legacy_path_parse_t *path_parse = malloc(sizeof(legacy_path_parse_t));
+  path_parse->token_types = linked_list_new();
+  path_parse->buffer = buffer;
+  path_parse->is_absolute = strcmp(token, "root") == 0;
+  path_parse->name = NULL;
+  if (!path_parse->is_absolute) {
+    linked_list_push(path_parse->token_types, legacy_path_token_new(token));
+  }
+  while ((token = strtok(NULL, "/"))) { // NOLINT
+    path_parse->name = token;
+    linked_list_push(path_parse->token_types, legacy_path_token_new(token));
+  }
+  if (path_parse->token_types->tail) {
+    ((legacy_path_token_t *) path_parse->token_types->tail->value)->is_last = true;
+  }
+  return path_parse;
+}
+
+// the original never released anything, the benchmark does to keep memory flat
+static void legacy_file_path_free(legacy_path_parse_t *path_parse) {
+  node_t *current = path_parse->token_types->head;
+  while (current) {
+    free(current->value);
+    current = current->next;
+  }
+  linked_list_free(path_parse->token_types);
+  free(path_parse->token_types);
+  free(path_parse->buffer);
+  free(path_parse);
+}
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void bench_path(char *path) {
+  uint64_t checksum = 0;
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < PATH_BENCH_ITERATIONS; i++) {
+    legacy_path_parse_t *path_parse = legacy_file_path_parse(path);
+    checksum += path_parse->token_types->count;
+    legacy_file_path_free(path_parse);
+  }
+  double legacy_ns = (double) (bench_now_ns() - start) / PATH_BENCH_ITERATIONS;
+
+  start = bench_now_ns();
+  for (int i = 0; i < PATH_BENCH_ITERATIONS; i++) {
+    path_parse_t path_parse;
+    file_path_parse(path, &path_parse);
+    checksum -= path_parse.num_tokens;
+    file_path_parse_free(&path_parse);
+  }
+  double slice_ns = (double) (bench_now_ns() - start) / PATH_BENCH_ITERATIONS;
+  printf("%-40s %10.1f %10.1f %s\n", path, legacy_ns, slice_ns, checksum ? "MISMATCH" : "");
+}
+
+int main() {
+  printf("%-40s %10s %10s\n", "path", "strtok ns", "slices ns");
+  bench_path("root/file");
+  bench_path("./dir/file");
+  bench_path("root/usr/local/share/doc/filesystem/x");
+  bench_path("../a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r");
+  return 0;
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+
+#define SCALE_BENCH_IMAGE "scale_bench.img"
+#define SCALE_BENCH_MAX_PATH 256
+#define SCALE_BENCH_SLACK_SIZE (64ull << 20) // journal, bitmaps and whatever the directories store past their slots
+#define SCALE_BENCH_DIRENT_SIZE 64 // stored bytes per directory entry, name included, with room to spare
+#define SCALE_BENCH_NUM_LOOKUPS 100000
+
+typedef struct {
+  uint64_t num_files;
+  uint32_t dir_files; // files per directory
+} scale_bench_config_t;
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// anonymous resident memory, the mapped image is left out
+static uint64_t scale_bench_rss_anon() {
+  FILE *status = fopen("/proc/self/status", "r");
+  if (!status) {
+    return 0;
+  }
+  char line[256];
+  unsigned long long kb = 0;
+  while (fgets(line, sizeof(line), status)) {
+    if (sscanf(line, "RssAnon: %llu kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(status);
+  return (uint64_t) kb * 1024;
+}
+
+static void scale_bench_usage(const char *program) {
+  fprintf(stderr, "usage: %s [-n files] [-w files per directory]\n", program);
+}
+
+static bool scale_bench_parse(scale_bench_config_t *config, int argc, char **argv) {
+  config->num_files = 10000000;
+  config->dir_files = 1000;
+  int option;
+  while ((option = getopt(argc, argv, "n:w:")) != -1) {
+    switch (option) {
+      case 'n':
+        config->num_files = strtoull(optarg, NULL, 10);
+        break;
+      case 'w':
+        config->dir_files = (uint32_t) strtoul(optarg, NULL, 10);
+        break;
+      default:
+        return false;
+    }
+  }
+  return config->num_files && config->dir_files;
+}
+
+static void scale_bench_path(char *path, const scale_bench_config_t *config, uint64_t i) {
+  snprintf(path, SCALE_BENCH_MAX_PATH, "root/d%llu/f%llu", (unsigned long long) (i / config->dir_files),
+           (unsigned long long) (i % config->dir_files));
+}
+
+// Creates num_files files spread over directories of dir_files each, then mounts the image again and
+// looks files up at random. Prints the rates and the anonymous memory each loaded inode costs.
+int main(int argc, char **argv) {
+  scale_bench_config_t config;
+  if (!scale_bench_parse(&config, argc, argv)) {
+    scale_bench_usage(argv[0]);
+    return 1;
+  }
+  uint64_t num_dirs = (config.num_files + config.dir_files - 1) / config.dir_files;
+  fs_mkfs_options_t options;
+  fs_mkfs_options_init(&options);
+  options.image_path = SCALE_BENCH_IMAGE;
+  options.num_inodes = config.num_files + num_dirs + 16;
+  // two slots of 128 bytes per inode, the image stays sparse where nothing is written
+  options.image_size = options.num_inodes * 256 + config.num_files * SCALE_BENCH_DIRENT_SIZE + SCALE_BENCH_SLACK_SIZE;
+  fs_ctx_t *ctx = fs_ctx_new();
+  fs_ctx_set_quiet(ctx, true);
+  if (fs_mkfs(ctx, &options) || fs_mount(ctx, NULL)) {
+    fprintf(stderr, "cannot create %s\n", SCALE_BENCH_IMAGE);
+    return 1;
+  }
+
+  char path[SCALE_BENCH_MAX_PATH];
+  uint64_t errors = 0;
+  uint64_t rss = scale_bench_rss_anon();
+  uint64_t start = bench_now_ns();
+  for (uint64_t i = 0; i < config.num_files; i++) {
+    if (i % config.dir_files == 0) {
+      snprintf(path, sizeof(path), "root/d%llu", (unsigned long long) (i / config.dir_files));
+      errors += fs_mkdir(ctx, path) != 0;
+    }
+    scale_bench_path(path, &config, i);
+    errors += fs_create(ctx, path) != 0;
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  uint64_t created_rss = scale_bench_rss_anon();
+  uint64_t num_inodes = config.num_files + num_dirs;
+  printf("create: %llu files in %llu directories, %.2f s, %.0f files/s, %llu errors\n",
+         (unsigned long long) config.num_files, (unsigned long long) num_dirs, (double) elapsed / 1e9,
+         (double) config.num_files * 1e9 / (double) elapsed, (unsigned long long) errors);
+  printf("memory: %.1f bytes per inode after creating\n",
+         (double) (created_rss > rss ? created_rss - rss : 0) / (double) num_inodes);
+
+  start = bench_now_ns();
+  fs_unmount(ctx);
+  uint64_t unmount_ns = bench_now_ns() - start;
+  rss = scale_bench_rss_anon();
+  start = bench_now_ns();
+  if (fs_mount(ctx, SCALE_BENCH_IMAGE)) {
+    fprintf(stderr, "cannot mount %s\n", SCALE_BENCH_IMAGE);
+    return 1;
+  }
+  uint64_t mount_ns = bench_now_ns() - start;
+  printf("unmount: %.2f s, mount: %.3f ms\n", (double) unmount_ns / 1e9, (double) mount_ns / 1e6);
+
+  // every lookup loads the directory it lands in, the first time
+  uint64_t lookups = config.num_files < SCALE_BENCH_NUM_LOOKUPS ? config.num_files : SCALE_BENCH_NUM_LOOKUPS;
+  uint64_t seed = 88172645463325252ull;
+  errors = 0;
+  start = bench_now_ns();
+  for (uint64_t i = 0; i < lookups; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    scale_bench_path(path, &config, seed % config.num_files);
+    int fd = fs_open(ctx, path);
+    errors += fd == FS_INVALID_FD;
+    fs_close(ctx, fd);
+  }
+  elapsed = bench_now_ns() - start;
+  uint64_t loaded_rss = scale_bench_rss_anon();
+  printf("lookup: %llu random opens, %.0f opens/s, %llu errors\n", (unsigned long long) lookups,
+         (double) lookups * 1e9 / (double) elapsed, (unsigned long long) errors);
+  printf("memory: %.1f MB after the lookups, loaded lazily\n",
+         (double) (loaded_rss > rss ? loaded_rss - rss : 0) / (1 << 20));
+  fs_ctx_free(ctx);
+  unlink(SCALE_BENCH_IMAGE);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "binary_tree.h"
+#include "slab.h"
+
+#define TREE_BENCH_ENTRIES 1000000
+
+static uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void bench_report(const char *name, uint64_t start, uint64_t ops) {
+  printf("%-10s %10.1f ns/op\n", name, (double) (bench_now_ns() - start) / (double) ops);
+}
+
+// Keys grow monotonically like storage addresses do, the worst case for an unbalanced tree.
+// Nodes come from malloc when pool is NULL.
+static int bench_tree(const char *allocator, slab_pool_t *pool) {
+  printf("%s\n", allocator);
+  tree_t *tree = tree_new(pool);
+  tree_node_t tree_node = {.name = NULL, .index = 0, .num_reserved_bits = 1};
+
+  uint64_t start = bench_now_ns();
+  for (uint64_t i = 0; i < TREE_BENCH_ENTRIES; i++) {
+    tree_node.value = i * 16;
+    tree_insert_node(tree, &tree_node);
+  }
+  bench_report("insert", start, TREE_BENCH_ENTRIES);
+  printf("%-10s %10u\n", "height", tree_get_height(tree->ptr));
+
+  srand(1);
+  uint64_t found = 0;
+  start = bench_now_ns();
+  for (uint64_t i = 0; i < TREE_BENCH_ENTRIES; i++) {
+    found += tree_find_node(tree->ptr, (uint64_t) (rand() % TREE_BENCH_ENTRIES) * 16) != NULL;
+  }
+  bench_report("find", start, TREE_BENCH_ENTRIES);
+
+  start = bench_now_ns();
+  for (uint64_t i = 0; i < TREE_BENCH_ENTRIES; i += 2) {
+    tree_delete_node(tree, i * 16);
+  }
+  bench_report("delete", start, TREE_BENCH_ENTRIES / 2);
+
+  start = bench_now_ns();
+  if (pool) {
+    // the slabs go back at once, as they do on unmount
+    slab_pool_destroy(pool);
+    tree->ptr = NULL;
+  } else {
+    tree_delete_all(tree);
+  }
+  bench_report("clear", start, TREE_BENCH_ENTRIES / 2);
+  free(tree);
+  return found == TREE_BENCH_ENTRIES ? 0 : 1;
+}
+
+int main() {
+  slab_pool_t pool;
+  slab_pool_init(&pool, sizeof(tree_node_t), false);
+  return bench_tree("malloc", NULL) | bench_tree("slab", &pool);
+}
@@ -1,6 +1,7 @@
 #ifndef FILESYSTEM_COMMAND_LINE_PARSER_H
 #define FILESYSTEM_COMMAND_LINE_PARSER_H
 
-_Noreturn void command_line_run();
+// filesystem_demo [--quiet] [script], commands come from the script or stdin
+_Noreturn void command_line_run(int argc, char **argv);
 
 #endif // FILESYSTEM_COMMAND_LINE_PARSER_H
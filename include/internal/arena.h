@@ -0,0 +1,42 @@
+#ifndef FILESYSTEM_ARENA_H
+#define FILESYSTEM_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "slab.h"
+
+#define ARENA_MIN_CLASS_SIZE 16
+#define ARENA_NUM_CLASSES 8 // 16 to 2048 bytes, bigger blocks are kept in a list
+
+typedef struct arena_block {
+  struct arena_block *previous;
+  struct arena_block *next;
+} arena_block_t;
+
+// The memory of one mount's metadata: pools for the fixed-size objects, power of two size
+// classes for names and tables, and a list of the blocks too big for a class.
+// arena_free hands all of it back in time proportional to the number of slabs.
+// Only extent_nodes is shared, the rest is used under the namespace lock, see filesystem.h.
+typedef struct {
+  slab_pool_t files;
+  slab_pool_t descriptors;
+  slab_pool_t list_nodes;
+  slab_pool_t extent_nodes; // extent maps change under the per-descriptor locks
+  slab_pool_t classes[ARENA_NUM_CLASSES];
+  arena_block_t *blocks;
+} arena_t;
+
+arena_t *arena_new();
+
+void arena_free(arena_t *arena);
+
+// size bytes from the size classes, NULL arena falls back to malloc
+void *arena_alloc(arena_t *arena, size_t size);
+
+void *arena_calloc(arena_t *arena, size_t size);
+
+// size is the size the block was allocated with
+void arena_release(arena_t *arena, void *ptr, size_t size);
+
+#endif // FILESYSTEM_ARENA_H
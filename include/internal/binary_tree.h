@@ -1,34 +1,49 @@
 #ifndef FILESYSTEM_BINARY_TREE_H
 #define FILESYSTEM_BINARY_TREE_H
 
+#include <stdint.h>
+
+#include "slab.h"
+
+#define TREE_MAX_HEIGHT 96 // AVL height bound for 2^64 nodes is ~1.44 * 64
+
+// AVL tree, every operation walks the tree iteratively.
 typedef struct tree_node {
   char *name;
-  uint32_t value;
+  uint64_t value;
   uint32_t index;
   uint32_t num_reserved_bits;
   struct tree_node *left;
   struct tree_node *right;
+  int32_t height; // leaf height is 1
 } tree_node_t;
 
-tree_node_t *tree_node_new(uint32_t value, uint32_t index, uint32_t num_reserved_bits);
-
 typedef struct {
   tree_node_t *ptr;
+  slab_pool_t *pool; // where the nodes come from, NULL for malloc
 } tree_t;
 
-tree_t *tree_new();
+tree_node_t *tree_node_new(tree_t *tree, uint64_t value, uint32_t index, uint32_t num_reserved_bits);
+
+tree_t *tree_new(slab_pool_t *pool);
+
+void tree_init(tree_t *tree, slab_pool_t *pool);
+
+void tree_insert_node_value(tree_t *tree, uint64_t value);
+
+void tree_insert_node(tree_t *tree, tree_node_t *tree_node);
 
-void tree_insert_node_value(tree_node_t **link, uint32_t value);
+tree_node_t *tree_find_node(tree_node_t *link, uint64_t value);
 
-void tree_insert_node(tree_node_t **link, tree_node_t *tree_node);
+tree_node_t *tree_find_floor_node(tree_node_t *link, uint64_t value);
 
-tree_node_t *tree_find_node(tree_node_t *link, uint32_t value);
+tree_node_t *tree_find_ceil_node(tree_node_t *link, uint64_t value);
 
 tree_node_t *tree_delete_smallest_node(tree_node_t **link);
 
-void tree_delete_node(tree_node_t **link, uint32_t value);
+void tree_delete_node(tree_t *tree, uint64_t value);
 
-void tree_delete_all(tree_node_t **link);
+void tree_delete_all(tree_t *tree);
 
 uint32_t tree_get_height(tree_node_t *link);
 
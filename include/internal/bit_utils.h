@@ -16,4 +16,36 @@ inline static uint32_t extract_bit_range(uint32_t reg, uint32_t msb, uint32_t ls
   return (reg >> lsb) & mask;
 }
 
+// number of trailing zero bits, reg must not be zero
+inline static uint32_t bit_ctz64(uint64_t reg) {
+  assert(reg);
+  return (uint32_t) __builtin_ctzll(reg);
+}
+
+// number of leading zero bits, reg must not be zero
+inline static uint32_t bit_clz64(uint64_t reg) {
+  assert(reg);
+  return (uint32_t) __builtin_clzll(reg);
+}
+
+inline static uint32_t bit_popcount64(uint64_t reg) {
+  return (uint32_t) __builtin_popcountll(reg);
+}
+
+// number of consecutive set bits starting from bit 0
+inline static uint32_t bit_trailing_ones64(uint64_t reg) {
+  return ~reg ? bit_ctz64(~reg) : 64;
+}
+
+// number of consecutive set bits starting from bit 63
+inline static uint32_t bit_leading_ones64(uint64_t reg) {
+  return ~reg ? bit_clz64(~reg) : 64;
+}
+
+// mask with bits [lsb, lsb + nbits) set, nbits in range [1, 64 - lsb]
+inline static uint64_t bit_range_mask64(uint32_t lsb, uint32_t nbits) {
+  assert(nbits && lsb + nbits <= 64);
+  return (nbits == 64 ? ~0ULL : ((1ULL << nbits) - 1ULL)) << lsb;
+}
+
 #endif // FILESYSTEM_BIT_UTILS_H
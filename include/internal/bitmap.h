@@ -7,19 +7,41 @@
 #include <assert.h>
 #include <stdio.h>
 
+#define BITMAP_BITS_PER_WORD 64
+#define BITMAP_MAX_LEVELS 6 // enough summary levels for 2^32 bits
+
+// Free-space bitmap, a set bit marks a free block.
+// Every summary level keeps one bit per word of the level below, so a search
+// skips fully reserved (or partially reserved) regions in O(log64 n) steps.
 typedef struct {
-  uint8_t *map;
+  uint64_t *map;
+  uint64_t *any_free[BITMAP_MAX_LEVELS]; // level 0: map word has a free bit, above: child word is not zero
+  uint64_t *all_free[BITMAP_MAX_LEVELS]; // level 0: every bit of map word is free, above: child word is not zero
+  uint32_t level_words[BITMAP_MAX_LEVELS];
+  uint32_t num_levels;
   uint32_t num_bits;
-  uint32_t num_bytes;
+  uint32_t num_words;
 } bitmap_t;
 
-bitmap_t *bitmap_create(uint32_t num_blocks);
+bitmap_t *bitmap_create(uint32_t num_bits);
+
+void bitmap_free(bitmap_t *bitmap);
 
 void bitmap_set_bits(bitmap_t *bitmap, int32_t val, uint32_t nbits, uint32_t index);
 
 int32_t bitmap_get_bit(bitmap_t *bitmap, uint32_t index);
 
-int32_t bitmap_get_bit_run(bitmap_t *bitmap, uint32_t size);
+int64_t bitmap_get_bit_run(bitmap_t *bitmap, uint32_t size);
+
+int64_t bitmap_next_free_run(bitmap_t *bitmap, uint32_t from, uint32_t *length);
+
+uint32_t bitmap_count_free(bitmap_t *bitmap);
+
+// reserves the bits set in used, one word of used per word of the map as stored in the image
+void bitmap_load(bitmap_t *bitmap, const uint64_t *used);
+
+// stores the map inverted, a set bit of used marks a reserved bit
+void bitmap_save(const bitmap_t *bitmap, uint64_t *used);
 
 void bitmap_show(bitmap_t *bitmap);
 
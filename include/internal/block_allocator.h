@@ -0,0 +1,86 @@
+#ifndef FILESYSTEM_BLOCK_ALLOCATOR_H
+#define FILESYSTEM_BLOCK_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "bitmap.h"
+#include "extent_allocator.h"
+
+#define BLOCK_ALLOCATOR_MAX_GROUPS 64
+#define BLOCK_ALLOCATOR_MIN_GROUP_BLOCKS 1024 // smaller devices get fewer groups
+#define BLOCK_ALLOCATOR_RUN_BUCKETS 32
+
+// A contiguous segment of the block space with its own bitmap, free extent index and lock.
+// Bitmap and index are built from the stored bitmap when the group is first used.
+typedef struct {
+  pthread_mutex_t lock;
+  bitmap_t *bitmap;
+  extent_allocator_t *allocator; // block numbers are relative to first_block, NULL until loaded
+  uint32_t first_block;
+  uint32_t num_blocks;
+} __attribute__((aligned(64))) alloc_group_t;
+
+// Block space split into allocation groups, so writers working in different groups
+// never share a lock or a bitmap cache line. A group that runs dry steals from the others.
+typedef struct {
+  alloc_group_t *groups;
+  uint32_t num_groups;
+  uint32_t group_blocks; // blocks per group, a multiple of 64, the last one may be shorter
+  alloc_policy_t policy;
+  const uint64_t *used; // stored bitmap the groups load from, a set bit marks a used block
+  const uint64_t *held; // blocks snapshots use, NULL without snapshots; changes only under the filesystem lock
+  uint64_t *kept; // used blocks the tree does not use, the bits of a group change under its lock
+} block_allocator_t;
+
+// Free space as runs of free blocks, counted per group as the allocator hands them out.
+typedef struct {
+  uint64_t num_free;
+  uint64_t num_runs;
+  uint64_t largest_run;
+  uint64_t runs[BLOCK_ALLOCATOR_RUN_BUCKETS]; // bucket i counts runs of [2^i, 2^(i+1)) blocks
+} block_free_runs_t;
+
+// used is the stored bitmap, see bitmap_save, and must stay mapped; NULL starts with every block free
+block_allocator_t *block_allocator_new(uint32_t num_blocks, alloc_policy_t policy, const uint64_t *used);
+
+void block_allocator_free(block_allocator_t *blocks);
+
+// allocates num_blocks contiguous blocks, from group first and then from the others, -1 if none has them
+int64_t block_allocator_alloc(block_allocator_t *blocks, uint32_t group, uint32_t num_blocks);
+
+// allocates num_blocks contiguous blocks from the lowest free run which holds them and starts below limit,
+// -1 if there is none
+int64_t block_allocator_alloc_low(block_allocator_t *blocks, uint32_t num_blocks, uint32_t limit);
+
+// claims up to num_blocks free blocks starting exactly at index, within index's group
+uint32_t block_allocator_extend(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks);
+
+// claims exactly [index, index + num_blocks), the run may cross group boundaries;
+// false and nothing claimed if any of it is in use
+bool block_allocator_claim(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks);
+
+// frees a run of blocks, the run may cross group boundaries; blocks in held stay allocated and are marked kept
+void block_allocator_release(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks);
+
+// releases leave the blocks set in held to the snapshots from now on, both NULL when there are none
+void block_allocator_share(block_allocator_t *blocks, const uint64_t *held, uint64_t *kept);
+
+// marks a run of allocated blocks as kept, they belong to the snapshots rather than the tree
+void block_allocator_keep(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks);
+
+// length of the run from index, at most num_blocks, whose blocks held is all set or all clear for
+uint32_t block_allocator_held_run(const block_allocator_t *blocks, uint32_t index, uint32_t num_blocks, bool *held);
+
+// loads every group
+uint64_t block_allocator_num_free(block_allocator_t *blocks);
+
+// loads every group
+void block_allocator_free_runs(block_allocator_t *blocks, block_free_runs_t *runs);
+
+// stores the state of every group to used, groups not loaded yet are copied over;
+// later loads read from used
+void block_allocator_save(block_allocator_t *blocks, uint64_t *used);
+
+#endif // FILESYSTEM_BLOCK_ALLOCATOR_H
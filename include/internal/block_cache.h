@@ -0,0 +1,80 @@
+#ifndef FILESYSTEM_BLOCK_CACHE_H
+#define FILESYSTEM_BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "image.h"
+
+#define BLOCK_CACHE_SHARDS 16 // blocks go to shard physical % BLOCK_CACHE_SHARDS
+#define BLOCK_CACHE_DIRTY_PERCENT 50 // a shard writes all its dirty blocks back past this share
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t writebacks; // dirty blocks copied back to the image
+  uint64_t flushes;    // writebacks forced by dirty pressure
+  uint32_t num_entries;
+  uint32_t num_dirty;
+  uint32_t capacity;
+} block_cache_stats_t;
+
+typedef struct {
+  uint32_t block; // physical block
+  uint32_t next;  // next entry in the hash chain
+  bool used;
+  bool dirty;
+  bool referenced; // CLOCK bit, set on every access
+} block_cache_entry_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  block_cache_entry_t *entries;
+  unsigned char *data; // capacity blocks, entry i owns block i
+  uint32_t *buckets;   // physical block -> first entry of the chain
+  uint32_t num_buckets;
+  uint32_t capacity;
+  uint32_t hand; // CLOCK hand
+  block_cache_stats_t stats;
+} __attribute__((aligned(64))) block_cache_shard_t;
+
+// Write-back cache of partially written blocks in front of the mapped image. Small writes
+// merge in memory and reach the image on eviction, dirty pressure or an explicit flush.
+// Reads are served from the cache when the block is there and straight from the image otherwise,
+// whole block writes of uncached blocks skip the cache as there is nothing to merge.
+typedef struct {
+  image_t *image;
+  uint32_t block_size;
+  block_cache_shard_t shards[BLOCK_CACHE_SHARDS];
+} block_cache_t;
+
+// budget is the memory for cached block data in bytes, NULL when it is too small for a single block per shard
+block_cache_t *block_cache_new(image_t *image, uint32_t block_size, size_t budget);
+
+// writes every dirty block back before freeing
+void block_cache_free(block_cache_t *cache);
+
+// copies size bytes starting offset bytes into physical block, the range may run over contiguous blocks
+void block_cache_read(block_cache_t *cache, uint32_t physical, uint64_t offset, unsigned char *buffer,
+                      uint64_t size);
+
+void block_cache_write(block_cache_t *cache, uint32_t physical, uint64_t offset, const unsigned char *buffer,
+                       uint64_t size);
+
+// block_cache_write of size zero bytes
+void block_cache_zero(block_cache_t *cache, uint32_t physical, uint64_t offset, uint64_t size);
+
+// writes the dirty blocks of [physical, physical + num_blocks) back to the image
+void block_cache_flush(block_cache_t *cache, uint32_t physical, uint32_t num_blocks);
+
+void block_cache_flush_all(block_cache_t *cache);
+
+// drops freed blocks without writing them back
+void block_cache_invalidate(block_cache_t *cache, uint32_t physical, uint32_t num_blocks);
+
+void block_cache_stats(block_cache_t *cache, block_cache_stats_t *stats);
+
+#endif // FILESYSTEM_BLOCK_CACHE_H
@@ -0,0 +1,64 @@
+#ifndef FILESYSTEM_DENTRY_CACHE_H
+#define FILESYSTEM_DENTRY_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "file.h"
+
+#define DENTRY_CACHE_WAYS 4
+#define DENTRY_CACHE_NAME_LENGTH 32 // longer names are not cached
+#define DENTRY_CACHE_STRIPES 64 // sets share locks and counters round robin
+
+typedef struct {
+  file_t *dir;  // NULL when the entry is empty
+  file_t *file; // NULL for a negative ("not found") entry
+  uint32_t hash;
+  uint32_t length;
+  char name[DENTRY_CACHE_NAME_LENGTH];
+} dentry_t;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+  uint64_t insertions;
+  uint64_t evictions;
+  uint64_t invalidations;
+  uint32_t num_entries;
+  uint32_t capacity;
+} dentry_cache_stats_t;
+
+// a lock and counters of their own per stripe keep concurrent lookups off shared cache lines
+typedef struct {
+  pthread_mutex_t lock;
+  dentry_cache_stats_t stats;
+} __attribute__((aligned(64))) dentry_cache_stripe_t;
+
+// Set-associative cache of (parent directory, component name) -> file lookups.
+typedef struct {
+  dentry_t *entries;
+  uint8_t *victims; // next way to evict, per set
+  uint32_t num_sets;
+  dentry_cache_stripe_t stripes[DENTRY_CACHE_STRIPES];
+} dentry_cache_t;
+
+dentry_cache_t *dentry_cache_new(uint32_t num_entries);
+
+void dentry_cache_free(dentry_cache_t *cache);
+
+bool dentry_cache_lookup(dentry_cache_t *cache, file_t *dir, const char *name, size_t length, uint32_t hash,
+                         file_t **file);
+
+void dentry_cache_insert(dentry_cache_t *cache, file_t *dir, const char *name, size_t length, uint32_t hash,
+                         file_t *file);
+
+void dentry_cache_invalidate(dentry_cache_t *cache, file_t *dir, const char *name, size_t length, uint32_t hash);
+
+void dentry_cache_invalidate_dir(dentry_cache_t *cache, file_t *dir);
+
+void dentry_cache_stats(dentry_cache_t *cache, dentry_cache_stats_t *stats);
+
+#endif // FILESYSTEM_DENTRY_CACHE_H
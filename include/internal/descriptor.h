@@ -2,7 +2,13 @@
 #define FILESYSTEM_DESCRIPTOR_H
 
 #include "stdint.h"
+#include <stdbool.h>
+#include <pthread.h>
+
 #include "linked_list.h"
+#include "dir_index.h"
+#include "extent_map.h"
+#include "arena.h"
 
 typedef enum {
   FS_FILE,
@@ -10,14 +16,29 @@ typedef enum {
   FS_SYMLINK
 } fs_type_t;
 
+// The fields stat, path lookups and small reads touch come first and share one cache line,
+// the descriptors are carved cache line aligned out of their pool, see slab.h.
 typedef struct {
   size_t id;
+  int32_t file_size; // file size in bytes
   fs_type_t type;
+  extent_map_t extents; // logical to physical blocks, files only
+  bool loaded; // directories: the entries were read from the image
+  bool dirty; // queued for the next checkpoint
+  uint32_t num_links; // directory entries naming the file
+  dir_index_t *index; // children, directories only
+  // a symlink's target or the symlinks to a directory, NULL until there is one
   linked_list_t *links;
-  int32_t file_size; // file size in bytes
-} fs_descriptor_t;
+  pthread_rwlock_t lock; // guards the extents and file_size
+} __attribute__((aligned(64))) fs_descriptor_t;
+
+// the descriptor, its lists and trees come from arena
+fs_descriptor_t *fs_descriptor_new(arena_t *arena, size_t id, fs_type_t type, int32_t file_size);
+
+void fs_descriptor_free(arena_t *arena, fs_descriptor_t *descriptor);
 
-fs_descriptor_t *fs_descriptor_new(fs_type_t type, int32_t file_size);
+// the descriptor's links, created on first use
+linked_list_t *fs_descriptor_links(arena_t *arena, fs_descriptor_t *descriptor);
 
 void fs_descriptor_show(fs_descriptor_t *descriptor);
 
@@ -0,0 +1,64 @@
+#ifndef FILESYSTEM_DIR_INDEX_H
+#define FILESYSTEM_DIR_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+#define DIR_INDEX_INLINE_ENTRIES 4 // entries held in the index itself, a directory this small has no table
+
+struct file;
+
+// A directory entry, what listing and storing a directory need without touching the files.
+typedef struct {
+  struct file *file;
+  uint64_t id;
+  uint32_t hash;
+  uint32_t name_length;
+  uint8_t type; // fs_type_t
+} dir_entry_t;
+
+typedef struct {
+  uint32_t hash;
+  uint32_t position; // of the entry, DIR_INDEX_EMPTY or DIR_INDEX_TOMBSTONE for none
+} dir_index_slot_t;
+
+typedef struct {
+  dir_index_slot_t *slots;
+  uint32_t capacity; // power of two
+  uint32_t used;     // live slots and tombstones
+} dir_index_table_t;
+
+// The children of a directory, packed in an entry array, and an open-addressing (linear probing)
+// index of their positions by name. Up to DIR_INDEX_INLINE_ENTRIES entries live in the index
+// itself and are looked up by a scan, bigger directories move them to an array of their own.
+// Removing an entry moves the last one into its place.
+// Growing the table allocates one twice the size and moves the old slots over a
+// few per insert, so no single insert rehashes the whole directory.
+typedef struct {
+  dir_entry_t *entries; // count entries, inline_entries until they outgrow it
+  uint32_t count;
+  uint32_t capacity;
+  dir_index_table_t table; // slots == NULL while the entries are inline
+  dir_index_table_t old_table; // being drained into table, slots == NULL when idle
+  uint32_t migrate_cursor;
+  arena_t *arena; // holds the entries and tables
+  dir_entry_t inline_entries[DIR_INDEX_INLINE_ENTRIES];
+} dir_index_t;
+
+uint32_t dir_index_hash(const char *name, size_t length);
+
+// the index, its entries and tables come from arena, NULL for malloc
+dir_index_t *dir_index_new(arena_t *arena);
+
+void dir_index_free(dir_index_t *dir_index);
+
+struct file *dir_index_find(dir_index_t *dir_index, const char *name, size_t length, uint32_t hash);
+
+// appends an entry for file, its descriptor must be set
+void dir_index_insert(dir_index_t *dir_index, struct file *file);
+
+void dir_index_remove(dir_index_t *dir_index, struct file *file);
+
+#endif // FILESYSTEM_DIR_INDEX_H
@@ -0,0 +1,51 @@
+#ifndef FILESYSTEM_EXTENT_ALLOCATOR_H
+#define FILESYSTEM_EXTENT_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bitmap.h"
+#include "binary_tree.h"
+#include "slab.h"
+
+typedef enum {
+  ALLOC_BEST_FIT,
+  ALLOC_NEXT_FIT
+} alloc_policy_t;
+
+// Free extents indexed twice: by start block for next-fit and coalescing,
+// and by (length, start) for best-fit. The bitmap stays the source of truth
+// and is updated on every allocation and release.
+typedef struct {
+  bitmap_t *bitmap;
+  tree_t by_offset;  // value: start block, num_reserved_bits: length
+  tree_t by_size;    // value: EXTENT_SIZE_KEY(length, start)
+  slab_pool_t nodes; // of both trees
+  alloc_policy_t policy;
+  uint32_t cursor;   // next-fit resumes the search from this block
+  uint32_t num_extents;
+  uint32_t num_free_blocks;
+} extent_allocator_t;
+
+extent_allocator_t *extent_allocator_new(bitmap_t *bitmap, alloc_policy_t policy);
+
+void extent_allocator_free(extent_allocator_t *allocator);
+
+int64_t extent_allocator_alloc(extent_allocator_t *allocator, uint32_t num_blocks);
+
+// claims up to num_blocks free blocks starting exactly at index, returns how many were claimed
+uint32_t extent_allocator_extend(extent_allocator_t *allocator, uint32_t index, uint32_t num_blocks);
+
+// claims exactly [index, index + num_blocks), false if any of it is in use
+bool extent_allocator_claim(extent_allocator_t *allocator, uint32_t index, uint32_t num_blocks);
+
+void extent_allocator_release(extent_allocator_t *allocator, uint32_t index, uint32_t num_blocks);
+
+// first free extent at or after index, its length goes to length; -1 if there is none
+int64_t extent_allocator_next_free(extent_allocator_t *allocator, uint32_t index, uint32_t *length);
+
+// allocates from the lowest free extent which holds num_blocks and starts below limit, whatever the policy;
+// -1 if there is none
+int64_t extent_allocator_alloc_low(extent_allocator_t *allocator, uint32_t num_blocks, uint32_t limit);
+
+#endif // FILESYSTEM_EXTENT_ALLOCATOR_H
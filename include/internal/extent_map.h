@@ -0,0 +1,44 @@
+#ifndef FILESYSTEM_EXTENT_MAP_H
+#define FILESYSTEM_EXTENT_MAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "binary_tree.h"
+#include "block_allocator.h"
+
+// Logical to physical block mapping of a file, one tree node per extent:
+// value: first logical block, index: first physical block, num_reserved_bits: length.
+// Unmapped logical blocks are holes.
+// The first extent is also kept next to the tree so most small files never walk it.
+typedef struct {
+  tree_t tree;
+  uint32_t first_block;
+  uint32_t first_physical;
+  uint32_t first_length; // 0 when nothing is mapped
+} extent_map_t;
+
+void extent_map_init(extent_map_t *map, slab_pool_t *pool);
+
+void extent_map_destroy(extent_map_t *map);
+
+// maps block to its physical block, run gets how many blocks stay contiguous from there;
+// for a hole returns false and run gets the distance to the next extent, UINT32_MAX if none
+bool extent_map_lookup(extent_map_t *map, uint32_t block, uint32_t *physical, uint32_t *run);
+
+// maps logical [block, block + num_blocks) to physical blocks the caller already owns
+void extent_map_add(extent_map_t *map, uint32_t block, uint32_t physical, uint32_t num_blocks);
+
+// maps the unmapped range [block, block + num_blocks), appends grow the previous extent in place
+// when the blocks after it are free, new extents come from group first,
+// returns false when the allocator runs out of blocks
+bool extent_map_allocate(extent_map_t *map, block_allocator_t *blocks, uint32_t group, uint32_t block, uint32_t num_blocks);
+
+// points logical [block, block + num_blocks) at physical instead, old_physical gets where it was mapped;
+// the caller owns both runs and moves the data, false when the range is not one mapped run
+bool extent_map_remap(extent_map_t *map, uint32_t block, uint32_t physical, uint32_t num_blocks, uint32_t *old_physical);
+
+// unmaps every block from block on and hands it back to the allocator
+void extent_map_truncate(extent_map_t *map, block_allocator_t *blocks, uint32_t block);
+
+#endif // FILESYSTEM_EXTENT_MAP_H
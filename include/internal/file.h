@@ -8,19 +8,25 @@
 #include "linked_list.h"
 #include "array_list.h"
 
+// A directory entry. The names of a hard linked file share its descriptor with the file's own entry
+// in the hidden directory of hard linked files.
 typedef struct file {
   fs_descriptor_t *fd;
   char *name;
-  uint32_t content;
-  bool is_link;
-  bool is_opened;
-  array_list_t *open_ids;
+  uint32_t name_hash;
+  uint32_t open_count; // handles in the open file table
+  uint32_t cwd_count; // sessions working in this directory
   struct file *parent_dir;
 } file_t;
 
-file_t *file_new(char *name, bool link);
+// the file and its name come from arena, file_free releases the descriptor along
+file_t *file_new(arena_t *arena, const char *name, size_t length);
 
-void file_free(file_t *file);
+void file_free(arena_t *arena, file_t *file);
+
+void file_dir_add(file_t *dir, file_t *file);
+
+void file_dir_remove(file_t *dir, file_t *file);
 
 file_t *linked_list_file_find_by_name(linked_list_t *linked_list, char *name);
 
@@ -3,7 +3,8 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include "linked_list.h"
+
+#define FILE_PATH_INLINE_TOKENS 16 // deeper paths spill into a heap array
 
 typedef enum {
   PATH_RELATIVE,
@@ -11,18 +12,23 @@ typedef enum {
   PATH_FILE
 } path_type_t;
 
+// a path component, value points into the parsed string and is not NUL-terminated
 typedef struct {
   path_type_t type;
-  char* value;
-  bool is_last;
+  const char *value;
+  uint32_t length;
 } path_token_t;
 
 typedef struct {
-  linked_list_t *token_types;
-  char* name;
+  path_token_t inline_tokens[FILE_PATH_INLINE_TOKENS];
+  path_token_t *tokens;
+  uint32_t num_tokens;
+  uint32_t capacity;
   bool is_absolute;
 } path_parse_t;
 
-path_parse_t *file_path_parse(char *path);
+bool file_path_parse(const char *path, path_parse_t *path_parse);
+
+void file_path_parse_free(path_parse_t *path_parse);
 
 #endif //FILESYSTEM_FILE_PATH_H
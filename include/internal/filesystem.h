@@ -2,55 +2,237 @@
 #define FILESYSTEM_FS_DRIVER_H
 
 #include "stdbool.h"
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #include "file.h"
 #include "internal/linked_list.h"
 #include "binary_tree.h"
-#include "bitmap.h"
+#include "block_allocator.h"
+#include "extent_map.h"
+#include "open_file_table.h"
+#include "dentry_cache.h"
+#include "image.h"
+#include "block_cache.h"
+#include "journal.h"
+#include "inode_table.h"
+#include "snapshot.h"
+#include "array_list.h"
+#include "arena.h"
+#include "stats.h"
+
+#define FS_INVALID_FD (-1)
+
+// A span of file data straight in the mapped image, data is NULL for a hole which reads as zeros.
+// Spans stay valid until the range is truncated away, moved by fs_compact or by a write to blocks a snapshot
+// shares, or the filesystem is unmounted.
+typedef struct {
+  const unsigned char *data;
+  size_t length;
+} fs_view_t;
+
+#define FS_FRAG_BUCKETS 32
+
+typedef struct {
+  block_free_runs_t free;
+  uint64_t num_files; // regular files, a hard linked one once
+  uint64_t num_extents;
+  uint64_t max_extents; // of a single file
+  uint64_t extents[FS_FRAG_BUCKETS]; // bucket i counts files of [2^i, 2^(i+1)) extents, empty files are left out
+} fs_frag_report_t;
 
 typedef struct {
-  bitmap_t *bitmap;
-  tree_t *bst;
-  linked_list_t *files;
-  uint32_t max_num_fd;
-  uint32_t num_files;
+  uint64_t files; // files looked at
+  uint64_t extents_moved;
+  uint64_t blocks_moved;
+  bool wrapped; // the pass reached the last inode and starts over on the next call
+} fs_compact_result_t;
+
+// Locking: lock guards the namespace, the open file table and mount state, it is held
+// shared by lookups and data operations and exclusively by anything that changes them.
+// File data is guarded by the per-descriptor lock, block allocation by the allocation group locks.
+// Every metadata change is logged to the journal while the change is made, under the same locks.
+// Inodes are read from the image on first use: a directory's entries when it is first looked into,
+// any other inode through its directory; load_lock serializes the loading.
+// Files, names and directory tables come from the arena, which is used under lock held exclusively
+// or under load_lock; only its extent nodes are allocated by data operations.
+typedef struct {
+  pthread_rwlock_t lock;
+  uint32_t num_sessions;
+  uint64_t mount_generation; // bumped on every mount, stale session cwds go back to root
+  size_t next_fd_id;
+  block_allocator_t *blocks;
+  alloc_policy_t alloc_policy;
+  open_file_table_t *open_files;
+  dentry_cache_t *dcache;
+  file_t *root;
+  file_t *links_dir; // holds symlinks, reachable by no path
+  file_t *inodes_dir; // holds hard linked files named by number, reachable by no path
+  arena_t *arena; // freed as a whole on unmount
+  file_t **inodes; // loaded files by id, NULL for ids not loaded yet or free
+  uint64_t inodes_capacity; // grows with next_fd_id
+  uint64_t num_inodes;
+  array_list_t *free_ids; // ids freed since the mount, reused newest first
+  size_t inode_scan; // next id the allocation checks for a slot freed before the mount
+  size_t compact_cursor; // next id fs_compact looks at
+  pthread_mutex_t load_lock;
+  array_list_t *dirty; // ids of inodes changed since the last checkpoint
+  pthread_mutex_t dirty_lock;
+  uint32_t max_num_fd; // most regular files, 0 for as many as there are inodes
+  uint64_t num_files;
   bool format;
   bool mount;
-  unsigned char *storage;
+  char *image_path;
+  image_t *image;
+  uint32_t block_size;
+  uint64_t num_blocks;
+  unsigned char *storage; // data region of the mapped image
+  block_cache_t *cache; // NULL when the budget is too small for a cache
+  size_t cache_budget;
+  journal_t *journal;
+  uint32_t commit_interval_us;
+  snapshot_table_t *snapshots;
+  snapshot_view_t *view; // the snapshot mounted read only, NULL when the tree is mounted
 } filesystem_t;
 
-int fs_mkfs(int num_fd);
+// A session on a filesystem instance, with its own working directory.
+// Sessions may run concurrently, one session is used by one thread at a time.
+typedef struct {
+  filesystem_t *fs;
+  file_t *cwd;
+  uint64_t mount_generation;
+  bool quiet; // no status output
+  uint64_t commit_lsn; // last record logged by the running call, committed once the lock is dropped
+  uint64_t commit_generation;
+  bool checkpoint; // the running call found the log full
+#ifdef FS_STATS
+  fs_op_t stats_op; // the running call
+  uint64_t stats_start;
+  uint64_t stats_bytes;
+#endif
+} fs_ctx_t;
+
+typedef struct {
+  const char *image_path;
+  uint64_t image_size;
+  uint32_t block_size; // power of two
+  int num_fd; // most regular files, 0 for as many as there are inodes
+  alloc_policy_t alloc_policy;
+  uint64_t journal_size;
+  uint64_t num_inodes; // 0 takes one per FS_BYTES_PER_INODE bytes of image
+} fs_mkfs_options_t;
+
+// creates an unformatted filesystem instance and its first session
+fs_ctx_t *fs_ctx_new();
+
+// opens another session on the instance ctx belongs to
+fs_ctx_t *fs_ctx_session(fs_ctx_t *ctx);
+
+// closes the session, the instance is unmounted and freed with its last session
+void fs_ctx_free(fs_ctx_t *ctx);
+
+void fs_ctx_set_quiet(fs_ctx_t *ctx, bool quiet);
+
+void fs_mkfs_options_init(fs_mkfs_options_t *options);
+
+// creates and formats the image file, it is mounted with fs_mount
+int fs_mkfs(fs_ctx_t *ctx, const fs_mkfs_options_t *options);
+
+// maps image_path, or the image of the last fs_mkfs when NULL
+int fs_mount(fs_ctx_t *ctx, const char *image_path);
+
+// mounts the snapshot called name of image_path read only, it is left with fs_unmount
+int fs_mount_snapshot(fs_ctx_t *ctx, const char *image_path, const char *name);
+
+int fs_unmount(fs_ctx_t *ctx);
+
+// shows the inode with number id
+int fs_fstat(fs_ctx_t *ctx, uint64_t id);
+
+int fs_ls(fs_ctx_t *ctx);
+
+int fs_create(fs_ctx_t *ctx, char *path);
+
+// makes path1 another name of the file at path2, the names share one inode and its data
+int fs_link(fs_ctx_t *ctx, char *path1, char *path2);
+
+// removes a name of a file, the file and its blocks go with its last name
+int fs_unlink(fs_ctx_t *ctx, char *name);
+
+// sizes go up to INT32_MAX bytes, the file size is stored as an int32_t
+int fs_truncate(fs_ctx_t *ctx, char *path, uint32_t size);
+
+// returns an open file handle, FS_INVALID_FD on failure
+int fs_open(fs_ctx_t *ctx, char *path);
+
+// syncs the file's blocks back to the image before the handle goes away
+int fs_close(fs_ctx_t *ctx, int fd);
+
+// hints how an open file is about to be accessed
+int fs_advise(fs_ctx_t *ctx, int fd, image_advice_t advice);
+
+int fs_read(fs_ctx_t *ctx, int fd, uint32_t offset, uint32_t size);
+
+// fails if the write would end past INT32_MAX bytes
+int fs_write(fs_ctx_t *ctx, int fd, char *buffer, uint32_t offset, uint32_t size);
+
+// reads up to size bytes at offset, returns the number of bytes read, short at the end of the file, -1 on error
+ssize_t fs_pread(fs_ctx_t *ctx, int fd, void *buffer, size_t size, uint64_t offset);
+
+// writes size bytes at offset, growing the file, returns size or -1 if nothing was written; offset and size
+// are 64 bit but a file ends at INT32_MAX bytes, a write past it fails with "File too large"
+ssize_t fs_pwrite(fs_ctx_t *ctx, int fd, const void *buffer, size_t size, uint64_t offset);
+
+// fs_pread scattering into iovcnt buffers in order
+ssize_t fs_readv(fs_ctx_t *ctx, int fd, const struct iovec *iov, int iovcnt, uint64_t offset);
+
+// fs_pwrite gathering from iovcnt buffers in order, as one write, the lengths add up to at most INT32_MAX
+ssize_t fs_writev(fs_ctx_t *ctx, int fd, const struct iovec *iov, int iovcnt, uint64_t offset);
 
-int fs_mount();
+// fills up to max_views spans covering [offset, offset + size) without copying, one per extent or hole,
+// returns the number of spans, -1 on error
+int fs_read_view(fs_ctx_t *ctx, int fd, uint64_t offset, size_t size, fs_view_t *views, int max_views);
 
-int fs_unmount();
+int fs_cd(fs_ctx_t *ctx, char *path);
 
-int fs_fstat(int id);
+int fs_mkdir(fs_ctx_t *ctx, char *path);
 
-int fs_ls();
+int fs_rmdir(fs_ctx_t *ctx, char *path);
 
-int fs_create(char *path);
+int fs_symlink(fs_ctx_t *ctx, char* str, char* path);
 
-int fs_link(char *path1, char *path2);
+int fs_dcache_stats(fs_ctx_t *ctx, dentry_cache_stats_t *stats);
 
-int fs_unlink(char *name);
+// writes every cached dirty block back, commits the journal and syncs the image
+int fs_sync(fs_ctx_t *ctx);
 
-int fs_truncate(char *path, uint32_t size);
+// memory for the block cache in bytes, a mounted filesystem flushes and rebuilds its cache
+int fs_set_cache_budget(fs_ctx_t *ctx, size_t budget);
 
-int fs_open(char *path);
+int fs_bcache_stats(fs_ctx_t *ctx, block_cache_stats_t *stats);
 
-int fs_close(int fd);
+// how long metadata changes may wait for the journal commit, 0 commits before every call returns
+int fs_set_commit_interval(fs_ctx_t *ctx, uint32_t commit_interval_us);
 
-int fs_read(int fd, uint32_t offset, uint32_t size);
+int fs_journal_stats(fs_ctx_t *ctx, journal_stats_t *stats);
 
-int fs_write(int fd, char *buffer, uint32_t offset, uint32_t size);
+// free space and extent counts, every allocation group is loaded and so is every file with more than one extent
+int fs_frag_report(fs_ctx_t *ctx, fs_frag_report_t *report);
 
-int fs_cd(char *path);
+// moves file data toward the start of the data region for about budget_us, picking up where the last call
+// stopped: extents a file has back to back are gathered into one run, single runs move down into the lowest
+// free run that holds them; files busy with other calls are skipped; result may be NULL
+int fs_compact(fs_ctx_t *ctx, uint32_t budget_us, fs_compact_result_t *result);
 
-int fs_mkdir(char *path);
+// freezes the mounted tree as a snapshot called name, sharing its inodes and blocks; a write to a shared block
+// copies the blocks it touches first
+int fs_snapshot(fs_ctx_t *ctx, const char *name);
 
-int fs_rmdir(char *path);
+// deletes a snapshot, the blocks only it used are freed
+int fs_snapshot_delete(fs_ctx_t *ctx, const char *name);
 
-int fs_symlink(char* str, char* path);
+// the call counters of the whole process, FS_FAILURE and zeros when they are compiled out
+int fs_stats_snapshot(fs_stats_t *stats);
 
 #endif //FILESYSTEM_FS_DRIVER_H
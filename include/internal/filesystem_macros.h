@@ -1,9 +1,26 @@
 #ifndef FILESYSTEM_FILESYSTEM_MACROS_H
 #define FILESYSTEM_FILESYSTEM_MACROS_H
 
-#define FS_BYTES_PER_BITMAP_BIT 16
+#define FS_DEFAULT_IMAGE_PATH "filesystem.img"
+#define FS_DEFAULT_IMAGE_SIZE (64ull << 20)
+#define FS_DEFAULT_BLOCK_SIZE 4096
+#define FS_MIN_BLOCK_SIZE 16
+#define FS_MAX_BLOCK_SIZE (1u << 20)
+#define FS_MAX_NUM_BLOCKS (1u << 31) // block numbers are 32 bit
 #define FS_BYTES_PER_BITMAP_BYTE 128
-#define FS_MAX_NUM_DESCRIPTORS 20 // Max number of files
+#define FS_DENTRY_CACHE_ENTRIES 4096
+#define FS_DEFAULT_BLOCK_CACHE_SIZE (8u << 20) // bytes of cached block data
+#define FS_DEFAULT_JOURNAL_SIZE (4ull << 20)
+#define FS_DEFAULT_COMMIT_INTERVAL_US 5000
+#define FS_CHECKPOINT_LOCK_WAIT_NS 10000000 // the commit thread retries the lock for a checkpoint this often
+#define FS_BYTES_PER_INODE 8192
+#define FS_MAX_NUM_INODES (1ull << 48) // keeps the inode table offsets far from overflowing 64 bits
+#define FS_ROOT_ID 0
+#define FS_LINKS_ID 1 // the hidden directory of symlinks
+#define FS_INODES_ID 2 // the hidden directory of hard linked files
+#define FS_FIRST_FILE_ID 3
+#define FS_MIN_INODES_CAPACITY 1024 // loaded inodes table entries at mount, it doubles from there
+#define FS_INODE_SCAN_STEP 64 // table slots an allocation checks for numbers freed before the mount
 
 #if defined(__clang__)
 #define FS_COMPILER_CLANG
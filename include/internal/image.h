@@ -0,0 +1,139 @@
+#ifndef FILESYSTEM_IMAGE_H
+#define FILESYSTEM_IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IMAGE_MAGIC 0x31474d4953465346ull // "FSFSIMG1"
+#define IMAGE_VERSION 5
+#define IMAGE_HEADER_SIZE 4096 // the journal, the metadata tables and the data region start on block boundaries after it
+#define IMAGE_NO_INODE UINT64_MAX
+#define IMAGE_NO_BLOCK UINT32_MAX
+#define IMAGE_INODE_EXTENTS 6 // extents kept in the inode itself, the rest go to its blob
+#define IMAGE_INODE_USED 1
+#define IMAGE_MAX_SNAPSHOTS 32
+#define IMAGE_SNAPSHOT_NAME_SIZE 32
+
+typedef enum {
+  IMAGE_ADVICE_NORMAL,
+  IMAGE_ADVICE_SEQUENTIAL,
+  IMAGE_ADVICE_RANDOM
+} image_advice_t;
+
+// first bytes of the image file
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t image_size;
+  uint64_t data_offset;
+  uint64_t num_blocks;
+  uint32_t max_num_fd;
+  uint32_t alloc_policy;
+  uint64_t journal_offset;
+  uint64_t journal_size;  // two halves, one of them holds the live log
+  uint64_t journal_epoch; // bumped by every checkpoint, older records are ignored
+  uint32_t journal_active; // the half with the live log
+  uint32_t tables_active;  // the copy of the inode map and of the block bitmap written by the last checkpoint
+  uint64_t inode_table_offset; // two image_inode_t slots per inode number
+  uint64_t num_inodes;
+  uint64_t inode_map_offset; // two copies, a set bit selects the second slot of an inode
+  uint64_t inode_map_size;   // bytes per copy
+  uint64_t bitmap_offset;    // two copies, a set bit marks a used block of the data region
+  uint64_t bitmap_size;      // bytes per copy
+  uint64_t snapshot_offset;  // two copies of the snapshot table
+  uint64_t snapshot_size;    // bytes per copy, room for IMAGE_MAX_SNAPSHOTS image_snapshot_t
+  uint64_t kept_offset;      // two copies of bitmap_size bytes, a set bit marks a used block the tree does not use
+  uint64_t next_id;          // as of the last checkpoint, the journal may have used more
+  uint64_t num_files;
+  uint32_t num_snapshots;    // in the table copy selected by tables_active, oldest first
+  uint32_t reserved;
+} image_header_t;
+
+typedef struct {
+  uint32_t logical;
+  uint32_t physical;
+  uint32_t length;
+} image_extent_t;
+
+// An inode as of the checkpoint which wrote it. A checkpoint writes the slot the inode map does not
+// select and flips the bit in the other map copy, so the old slot stays valid until the header switches.
+typedef struct {
+  uint64_t parent;      // directory holding the entry, IMAGE_NO_INODE for the root
+  uint64_t target;      // directory of a symlink, IMAGE_NO_INODE if none
+  uint64_t size;
+  uint32_t blob;        // first block of a chain of image_blob_t, IMAGE_NO_BLOCK if none
+  uint32_t num_entries; // extents of a file, entries of a directory
+  uint16_t type;        // fs_type_t
+  uint16_t flags;       // IMAGE_INODE_*
+  image_extent_t extents[IMAGE_INODE_EXTENTS]; // the rest, as image_extent_t, in the blob
+  uint32_t num_links;   // directory entries naming the inode
+  uint64_t generation;  // journal epoch of the checkpoint which wrote the slot
+  uint64_t reserved;
+} image_inode_t;
+
+// Starts every block of a blob, length bytes of payload follow. A directory's payload is its entries:
+// an image_dirent_t followed by name_length bytes of name each.
+typedef struct {
+  uint32_t next; // IMAGE_NO_BLOCK ends the chain
+  uint32_t length;
+} image_blob_t;
+
+typedef struct {
+  uint64_t id;
+  uint32_t name_length;
+  uint32_t reserved;
+} image_dirent_t;
+
+// A point in time copy of the tree, sharing the inode table and the blocks with it. Its inodes are the current
+// slots of a lower generation; a checkpoint about to make such a slot stale appends it to the inodes blob first.
+// The blocks it uses are set in its bitmap and stay allocated while it exists, released ones are marked kept.
+typedef struct {
+  char name[IMAGE_SNAPSHOT_NAME_SIZE]; // NUL padded
+  uint64_t generation; // journal epoch after the checkpoint which froze the tree
+  uint64_t next_id;
+  uint64_t num_files;
+  uint64_t num_inodes;  // entries of inodes
+  uint32_t inodes;      // blob of image_snapshot_inode_t, IMAGE_NO_BLOCK if none
+  uint32_t inodes_last; // last block of inodes, the next checkpoint appends there
+  uint32_t inodes_tail; // payload bytes of inodes_last in use, anything past them is left from a crash
+  uint32_t bitmap;      // blob of one word per 64 blocks, laid out like the block bitmap
+} image_snapshot_t;
+
+typedef struct {
+  uint64_t id;
+  image_inode_t inode;
+} image_snapshot_inode_t;
+
+// An image file mapped shared as a whole, pages fault in on first access.
+typedef struct {
+  int fd;
+  unsigned char *base;
+  uint64_t size;
+  image_header_t *header;
+  unsigned char *data;
+} image_t;
+
+// creates a sparse image file from a header with image_size, block_size, max_num_fd, alloc_policy,
+// journal_size and num_inodes filled in, the layout fields are computed here;
+// tables of zeros hold no inodes and no used blocks
+bool image_create(const char *path, image_header_t *header);
+
+// maps an existing image, returns NULL if the file is missing or not an image
+image_t *image_open(const char *path);
+
+// syncs and unmaps the image
+void image_close(image_t *image);
+
+// hints the kernel about the access pattern of a range of the data region
+void image_advise(image_t *image, uint64_t offset, uint64_t length, image_advice_t advice);
+
+// writes a dirty range of the data region back to the file, synchronously
+bool image_sync(image_t *image, uint64_t offset, uint64_t length);
+
+// like image_sync, for a range given from the start of the file
+bool image_sync_range(image_t *image, uint64_t offset, uint64_t length);
+
+bool image_sync_all(image_t *image);
+
+#endif // FILESYSTEM_IMAGE_H
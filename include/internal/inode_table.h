@@ -0,0 +1,69 @@
+#ifndef FILESYSTEM_INODE_TABLE_H
+#define FILESYSTEM_INODE_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "image.h"
+#include "block_allocator.h"
+
+// Inode slots and blobs of a mapped image, see image_inode_t. The copy of the inode map named by
+// tables_active selects the current slots, a checkpoint builds the other copy while it writes.
+
+// the slot of id written by the last checkpoint, a slot without IMAGE_INODE_USED is a free inode
+image_inode_t *inode_table_current(image_t *image, uint64_t id);
+
+// starts a checkpoint, the map copy being built begins as the current one
+void inode_table_begin(image_t *image);
+
+// the slot the running checkpoint writes id to, NULL if it wrote id already
+image_inode_t *inode_table_next(image_t *image, uint64_t id);
+
+// the block bitmap copy the running checkpoint writes
+uint64_t *inode_table_next_bitmap(image_t *image);
+
+// the block bitmap copy of the last checkpoint
+const uint64_t *inode_table_current_bitmap(image_t *image);
+
+// reads a blob front to back
+typedef struct {
+  image_t *image;
+  uint32_t block; // IMAGE_NO_BLOCK past the end
+  uint32_t position; // payload bytes of block already read
+} inode_blob_reader_t;
+
+void inode_blob_reader_init(inode_blob_reader_t *reader, image_t *image, uint32_t block);
+
+// false if the blob ends, or turns out broken, before length bytes
+bool inode_blob_read(inode_blob_reader_t *reader, void *buffer, size_t length);
+
+// appends to a new blob, blocks come from the allocator and follow each other where they are free
+typedef struct {
+  image_t *image;
+  block_allocator_t *blocks;
+  uint32_t group;
+  uint32_t first; // IMAGE_NO_BLOCK until something is written
+  uint32_t block;
+  bool kept; // the blocks are marked kept as they are allocated, see block_allocator_keep
+} inode_blob_writer_t;
+
+void inode_blob_writer_init(inode_blob_writer_t *writer, image_t *image, block_allocator_t *blocks, uint32_t group);
+
+// appends to the blob at first instead, after length payload bytes of its last block; whatever followed them
+// is dropped, blocks past last included, which only a crash leaves behind and the allocator has free
+void inode_blob_writer_resume(inode_blob_writer_t *writer, uint32_t first, uint32_t last, uint32_t length);
+
+// payload bytes of the block written last
+uint32_t inode_blob_writer_tail(const inode_blob_writer_t *writer);
+
+// false if the allocator runs out of blocks, the blob written so far stays allocated
+bool inode_blob_write(inode_blob_writer_t *writer, const void *data, size_t length);
+
+// gives the blocks of a blob back to the allocator
+void inode_blob_release(image_t *image, block_allocator_t *blocks, uint32_t block);
+
+// ends a blob after length payload bytes of block, the blocks which followed go back to the allocator
+void inode_blob_truncate(image_t *image, block_allocator_t *blocks, uint32_t block, uint32_t length);
+
+#endif // FILESYSTEM_INODE_TABLE_H
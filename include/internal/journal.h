@@ -0,0 +1,121 @@
+#ifndef FILESYSTEM_JOURNAL_H
+#define FILESYSTEM_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "image.h"
+
+#define JOURNAL_RECORD_MAGIC 0x4c4e524au // "JRNL"
+#define JOURNAL_CHECKPOINT_PERCENT 75 // a half filled past this asks for a checkpoint
+
+typedef enum {
+  JOURNAL_CREATE = 1, // id, parent, type, name
+  JOURNAL_REMOVE,     // id, directory, name
+  JOURNAL_LINK,       // id, directory, name
+  JOURNAL_SYMLINK,    // id, directory, name
+  JOURNAL_EXTENT,     // id, first logical block, first physical block, length
+  JOURNAL_SIZE,       // id, size
+  JOURNAL_TRUNCATE,   // id, size
+  JOURNAL_MOVE        // id, first logical block, new first physical block, length
+} journal_type_t;
+
+// A redo record, followed by name_length bytes of name and padded to 8 bytes.
+typedef struct {
+  uint32_t magic;
+  uint32_t checksum;      // of everything after this field, name included
+  uint32_t prev_checksum; // chains the records of a half, a torn or stale tail breaks the chain
+  uint16_t type;
+  uint16_t name_length;
+  uint64_t epoch;
+  uint64_t lsn;
+  uint64_t args[4];
+} journal_record_t;
+
+typedef struct {
+  uint64_t records;
+  uint64_t bytes;
+  uint64_t commits;     // syncs of the log, each covers every record appended before it
+  uint64_t checkpoints;
+  uint64_t replayed;    // records applied at mount
+  uint64_t dropped;     // records which found the log full, the next checkpoint covers them
+} journal_stats_t;
+
+// applies one record while the log is replayed
+typedef void (*journal_apply_t)(void *arg, const journal_record_t *record, const char *name);
+
+// writes the owner's metadata tables and syncs them, then fills in the owner's fields of the header copy
+// which the checkpoint switches to; false keeps the current tables and log
+typedef bool (*journal_snapshot_t)(void *arg, image_header_t *header);
+
+// asks the owner for a checkpoint from the commit thread, the owner may decline when busy
+typedef void (*journal_request_t)(void *arg);
+
+// Metadata redo log in the journal region of the image. Records are appended in memory order to
+// the mapped log and become durable together on the next commit (group commit): either every
+// commit_interval_us from a background thread, or, with an interval of 0, before the operation returns.
+// A checkpoint has the owner write its metadata tables, then switches to the other, empty half
+// with the same header write that makes the new tables current.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t flushed; // durable_lsn moved
+  pthread_cond_t wake;    // wakes the commit thread
+  pthread_t thread;
+  bool attached;
+  bool stop;
+  bool flushing;
+  bool overflow;
+  image_t *image;
+  uint64_t half_size;
+  uint32_t active;
+  uint64_t epoch;
+  uint64_t generation; // bumped per attach, commits of an older mount return at once
+  uint64_t head;       // bytes appended to the active half
+  uint64_t committed;  // bytes of the active half known to be durable
+  uint64_t next_lsn;
+  uint64_t durable_lsn;
+  uint32_t prev_checksum;
+  uint32_t commit_interval_us;
+  journal_request_t request;
+  void *request_arg;
+  journal_stats_t stats;
+} journal_t;
+
+journal_t *journal_new();
+
+void journal_free(journal_t *journal);
+
+// binds the journal to a mounted image and replays its log through apply
+void journal_attach(journal_t *journal, image_t *image, journal_apply_t apply, void *apply_arg);
+
+// starts the commit thread, request is called when the log wants a checkpoint
+void journal_start(journal_t *journal, journal_request_t request, void *request_arg);
+
+// commits what is left and unbinds the image
+void journal_detach(journal_t *journal);
+
+// true once detaching has begun, a request waiting for its owner's locks should give up then
+bool journal_stopping(journal_t *journal);
+
+void journal_set_commit_interval(journal_t *journal, uint32_t commit_interval_us);
+
+// returns the record's lsn, 0 if the log is full or detached
+uint64_t journal_append(journal_t *journal, journal_type_t type, uint64_t arg0, uint64_t arg1, uint64_t arg2,
+                        uint64_t arg3, const char *name, size_t name_length);
+
+// waits until lsn is durable, returns at once when commits are periodic
+void journal_commit(journal_t *journal, uint64_t lsn, uint64_t generation);
+
+// makes every appended record durable
+void journal_sync(journal_t *journal);
+
+bool journal_needs_checkpoint(journal_t *journal);
+
+// nothing may append while the snapshot runs, false if the journal is detached or the snapshot failed
+bool journal_checkpoint(journal_t *journal, journal_snapshot_t snapshot, void *arg);
+
+void journal_stats(journal_t *journal, journal_stats_t *stats);
+
+#endif // FILESYSTEM_JOURNAL_H
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "slab.h"
+
 typedef struct node {
   void *value;
   struct node *next;
@@ -15,10 +17,23 @@ typedef struct {
   node_t *head;
   node_t *tail;
   uint32_t count;
+  slab_pool_t *pool; // where the nodes come from, NULL for malloc
 } linked_list_t;
 
+inline static node_t *linked_list_node_new(linked_list_t *linked_list) {
+  return linked_list->pool ? (node_t *) slab_pool_alloc(linked_list->pool) : (node_t *) malloc(sizeof(node_t));
+}
+
+inline static void linked_list_node_free(linked_list_t *linked_list, node_t *node) {
+  if (linked_list->pool) {
+    slab_pool_release(linked_list->pool, node);
+  } else {
+    free(node);
+  }
+}
+
 static void linked_list_push(linked_list_t *linked_list, void *value) {
-  node_t *node = malloc(sizeof(node_t));
+  node_t *node = linked_list_node_new(linked_list);
   node->next = NULL;
   node->value = value;
   if (!linked_list->head) {
@@ -36,18 +51,23 @@ static void linked_list_free(linked_list_t *linked_list) {
   while (linked_list->head) {
     temp = linked_list->head;
     linked_list->head = linked_list->head->next;
-    free(temp);
+    linked_list_node_free(linked_list, temp);
   }
   linked_list->head = NULL;
   linked_list->tail = NULL;
   linked_list->count = 0;
 }
 
-static linked_list_t *linked_list_new() {
-  linked_list_t *linked_list = malloc(sizeof(linked_list_t));
+static void linked_list_init(linked_list_t *linked_list, slab_pool_t *pool) {
   linked_list->head = NULL;
   linked_list->tail = NULL;
   linked_list->count = 0;
+  linked_list->pool = pool;
+}
+
+static linked_list_t *linked_list_new() {
+  linked_list_t *linked_list = malloc(sizeof(linked_list_t));
+  linked_list_init(linked_list, NULL);
   return linked_list;
 }
 
@@ -105,6 +125,29 @@ static bool linked_list_remove_if(linked_list_t *linked_list, bool (*func)(void
   return false;
 }
 
+static bool linked_list_remove(linked_list_t *linked_list, void *value) {
+  node_t *current = linked_list->head;
+  node_t *previous = NULL;
+  while (current) {
+    if (current->value == value) {
+      if (previous) {
+        previous->next = current->next;
+      } else {
+        linked_list->head = current->next;
+      }
+      if (linked_list->tail == current) {
+        linked_list->tail = previous;
+      }
+      linked_list->count--;
+      linked_list_node_free(linked_list, current);
+      return true;
+    }
+    previous = current;
+    current = current->next;
+  }
+  return false;
+}
+
 #define CREATE_LINKED_LIST_FOREACH_FIRST_TYPE(TYPE)                                                                     \
 static bool linked_list_foreach_first_arg_##TYPE(linked_list_t *linked_list, bool (*func)(void *, TYPE), TYPE value) {  \
   node_t *current = linked_list->head;                                                                                  \
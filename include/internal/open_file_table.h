@@ -0,0 +1,42 @@
+#ifndef FILESYSTEM_OPEN_FILE_TABLE_H
+#define FILESYSTEM_OPEN_FILE_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "file.h"
+
+#define OPEN_FILE_SLOT_BITS 20
+#define OPEN_FILE_GENERATION_BITS 11 // handles stay positive ints
+#define OPEN_FILE_MAX_SLOTS (1u << OPEN_FILE_SLOT_BITS)
+
+#define OPEN_FILE_READ  0x1
+#define OPEN_FILE_WRITE 0x2
+
+typedef struct {
+  file_t *file; // NULL when the slot is free
+  uint32_t offset;
+  uint32_t flags;
+  uint32_t generation; // bumped on close, so old handles to the slot go stale
+  int32_t next_free;
+} open_file_t;
+
+// Open handles encode (generation, slot), resolving one is a single array access.
+typedef struct {
+  open_file_t *slots;
+  uint32_t capacity;
+  uint32_t count;
+  int32_t free_head;
+} open_file_table_t;
+
+open_file_table_t *open_file_table_new();
+
+void open_file_table_free(open_file_table_t *table);
+
+int open_file_table_open(open_file_table_t *table, file_t *file, uint32_t flags);
+
+open_file_t *open_file_table_get(open_file_table_t *table, int fd);
+
+bool open_file_table_close(open_file_table_t *table, int fd);
+
+#endif // FILESYSTEM_OPEN_FILE_TABLE_H
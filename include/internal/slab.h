@@ -0,0 +1,36 @@
+#ifndef FILESYSTEM_SLAB_H
+#define FILESYSTEM_SLAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define SLAB_SIZE 16384 // bytes per slab, objects are carved out of it as they are needed
+
+// Pool of same-size objects. Objects come off a free list first and are carved out of the
+// newest slab otherwise; a released object goes back on the free list, slabs are only given
+// back by slab_pool_destroy, all of them at once. A pool which is not shared is not thread safe,
+// its owner serializes the calls. Objects whose size is a multiple of 64 bytes start on a cache line.
+typedef struct {
+  size_t object_size;
+  void *free_list; // released objects, chained through their first word
+  unsigned char *next; // next uncarved object of the newest slab
+  unsigned char *end;
+  void *slabs; // chained through their first word, newest first
+  uint32_t num_slabs;
+  uint32_t num_objects; // live objects
+  bool shared;
+  pthread_mutex_t lock; // shared pools only
+} slab_pool_t;
+
+void slab_pool_init(slab_pool_t *pool, size_t object_size, bool shared);
+
+// frees every slab, objects still handed out go with them
+void slab_pool_destroy(slab_pool_t *pool);
+
+void *slab_pool_alloc(slab_pool_t *pool);
+
+void slab_pool_release(slab_pool_t *pool, void *object);
+
+#endif // FILESYSTEM_SLAB_H
@@ -0,0 +1,70 @@
+#ifndef FILESYSTEM_SNAPSHOT_H
+#define FILESYSTEM_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "image.h"
+#include "block_allocator.h"
+#include "array_list.h"
+
+// The snapshots of a mounted image and the blocks they hold, see image_snapshot_t. Every checkpoint writes
+// the table and the kept bitmap to the copies tables_active does not select, like the inode map.
+// A block's references are the tree, unless it is kept, and every snapshot whose bitmap has it.
+typedef struct {
+  image_t *image;
+  block_allocator_t *blocks; // shares held and kept
+  image_snapshot_t entries[IMAGE_MAX_SNAPSHOTS]; // oldest first
+  uint32_t count;
+  size_t num_words; // of a bitmap, one per 64 blocks
+  uint64_t *held; // the bitmaps of all snapshots or-ed together, NULL without snapshots
+  uint64_t *kept; // NULL without snapshots
+  array_list_t *released; // runs of deleted snapshots as start and length, freed by the next checkpoint
+  array_list_t *blobs; // blobs of deleted snapshots, freed by the next checkpoint
+} snapshot_table_t;
+
+// loads the table of the last checkpoint and hands its bitmaps to blocks, NULL if a snapshot is broken
+snapshot_table_t *snapshot_table_new(image_t *image, block_allocator_t *blocks);
+
+void snapshot_table_free(snapshot_table_t *table);
+
+// index of the snapshot named name, -1 if there is none
+int snapshot_table_find(const snapshot_table_t *table, const char *name);
+
+// freezes the tree the last checkpoint wrote: its blocks are the used ones which are not kept, its inodes the
+// slots written before generation; the next checkpoint makes it durable; false if the table is full or
+// there is no space for the bitmap
+bool snapshot_table_add(snapshot_table_t *table, const char *name, uint64_t generation, uint64_t next_id,
+                        uint64_t num_files);
+
+// drops a snapshot, the blocks no other one holds and the tree does not use are queued for the next checkpoint
+void snapshot_table_remove(snapshot_table_t *table, uint32_t index);
+
+// a checkpoint is about to write id's other slot, making current stale: every snapshot current belongs to
+// gets a copy of it; false if there is no space for the copies
+bool snapshot_table_preserve(snapshot_table_t *table, uint64_t id, const image_inode_t *current);
+
+// frees what deleted snapshots left behind, a checkpoint calls it once it allocated everything it writes
+void snapshot_table_release(snapshot_table_t *table);
+
+// writes the table and the kept bitmap to the copies the running checkpoint makes current
+void snapshot_table_save(snapshot_table_t *table);
+
+// The inodes of one snapshot, for mounting it read only.
+typedef struct {
+  image_t *image;
+  uint64_t generation;
+  image_snapshot_inode_t *inodes; // sorted by id, overwritten slots which belonged to the snapshot
+  uint64_t num_inodes;
+} snapshot_view_t;
+
+// reads the snapshot's copies of overwritten slots, NULL if they are broken
+snapshot_view_t *snapshot_view_new(image_t *image, const image_snapshot_t *entry);
+
+void snapshot_view_free(snapshot_view_t *view);
+
+// id's slot as of the snapshot, one without IMAGE_INODE_USED if the inode was free then
+const image_inode_t *snapshot_view_slot(const snapshot_view_t *view, uint64_t id);
+
+#endif // FILESYSTEM_SNAPSHOT_H
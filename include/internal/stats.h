@@ -0,0 +1,102 @@
+#ifndef FILESYSTEM_STATS_H
+#define FILESYSTEM_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// the instrumented fs_* calls
+typedef enum {
+  FS_OP_MKFS,
+  FS_OP_MOUNT,
+  FS_OP_UNMOUNT,
+  FS_OP_FSTAT,
+  FS_OP_LS,
+  FS_OP_CREATE,
+  FS_OP_LINK,
+  FS_OP_UNLINK,
+  FS_OP_TRUNCATE,
+  FS_OP_OPEN,
+  FS_OP_CLOSE,
+  FS_OP_ADVISE,
+  FS_OP_READ,
+  FS_OP_WRITE,
+  FS_OP_PREAD,
+  FS_OP_PWRITE,
+  FS_OP_READV,
+  FS_OP_WRITEV,
+  FS_OP_READ_VIEW,
+  FS_OP_CD,
+  FS_OP_MKDIR,
+  FS_OP_RMDIR,
+  FS_OP_SYMLINK,
+  FS_OP_DCACHE_STATS,
+  FS_OP_SYNC,
+  FS_OP_SET_CACHE_BUDGET,
+  FS_OP_BCACHE_STATS,
+  FS_OP_SET_COMMIT_INTERVAL,
+  FS_OP_JOURNAL_STATS,
+  FS_OP_FRAG_REPORT,
+  FS_OP_COMPACT,
+  FS_OP_SNAPSHOT,
+  FS_OP_SNAPSHOT_DELETE,
+  FS_OP_MOUNT_SNAPSHOT,
+  FS_NUM_OPS
+} fs_op_t;
+
+#define FS_STATS_BUCKETS 32 // bucket i counts calls of [2^i, 2^(i+1)) ns, the last one anything longer
+
+typedef struct {
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t bytes; // moved by reads and writes
+  uint64_t total_ns;
+  uint64_t histogram[FS_STATS_BUCKETS];
+} fs_op_stats_t;
+
+// Counters of the whole process, every thread counts into a block of its own
+// and a snapshot adds the blocks up.
+typedef struct {
+  fs_op_stats_t ops[FS_NUM_OPS];
+  uint64_t path_components; // components resolved by path walks
+  uint64_t bitmap_words; // words read by free space searches
+  uint64_t tree_nodes; // nodes visited by tree searches
+} fs_stats_t;
+
+const char *fs_stats_op_name(fs_op_t op);
+
+// the latency below which percentile of the calls finished, as the upper bound of a bucket
+uint64_t fs_stats_percentile(const fs_op_stats_t *op_stats, double percentile);
+
+#ifdef FS_STATS
+
+extern __thread fs_stats_t *fs_stats_thread;
+
+fs_stats_t *fs_stats_thread_init();
+
+// this thread's counters, only the thread itself writes them
+inline static fs_stats_t *fs_stats_local() {
+  return fs_stats_thread ? fs_stats_thread : fs_stats_thread_init();
+}
+
+// single writer, the store is atomic only so that a snapshot reads whole values
+inline static void fs_stats_add(uint64_t *counter, uint64_t n) {
+  __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+#define FS_STATS_ADD(counter, n) fs_stats_add(&fs_stats_local()->counter, (n))
+
+uint64_t fs_stats_now_ns();
+
+// status is what the call returned, a handle or byte count for the calls returning one
+void fs_stats_record(fs_op_t op, uint64_t elapsed_ns, int64_t status, uint64_t bytes);
+
+// adds up the counters of every thread which has counted anything
+void fs_stats_collect(fs_stats_t *stats);
+
+#else
+
+#define FS_STATS_ADD(counter, n) ((void) 0)
+
+#endif // FS_STATS
+
+#endif // FILESYSTEM_STATS_H
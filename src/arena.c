@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "file.h"
+
+// index of the smallest class holding size bytes, ARENA_NUM_CLASSES when none does
+inline static uint32_t arena_class(size_t size) {
+  uint32_t index = 0;
+  size_t class_size = ARENA_MIN_CLASS_SIZE;
+  while (index < ARENA_NUM_CLASSES && class_size < size) {
+    class_size *= 2;
+    index++;
+  }
+  return index;
+}
+
+arena_t *arena_new() {
+  arena_t *arena = malloc(sizeof(arena_t));
+  slab_pool_init(&arena->files, sizeof(file_t), false);
+  slab_pool_init(&arena->descriptors, sizeof(fs_descriptor_t), false);
+  slab_pool_init(&arena->list_nodes, sizeof(node_t), false);
+  slab_pool_init(&arena->extent_nodes, sizeof(tree_node_t), true);
+  for (uint32_t i = 0; i < ARENA_NUM_CLASSES; i++) {
+    slab_pool_init(&arena->classes[i], (size_t) ARENA_MIN_CLASS_SIZE << i, false);
+  }
+  arena->blocks = NULL;
+  return arena;
+}
+
+void arena_free(arena_t *arena) {
+  if (!arena) return;
+  slab_pool_destroy(&arena->files);
+  slab_pool_destroy(&arena->descriptors);
+  slab_pool_destroy(&arena->list_nodes);
+  slab_pool_destroy(&arena->extent_nodes);
+  for (uint32_t i = 0; i < ARENA_NUM_CLASSES; i++) {
+    slab_pool_destroy(&arena->classes[i]);
+  }
+  while (arena->blocks) {
+    arena_block_t *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+  free(arena);
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  if (!arena) {
+    return malloc(size);
+  }
+  uint32_t index = arena_class(size);
+  if (index < ARENA_NUM_CLASSES) {
+    return slab_pool_alloc(&arena->classes[index]);
+  }
+  arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+  if (!block) {
+    return NULL;
+  }
+  block->previous = NULL;
+  block->next = arena->blocks;
+  if (arena->blocks) {
+    arena->blocks->previous = block;
+  }
+  arena->blocks = block;
+  return block + 1;
+}
+
+void *arena_calloc(arena_t *arena, size_t size) {
+  void *ptr = arena_alloc(arena, size);
+  if (ptr) {
+    memset(ptr, 0, size);
+  }
+  return ptr;
+}
+
+void arena_release(arena_t *arena, void *ptr, size_t size) {
+  if (!ptr) return;
+  if (!arena) {
+    free(ptr);
+    return;
+  }
+  uint32_t index = arena_class(size);
+  if (index < ARENA_NUM_CLASSES) {
+    slab_pool_release(&arena->classes[index], ptr);
+    return;
+  }
+  arena_block_t *block = (arena_block_t *) ptr - 1;
+  if (block->previous) {
+    block->previous->next = block->next;
+  } else {
+    arena->blocks = block->next;
+  }
+  if (block->next) {
+    block->next->previous = block->previous;
+  }
+  free(block);
+}
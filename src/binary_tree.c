@@ -4,133 +4,275 @@
 #include <stdio.h>
 
 #include "binary_tree.h"
+#include "stats.h"
 
-void tree_insert_node_value(tree_node_t **link, uint32_t value) {
-  if (!*link) {
-    (*link) = tree_node_new(value, 0, 0);
-  } else if ((value) < ((*(*link)).value)) {
-    tree_insert_node_value(&((*(*link)).left), value);
-  } else {
-    tree_insert_node_value(&((*(*link)).right), value);
+inline static int32_t tree_node_height(tree_node_t *link) {
+  return link ? link->height : 0;
+}
+
+inline static void tree_node_update_height(tree_node_t *link) {
+  int32_t left = tree_node_height(link->left);
+  int32_t right = tree_node_height(link->right);
+  link->height = (left > right ? left : right) + 1;
+}
+
+static tree_node_t *tree_rotate_right(tree_node_t *link) {
+  tree_node_t *left = link->left;
+  link->left = left->right;
+  left->right = link;
+  tree_node_update_height(link);
+  tree_node_update_height(left);
+  return left;
+}
+
+static tree_node_t *tree_rotate_left(tree_node_t *link) {
+  tree_node_t *right = link->right;
+  link->right = right->left;
+  right->left = link;
+  tree_node_update_height(link);
+  tree_node_update_height(right);
+  return right;
+}
+
+static tree_node_t *tree_rebalance(tree_node_t *link) {
+  tree_node_update_height(link);
+  int32_t balance = tree_node_height(link->left) - tree_node_height(link->right);
+  if (balance > 1) {
+    if (tree_node_height(link->left->left) < tree_node_height(link->left->right)) {
+      link->left = tree_rotate_left(link->left);
+    }
+    return tree_rotate_right(link);
+  }
+  if (balance < -1) {
+    if (tree_node_height(link->right->right) < tree_node_height(link->right->left)) {
+      link->right = tree_rotate_right(link->right);
+    }
+    return tree_rotate_left(link);
   }
+  return link;
 }
 
-void tree_insert_node(tree_node_t **link, tree_node_t *tree_node) {
-  if (!*link) {
-    (*link) = (tree_node_t *) malloc(sizeof(tree_node_t));
-    (*(*link)).value = (*tree_node).value;
-    (*(*link)).index = (*tree_node).index;
-    (*(*link)).num_reserved_bits = (*tree_node).num_reserved_bits;
-    (*(*link)).left = NULL;
-    (*(*link)).right = NULL;
-  } else if ((*tree_node).value < (*(*link)).value) {
-    tree_insert_node(&((*(*link)).left), tree_node);
-  } else {
-    tree_insert_node(&((*(*link)).right), tree_node);
+// rebalances the subtrees on the path bottom-up, stops once a subtree height is unchanged
+static void tree_rebalance_path(tree_node_t **path[], int32_t depth) {
+  while (depth-- > 0) {
+    tree_node_t **link = path[depth];
+    int32_t height = (*link)->height;
+    *link = tree_rebalance(*link);
+    if ((*link)->height == height) {
+      return;
+    }
+  }
+}
+
+static void tree_link_node(tree_node_t **link, tree_node_t *tree_node) {
+  tree_node_t **path[TREE_MAX_HEIGHT];
+  int32_t depth = 0;
+
+  while (*link) {
+    path[depth++] = link;
+    link = tree_node->value < (*link)->value ? &(*link)->left : &(*link)->right;
   }
+  tree_node->left = NULL;
+  tree_node->right = NULL;
+  tree_node->height = 1;
+  *link = tree_node;
+  tree_rebalance_path(path, depth);
 }
 
-tree_node_t *tree_find_node(tree_node_t *link, uint32_t value) {
-  if (!link)
-    return NULL;
-  if (((*link).value) == value) {
-    return (link);
-  } else if (value >= ((*link).value)) {
-    return (tree_find_node((*link).right, value));
+inline static void tree_node_free(tree_t *tree, tree_node_t *tree_node) {
+  if (tree->pool) {
+    slab_pool_release(tree->pool, tree_node);
   } else {
-    return (tree_find_node((*link).left, value));
+    free(tree_node);
   }
 }
 
+void tree_insert_node_value(tree_t *tree, uint64_t value) {
+  tree_link_node(&tree->ptr, tree_node_new(tree, value, 0, 0));
+}
+
+void tree_insert_node(tree_t *tree, tree_node_t *tree_node) {
+  tree_node_t *copy = tree_node_new(tree, tree_node->value, tree_node->index, tree_node->num_reserved_bits);
+  copy->name = tree_node->name;
+  tree_link_node(&tree->ptr, copy);
+}
+
+tree_node_t *tree_find_node(tree_node_t *link, uint64_t value) {
+  while (link) {
+    FS_STATS_ADD(tree_nodes, 1);
+    if (link->value == value) {
+      return link;
+    }
+    link = value < link->value ? link->left : link->right;
+  }
+  return NULL;
+}
+
+tree_node_t *tree_find_floor_node(tree_node_t *link, uint64_t value) {
+  tree_node_t *floor = NULL;
+  while (link) {
+    FS_STATS_ADD(tree_nodes, 1);
+    if (link->value == value) {
+      return link;
+    }
+    if (link->value < value) {
+      floor = link;
+      link = link->right;
+    } else {
+      link = link->left;
+    }
+  }
+  return floor;
+}
+
+tree_node_t *tree_find_ceil_node(tree_node_t *link, uint64_t value) {
+  tree_node_t *ceil = NULL;
+  while (link) {
+    FS_STATS_ADD(tree_nodes, 1);
+    if (link->value == value) {
+      return link;
+    }
+    if (link->value > value) {
+      ceil = link;
+      link = link->left;
+    } else {
+      link = link->right;
+    }
+  }
+  return ceil;
+}
+
 tree_node_t *tree_delete_smallest_node(tree_node_t **link) {
-  if ((*(*link)).left) {
-    return (tree_delete_smallest_node(&((*(*link)).left)));
-  } else {
-    tree_node_t *temp;
-    temp = *link;
-    (*link) = (*(*link)).right;
-    return temp;
+  if (!*link) return NULL;
+  tree_node_t **path[TREE_MAX_HEIGHT];
+  int32_t depth = 0;
+
+  while ((*link)->left) {
+    path[depth++] = link;
+    link = &(*link)->left;
   }
+  tree_node_t *smallest = *link;
+  *link = smallest->right;
+  smallest->right = NULL;
+  tree_rebalance_path(path, depth);
+  return smallest;
 }
 
-void tree_delete_node(tree_node_t **link, uint32_t value) {
-  if (!(*link)) return;
-  if (value < (*(*link)).value) {
-    tree_delete_node(&((*(*link)).left), value);
-  } else if (value > (*(*link)).value) {
-    tree_delete_node(&((*(*link)).right), value);
+void tree_delete_node(tree_t *tree, uint64_t value) {
+  tree_node_t **link = &tree->ptr;
+  tree_node_t **path[TREE_MAX_HEIGHT];
+  int32_t depth = 0;
+
+  while (*link && (*link)->value != value) {
+    path[depth++] = link;
+    link = value < (*link)->value ? &(*link)->left : &(*link)->right;
+  }
+  tree_node_t *tree_node = *link;
+  if (!tree_node) return;
+
+  if (!tree_node->left || !tree_node->right) {
+    *link = tree_node->left ? tree_node->left : tree_node->right;
   } else {
-    tree_node_t *temp = *link;
-    if ((*(*link)).right == NULL) {
-      (*link) = (*(*link)).left;
-    } else if ((*(*link)).left == NULL) {
-      (*link) = (*(*link)).right;
-    } else {
-      temp = tree_delete_smallest_node(&((*(*link)).right));
+    // the in-order successor takes the place of the deleted node
+    int32_t node_depth = depth;
+    path[depth++] = link;
+    tree_node_t **successor_link = &tree_node->right;
+    while ((*successor_link)->left) {
+      path[depth++] = successor_link;
+      successor_link = &(*successor_link)->left;
+    }
+    tree_node_t *successor = *successor_link;
+    *successor_link = successor->right;
+    successor->left = tree_node->left;
+    successor->right = tree_node->right;
+    successor->height = tree_node->height;
+    *link = successor;
+    if (node_depth + 1 < depth) {
+      path[node_depth + 1] = &successor->right;
     }
-    (*(*link)).value = (*temp).value;
-    free(temp);
   }
+  tree_node_free(tree, tree_node);
+  tree_rebalance_path(path, depth);
 }
 
-void tree_delete_all(tree_node_t **link) {
-  if (!(*link)) return;
-  tree_delete_all(&((*(*link)).left));
-  tree_delete_all(&((*(*link)).right));
-  free((*link));
-  *link = NULL;
+void tree_delete_all(tree_t *tree) {
+  tree_node_t *tree_node = tree->ptr;
+  while (tree_node) {
+    if (tree_node->left) {
+      // rotate right until the current node has no left subtree
+      tree_node_t *left = tree_node->left;
+      tree_node->left = left->right;
+      left->right = tree_node;
+      tree_node = left;
+    } else {
+      tree_node_t *right = tree_node->right;
+      tree_node_free(tree, tree_node);
+      tree_node = right;
+    }
+  }
+  tree->ptr = NULL;
 }
 
 uint32_t tree_get_height(tree_node_t *link) {
-  if (!link) return -1;
-  uint32_t u = tree_get_height((*link).left);
-  uint32_t v = tree_get_height((*link).right);
-  return u > v ? u + 1 : v + 1;
+  return (uint32_t) (tree_node_height(link) - 1);
 }
 
-tree_t *tree_new() {
+tree_t *tree_new(slab_pool_t *pool) {
   tree_t *tree = malloc(sizeof(tree_t));
-  tree->ptr = NULL;
+  tree_init(tree, pool);
   return tree;
 }
 
-tree_node_t *tree_node_new(uint32_t value, uint32_t index, uint32_t num_reserved_bits) {
-  tree_node_t *tree_node = malloc(sizeof(tree_node_t));
+void tree_init(tree_t *tree, slab_pool_t *pool) {
+  tree->ptr = NULL;
+  tree->pool = pool;
+}
+
+tree_node_t *tree_node_new(tree_t *tree, uint64_t value, uint32_t index, uint32_t num_reserved_bits) {
+  tree_node_t *tree_node = tree->pool ? slab_pool_alloc(tree->pool) : malloc(sizeof(tree_node_t));
+  tree_node->name = NULL;
   tree_node->index = index;
   tree_node->value = value;
   tree_node->num_reserved_bits = num_reserved_bits;
   tree_node->right = NULL;
   tree_node->left = NULL;
+  tree_node->height = 1;
   return tree_node;
 }
 
 tree_node_t *tree_find_node_by_name(tree_node_t *link, const char *value) {
-  if (!link) {
-    return NULL;
-  }
-
-  if (strcmp((*link).name, value) == 0) {
-    return link;
-  }
+  tree_node_t *stack[TREE_MAX_HEIGHT + 1];
+  int32_t depth = 0;
 
-  tree_node_t *left_tree_node = tree_find_node_by_name(link->left, value);
-  if (left_tree_node) {
-    return left_tree_node;
+  if (link) {
+    stack[depth++] = link;
   }
-
-  tree_node_t *right_tree_node = tree_find_node_by_name(link->right, value);
-  if (right_tree_node) {
-    return right_tree_node;
+  while (depth > 0) {
+    tree_node_t *tree_node = stack[--depth];
+    if (tree_node->name && strcmp(tree_node->name, value) == 0) {
+      return tree_node;
+    }
+    if (tree_node->right) {
+      stack[depth++] = tree_node->right;
+    }
+    if (tree_node->left) {
+      stack[depth++] = tree_node->left;
+    }
   }
   return NULL;
 }
 
-
 void tree_show(tree_node_t *link) {
-  if (link == NULL) {
-    return;
+  tree_node_t *stack[TREE_MAX_HEIGHT];
+  int32_t depth = 0;
+
+  while (link || depth > 0) {
+    while (link) {
+      stack[depth++] = link;
+      link = link->right;
+    }
+    link = stack[--depth];
+    printf("file: %s\n", link->name);
+    link = link->left;
   }
-  tree_show((*link).right);
-  printf("file: %s\n", link->name);
-  tree_show((*link).left);
-}
\ No newline at end of file
+}
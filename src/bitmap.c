@@ -1,93 +1,264 @@
 #include "bitmap.h"
+#include "bit_utils.h"
+#include "stats.h"
 
-bitmap_t *bitmap_create(uint32_t num_blocks) {
+#define BITMAP_WORD_SHIFT 6
+#define BITMAP_WORD_MASK  63
+
+#define BITMAP_LONG_RUN 128 // every free run of this length covers at least one whole free word
+
+static void bitmap_summary_update(bitmap_t *bitmap, uint32_t word) {
+  uint64_t value = bitmap->map[word];
+  bool any = value != 0;
+  bool all = value == ~0ULL;
+  uint32_t pos = word;
+
+  for (uint32_t level = 0; level < bitmap->num_levels; level++) {
+    uint32_t index = pos >> BITMAP_WORD_SHIFT;
+    uint64_t mask = 1ULL << (pos & BITMAP_WORD_MASK);
+    uint64_t old_any = bitmap->any_free[level][index];
+    uint64_t old_all = bitmap->all_free[level][index];
+    uint64_t new_any = any ? old_any | mask : old_any & ~mask;
+    uint64_t new_all = all ? old_all | mask : old_all & ~mask;
+    if (new_any == old_any && new_all == old_all) {
+      return;
+    }
+    bitmap->any_free[level][index] = new_any;
+    bitmap->all_free[level][index] = new_all;
+    any = new_any != 0;
+    all = new_all != 0;
+    pos = index;
+  }
+}
+
+// index of the first map word >= word whose level 0 summary bit is set, -1 if none
+static int64_t bitmap_summary_next(const bitmap_t *bitmap, uint64_t *const *levels, uint32_t word) {
+  uint32_t level = 0;
+  uint64_t pos = word;
+
+  while (true) {
+    uint64_t index = pos >> BITMAP_WORD_SHIFT;
+    FS_STATS_ADD(bitmap_words, 1);
+    if (index >= bitmap->level_words[level]) {
+      return -1;
+    }
+    uint64_t bits = levels[level][index] & (~0ULL << (pos & BITMAP_WORD_MASK));
+    if (bits) {
+      pos = (index << BITMAP_WORD_SHIFT) + bit_ctz64(bits);
+      break;
+    }
+    if (level + 1 == bitmap->num_levels) {
+      return -1;
+    }
+    pos = index + 1;
+    level++;
+  }
+  FS_STATS_ADD(bitmap_words, level);
+  while (level > 0) {
+    level--;
+    pos = (pos << BITMAP_WORD_SHIFT) + bit_ctz64(levels[level][pos]);
+  }
+  return (int64_t) pos;
+}
+
+// lowest bit of value which starts a run of size set bits, -1 if none
+static int32_t bitmap_word_find_run(uint64_t value, uint32_t size) {
+  uint32_t covered = 1;
+  while (value && covered < size) {
+    uint32_t shift = covered < size - covered ? covered : size - covered;
+    value &= value >> shift;
+    covered += shift;
+  }
+  return value ? (int32_t) bit_ctz64(value) : -1;
+}
+
+// length of a free run of head bits which continues from the end of the word before word
+static uint64_t bitmap_run_from_word(const bitmap_t *bitmap, uint32_t word, uint32_t head, uint32_t size, uint32_t *end) {
+  uint64_t length = head;
+  uint32_t current = word;
+  while (length < size && current < bitmap->num_words && bitmap->map[current] == ~0ULL) {
+    length += BITMAP_BITS_PER_WORD;
+    current++;
+  }
+  if (length < size && current < bitmap->num_words) {
+    length += bit_trailing_ones64(bitmap->map[current]);
+  }
+  FS_STATS_ADD(bitmap_words, current - word + 1);
+  *end = current;
+  return length;
+}
+
+bitmap_t *bitmap_create(uint32_t num_bits) {
   bitmap_t *bitmap = malloc(sizeof(bitmap_t));
+  assert(bitmap);
 
-  bitmap->map = (uint8_t *) calloc(num_blocks, 1);
+  bitmap->num_bits = num_bits;
+  bitmap->num_words = (num_bits + BITMAP_BITS_PER_WORD - 1) / BITMAP_BITS_PER_WORD;
+  if (!bitmap->num_words) {
+    bitmap->num_words = 1;
+  }
+  bitmap->map = (uint64_t *) malloc(bitmap->num_words * sizeof(uint64_t));
   assert(bitmap->map);
+  for (uint32_t i = 0; i < bitmap->num_words; i++) {
+    bitmap->map[i] = ~0ULL;
+  }
+  uint32_t tail_bits = num_bits & BITMAP_WORD_MASK;
+  if (tail_bits || !num_bits) {
+    bitmap->map[bitmap->num_words - 1] = num_bits ? bit_range_mask64(0, tail_bits) : 0;
+  }
+
+  uint32_t words = bitmap->num_words;
+  bitmap->num_levels = 0;
+  do {
+    assert(bitmap->num_levels < BITMAP_MAX_LEVELS);
+    words = (words + BITMAP_BITS_PER_WORD - 1) / BITMAP_BITS_PER_WORD;
+    bitmap->level_words[bitmap->num_levels] = words;
+    bitmap->any_free[bitmap->num_levels] = (uint64_t *) calloc(words, sizeof(uint64_t));
+    bitmap->all_free[bitmap->num_levels] = (uint64_t *) calloc(words, sizeof(uint64_t));
+    assert(bitmap->any_free[bitmap->num_levels] && bitmap->all_free[bitmap->num_levels]);
+    bitmap->num_levels++;
+  } while (words > 1);
 
-  bitmap->num_bytes = num_blocks;
-  bitmap->num_bits = bitmap->num_bytes * 8;
-  for (int i = 0; i < bitmap->num_bytes; i++) {
-    bitmap->map[i] = 0xFF;
+  for (uint32_t i = 0; i < bitmap->num_words; i++) {
+    bitmap_summary_update(bitmap, i);
   }
   return bitmap;
 }
 
+void bitmap_free(bitmap_t *bitmap) {
+  if (!bitmap) return;
+  for (uint32_t level = 0; level < bitmap->num_levels; level++) {
+    free(bitmap->any_free[level]);
+    free(bitmap->all_free[level]);
+  }
+  free(bitmap->map);
+  free(bitmap);
+}
+
 void bitmap_set_bits(bitmap_t *bitmap, int32_t val, uint32_t nbits, uint32_t index) {
-  uint32_t bit = 0;
-
-  for (uint32_t i = 0; i < bitmap->num_bytes; i++) {
-    uint8_t mask = 1;
-    for (uint32_t j = 0; j < 8; j++) {
-      if (bit < index) {
-        bit++;
-        mask = mask << 1;
-        continue;
-      }
-      if (bit == index + nbits) {
-        return;
-      }
-      if (val) {
-        bitmap->map[i] = bitmap->map[i] | mask;
-      } else {
-        bitmap->map[i] = bitmap->map[i] & (~mask);
-      }
+  assert((uint64_t) index + nbits <= bitmap->num_bits);
+  uint32_t word = index >> BITMAP_WORD_SHIFT;
+  uint32_t bit = index & BITMAP_WORD_MASK;
+
+  while (nbits) {
+    uint32_t count = BITMAP_BITS_PER_WORD - bit;
+    if (count > nbits) {
+      count = nbits;
     }
+    uint64_t mask = bit_range_mask64(bit, count);
+    uint64_t old = bitmap->map[word];
+    bitmap->map[word] = val ? old | mask : old & ~mask;
+    if (bitmap->map[word] != old) {
+      bitmap_summary_update(bitmap, word);
+    }
+    nbits -= count;
+    bit = 0;
+    word++;
   }
 }
 
 int32_t bitmap_get_bit(bitmap_t *bitmap, uint32_t index) {
-  uint32_t bit = 0;
+  if (index >= bitmap->num_bits) {
+    return -1;
+  }
+  return (bitmap->map[index >> BITMAP_WORD_SHIFT] >> (index & BITMAP_WORD_MASK)) & 0x1 ? 1 : 0;
+}
 
-  for (uint32_t i = 0; i < bitmap->num_bytes; i++) {
-    uint8_t mask = 1;
-    for (uint32_t j = 0; j < 8; j++) {
-      if (bit == index) {
-        return bitmap->map[i] & mask ? 1 : 0;
+int64_t bitmap_get_bit_run(bitmap_t *bitmap, uint32_t size) {
+  if (!size || size > bitmap->num_bits) {
+    return -1;
+  }
+  uint32_t word = 0;
+  uint32_t end;
+
+  if (size >= BITMAP_LONG_RUN) {
+    while (true) {
+      int64_t next = bitmap_summary_next(bitmap, bitmap->all_free, word);
+      if (next < 0) {
+        return -1;
+      }
+      word = (uint32_t) next;
+      uint32_t head = word ? bit_leading_ones64(bitmap->map[word - 1]) : 0;
+      uint64_t length = bitmap_run_from_word(bitmap, word, head, size, &end);
+      if (length >= size) {
+        return (int64_t) word * BITMAP_BITS_PER_WORD - head;
       }
-      bit++;
-      mask = mask << 1;
+      word = end;
     }
   }
-  return -1;
-}
 
-int32_t bitmap_get_bit_run(bitmap_t *bitmap, uint32_t size) {
-  uint8_t current_size = 0;
-  uint8_t bit = 0;
-
-  for (uint32_t i = 0; i < bitmap->num_bytes; i++) {
-    uint32_t mask = 1;
-    for (uint32_t j = 0; j < 8; j++) {
-      if (bitmap->map[i] & mask) {
-        current_size++;
-        if (current_size == size)
-          return bit - size + 1;
-      } else {
-        current_size = 0;
+  while (true) {
+    int64_t next = bitmap_summary_next(bitmap, bitmap->any_free, word);
+    if (next < 0) {
+      return -1;
+    }
+    word = (uint32_t) next;
+    uint64_t value = bitmap->map[word];
+    if (size <= BITMAP_BITS_PER_WORD) {
+      int32_t bit = bitmap_word_find_run(value, size);
+      if (bit >= 0) {
+        return (int64_t) word * BITMAP_BITS_PER_WORD + bit;
       }
-      bit++;
-      mask = mask << 1;
     }
+    uint32_t head = bit_leading_ones64(value);
+    if (head && bitmap_run_from_word(bitmap, word + 1, head, size, &end) >= size) {
+      return (int64_t) (word + 1) * BITMAP_BITS_PER_WORD - head;
+    }
+    word++;
+  }
+}
+
+int64_t bitmap_next_free_run(bitmap_t *bitmap, uint32_t from, uint32_t *length) {
+  if (from >= bitmap->num_bits) {
+    return -1;
+  }
+  uint32_t word = from >> BITMAP_WORD_SHIFT;
+  uint64_t value = bitmap->map[word] & (~0ULL << (from & BITMAP_WORD_MASK));
+  if (!value) {
+    int64_t next = bitmap_summary_next(bitmap, bitmap->any_free, word + 1);
+    if (next < 0) {
+      return -1;
+    }
+    word = (uint32_t) next;
+    value = bitmap->map[word];
+  }
+  uint32_t bit = bit_ctz64(value);
+  uint32_t head = bit_trailing_ones64(value >> bit);
+  uint32_t end;
+  if (bit + head < BITMAP_BITS_PER_WORD) {
+    *length = head;
+  } else {
+    *length = (uint32_t) bitmap_run_from_word(bitmap, word + 1, head, UINT32_MAX, &end);
+  }
+  return (int64_t) word * BITMAP_BITS_PER_WORD + bit;
+}
+
+uint32_t bitmap_count_free(bitmap_t *bitmap) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < bitmap->num_words; i++) {
+    count += bit_popcount64(bitmap->map[i]);
+  }
+  return count;
+}
+
+void bitmap_load(bitmap_t *bitmap, const uint64_t *used) {
+  for (uint32_t i = 0; i < (bitmap->num_bits + BITMAP_WORD_MASK) >> BITMAP_WORD_SHIFT; i++) {
+    bitmap->map[i] &= ~used[i];
+    bitmap_summary_update(bitmap, i);
+  }
+}
+
+void bitmap_save(const bitmap_t *bitmap, uint64_t *used) {
+  for (uint32_t i = 0; i < (bitmap->num_bits + BITMAP_WORD_MASK) >> BITMAP_WORD_SHIFT; i++) {
+    used[i] = ~bitmap->map[i];
   }
-  return -1;
 }
 
 void bitmap_show(bitmap_t *bitmap) {
-  uint32_t bit = 0;
-  uint8_t mask;
-  for (int i = 0; i < bitmap->num_bytes; i++) {
-    mask = 1;
-    printf("byte[%u]=%x\n", i, bitmap->map[i]);
-    for (int j = 0; j < 8; j++) {
-      if (bitmap->map[i] & mask) {
-        printf("1");
-      } else {
-        printf("0");
-      }
-      bit++;
-      mask = mask << 1;
+  for (uint32_t i = 0; i < bitmap->num_words; i++) {
+    printf("word[%u]=%016llx\n", i, (unsigned long long) bitmap->map[i]);
+    for (uint32_t j = 0; j < BITMAP_BITS_PER_WORD; j++) {
+      printf("%c", (bitmap->map[i] >> j) & 0x1 ? '1' : '0');
     }
     printf("\n\n");
   }
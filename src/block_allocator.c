@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_allocator.h"
+#include "bit_utils.h"
+
+inline static alloc_group_t *block_allocator_group(block_allocator_t *blocks, uint32_t index) {
+  return &blocks->groups[index / blocks->group_blocks];
+}
+
+// builds the group's bitmap and free extents on first use, called with the group lock held
+static void alloc_group_load(block_allocator_t *blocks, alloc_group_t *group) {
+  if (group->allocator) {
+    return;
+  }
+  group->bitmap = bitmap_create(group->num_blocks);
+  if (blocks->used) {
+    bitmap_load(group->bitmap, blocks->used + group->first_block / BITMAP_BITS_PER_WORD);
+  }
+  group->allocator = extent_allocator_new(group->bitmap, blocks->policy);
+}
+
+// sets or clears bits [index, index + count) of a bitmap stored as words
+static void block_allocator_mark(uint64_t *words, uint32_t index, uint32_t count, bool set) {
+  while (count) {
+    uint32_t bit = index % BITMAP_BITS_PER_WORD;
+    uint32_t n = BITMAP_BITS_PER_WORD - bit < count ? BITMAP_BITS_PER_WORD - bit : count;
+    uint64_t mask = bit_range_mask64(bit, n);
+    uint64_t *word = &words[index / BITMAP_BITS_PER_WORD];
+    *word = set ? *word | mask : *word & ~mask;
+    index += n;
+    count -= n;
+  }
+}
+
+// frees what no snapshot holds and keeps the rest, called with the group lock held
+static void alloc_group_release_shared(block_allocator_t *blocks, alloc_group_t *group, uint32_t offset,
+                                       uint32_t count) {
+  uint32_t index = group->first_block + offset;
+  uint32_t end = index + count;
+  while (index < end) {
+    bool held;
+    uint32_t run = block_allocator_held_run(blocks, index, end - index, &held);
+    block_allocator_mark(blocks->kept, index, run, held);
+    if (!held) {
+      extent_allocator_release(group->allocator, index - group->first_block, run);
+    }
+    index += run;
+  }
+}
+
+// tries one group, holding its lock only for the allocation itself
+static int64_t alloc_group_alloc(block_allocator_t *blocks, alloc_group_t *group, uint32_t num_blocks, bool wait) {
+  if (wait) {
+    pthread_mutex_lock(&group->lock);
+  } else if (pthread_mutex_trylock(&group->lock)) {
+    return -1;
+  }
+  alloc_group_load(blocks, group);
+  int64_t start = extent_allocator_alloc(group->allocator, num_blocks);
+  pthread_mutex_unlock(&group->lock);
+  return start == -1 ? -1 : start + group->first_block;
+}
+
+block_allocator_t *block_allocator_new(uint32_t num_blocks, alloc_policy_t policy, const uint64_t *used) {
+  block_allocator_t *blocks = malloc(sizeof(block_allocator_t));
+  uint32_t num_groups = num_blocks / BLOCK_ALLOCATOR_MIN_GROUP_BLOCKS;
+  if (num_groups > BLOCK_ALLOCATOR_MAX_GROUPS) {
+    num_groups = BLOCK_ALLOCATOR_MAX_GROUPS;
+  }
+  if (!num_groups) {
+    num_groups = 1;
+  }
+  // groups start on a bitmap word, so each one loads and saves whole words
+  uint64_t group_blocks = ((uint64_t) num_blocks + num_groups - 1) / num_groups;
+  group_blocks = (group_blocks + BITMAP_BITS_PER_WORD - 1) / BITMAP_BITS_PER_WORD * BITMAP_BITS_PER_WORD;
+  if (!group_blocks) {
+    group_blocks = BITMAP_BITS_PER_WORD;
+  }
+  num_groups = (uint32_t) (((uint64_t) num_blocks + group_blocks - 1) / group_blocks);
+  if (!num_groups) {
+    num_groups = 1;
+  }
+  blocks->num_groups = num_groups;
+  blocks->group_blocks = (uint32_t) group_blocks;
+  blocks->policy = policy;
+  blocks->used = used;
+  blocks->held = NULL;
+  blocks->kept = NULL;
+  if (posix_memalign((void **) &blocks->groups, __alignof__(alloc_group_t), num_groups * sizeof(alloc_group_t))) {
+    free(blocks);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < num_groups; i++) {
+    alloc_group_t *group = &blocks->groups[i];
+    uint64_t first_block = (uint64_t) i * group_blocks;
+    uint64_t end = first_block + group_blocks < num_blocks ? first_block + group_blocks : num_blocks;
+    pthread_mutex_init(&group->lock, NULL);
+    group->first_block = (uint32_t) first_block;
+    group->num_blocks = end > first_block ? (uint32_t) (end - first_block) : 0;
+    group->bitmap = NULL;
+    group->allocator = NULL;
+  }
+  return blocks;
+}
+
+void block_allocator_free(block_allocator_t *blocks) {
+  if (!blocks) return;
+  for (uint32_t i = 0; i < blocks->num_groups; i++) {
+    alloc_group_t *group = &blocks->groups[i];
+    extent_allocator_free(group->allocator);
+    bitmap_free(group->bitmap);
+    pthread_mutex_destroy(&group->lock);
+  }
+  free(blocks->groups);
+  free(blocks);
+}
+
+int64_t block_allocator_alloc(block_allocator_t *blocks, uint32_t group, uint32_t num_blocks) {
+  uint32_t home = group % blocks->num_groups;
+  int64_t start = alloc_group_alloc(blocks, &blocks->groups[home], num_blocks, true);
+  // steal from groups nobody is using right now first, then wait for the busy ones
+  for (int pass = 0; pass < 2 && start == -1; pass++) {
+    for (uint32_t i = 1; i < blocks->num_groups && start == -1; i++) {
+      start = alloc_group_alloc(blocks, &blocks->groups[(home + i) % blocks->num_groups], num_blocks, pass == 1);
+    }
+  }
+  return start;
+}
+
+int64_t block_allocator_alloc_low(block_allocator_t *blocks, uint32_t num_blocks, uint32_t limit) {
+  int64_t start = -1;
+  for (uint32_t i = 0; i < blocks->num_groups && blocks->groups[i].first_block < limit && start == -1; i++) {
+    alloc_group_t *group = &blocks->groups[i];
+    pthread_mutex_lock(&group->lock);
+    alloc_group_load(blocks, group);
+    start = extent_allocator_alloc_low(group->allocator, num_blocks, limit - group->first_block);
+    pthread_mutex_unlock(&group->lock);
+    if (start != -1) {
+      start += group->first_block;
+    }
+  }
+  return start;
+}
+
+uint32_t block_allocator_extend(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks) {
+  if (index / blocks->group_blocks >= blocks->num_groups) {
+    return 0;
+  }
+  alloc_group_t *group = block_allocator_group(blocks, index);
+  pthread_mutex_lock(&group->lock);
+  alloc_group_load(blocks, group);
+  uint32_t claimed = extent_allocator_extend(group->allocator, index - group->first_block, num_blocks);
+  pthread_mutex_unlock(&group->lock);
+  return claimed;
+}
+
+bool block_allocator_claim(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks) {
+  uint32_t claimed = 0;
+  while (claimed < num_blocks) {
+    uint32_t at = index + claimed;
+    if (at / blocks->group_blocks >= blocks->num_groups) {
+      break;
+    }
+    alloc_group_t *group = block_allocator_group(blocks, at);
+    uint32_t offset = at - group->first_block;
+    uint32_t count = group->num_blocks - offset < num_blocks - claimed ? group->num_blocks - offset
+                                                                      : num_blocks - claimed;
+    pthread_mutex_lock(&group->lock);
+    alloc_group_load(blocks, group);
+    bool done = extent_allocator_claim(group->allocator, offset, count);
+    pthread_mutex_unlock(&group->lock);
+    if (!done) {
+      break;
+    }
+    claimed += count;
+  }
+  if (claimed < num_blocks) {
+    block_allocator_release(blocks, index, claimed);
+    return false;
+  }
+  return true;
+}
+
+void block_allocator_release(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks) {
+  while (num_blocks) {
+    alloc_group_t *group = block_allocator_group(blocks, index);
+    uint32_t offset = index - group->first_block;
+    uint32_t count = group->num_blocks - offset < num_blocks ? group->num_blocks - offset : num_blocks;
+    pthread_mutex_lock(&group->lock);
+    alloc_group_load(blocks, group);
+    if (blocks->held) {
+      alloc_group_release_shared(blocks, group, offset, count);
+    } else {
+      extent_allocator_release(group->allocator, offset, count);
+    }
+    pthread_mutex_unlock(&group->lock);
+    index += count;
+    num_blocks -= count;
+  }
+}
+
+void block_allocator_share(block_allocator_t *blocks, const uint64_t *held, uint64_t *kept) {
+  blocks->held = held;
+  blocks->kept = kept;
+}
+
+void block_allocator_keep(block_allocator_t *blocks, uint32_t index, uint32_t num_blocks) {
+  while (num_blocks) {
+    alloc_group_t *group = block_allocator_group(blocks, index);
+    uint32_t count = group->first_block + group->num_blocks - index < num_blocks
+                         ? group->first_block + group->num_blocks - index : num_blocks;
+    pthread_mutex_lock(&group->lock);
+    block_allocator_mark(blocks->kept, index, count, true);
+    pthread_mutex_unlock(&group->lock);
+    index += count;
+    num_blocks -= count;
+  }
+}
+
+uint32_t block_allocator_held_run(const block_allocator_t *blocks, uint32_t index, uint32_t num_blocks, bool *held) {
+  const uint64_t *words = blocks->held;
+  *held = words && (words[index / BITMAP_BITS_PER_WORD] >> (index % BITMAP_BITS_PER_WORD)) & 1;
+  if (!words) {
+    return num_blocks;
+  }
+  uint32_t run = 0;
+  while (run < num_blocks) {
+    uint32_t at = index + run;
+    uint32_t bit = at % BITMAP_BITS_PER_WORD;
+    uint64_t word = words[at / BITMAP_BITS_PER_WORD];
+    uint32_t same = bit_trailing_ones64((*held ? word : ~word) >> bit);
+    if (same > BITMAP_BITS_PER_WORD - bit) {
+      same = BITMAP_BITS_PER_WORD - bit;
+    }
+    run += same;
+    if (same < BITMAP_BITS_PER_WORD - bit) {
+      break;
+    }
+  }
+  return run < num_blocks ? run : num_blocks;
+}
+
+uint64_t block_allocator_num_free(block_allocator_t *blocks) {
+  uint64_t num_free = 0;
+  for (uint32_t i = 0; i < blocks->num_groups; i++) {
+    alloc_group_t *group = &blocks->groups[i];
+    pthread_mutex_lock(&group->lock);
+    alloc_group_load(blocks, group);
+    num_free += group->allocator->num_free_blocks;
+    pthread_mutex_unlock(&group->lock);
+  }
+  return num_free;
+}
+
+void block_allocator_free_runs(block_allocator_t *blocks, block_free_runs_t *runs) {
+  memset(runs, 0, sizeof(block_free_runs_t));
+  for (uint32_t i = 0; i < blocks->num_groups; i++) {
+    alloc_group_t *group = &blocks->groups[i];
+    pthread_mutex_lock(&group->lock);
+    alloc_group_load(blocks, group);
+    uint32_t length;
+    int64_t start = extent_allocator_next_free(group->allocator, 0, &length);
+    while (start != -1) {
+      runs->num_free += length;
+      runs->num_runs++;
+      runs->runs[63 - bit_clz64(length)]++;
+      if (length > runs->largest_run) {
+        runs->largest_run = length;
+      }
+      start = extent_allocator_next_free(group->allocator, (uint32_t) start + length, &length);
+    }
+    pthread_mutex_unlock(&group->lock);
+  }
+}
+
+void block_allocator_save(block_allocator_t *blocks, uint64_t *used) {
+  for (uint32_t i = 0; i < blocks->num_groups; i++) {
+    alloc_group_t *group = &blocks->groups[i];
+    uint64_t *words = used + group->first_block / BITMAP_BITS_PER_WORD;
+    size_t num_words = (group->num_blocks + BITMAP_BITS_PER_WORD - 1) / BITMAP_BITS_PER_WORD;
+    pthread_mutex_lock(&group->lock);
+    if (group->bitmap) {
+      bitmap_save(group->bitmap, words);
+    } else if (blocks->used) {
+      memmove(words, blocks->used + group->first_block / BITMAP_BITS_PER_WORD, num_words * sizeof(uint64_t));
+    } else {
+      memset(words, 0, num_words * sizeof(uint64_t));
+    }
+    pthread_mutex_unlock(&group->lock);
+  }
+  blocks->used = used;
+}
@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_cache.h"
+
+#define BLOCK_CACHE_NONE UINT32_MAX
+
+inline static block_cache_shard_t *block_cache_shard(block_cache_t *cache, uint32_t block) {
+  return &cache->shards[block % BLOCK_CACHE_SHARDS];
+}
+
+inline static uint32_t *block_cache_bucket(block_cache_shard_t *shard, uint32_t block) {
+  return &shard->buckets[((block / BLOCK_CACHE_SHARDS) * 0x9E3779B1u) & (shard->num_buckets - 1)];
+}
+
+inline static unsigned char *block_cache_data(block_cache_t *cache, block_cache_shard_t *shard, uint32_t index) {
+  return &shard->data[(uint64_t) index * cache->block_size];
+}
+
+inline static unsigned char *block_cache_image(block_cache_t *cache, uint32_t block) {
+  return &cache->image->data[(uint64_t) block * cache->block_size];
+}
+
+static uint32_t block_cache_find(block_cache_shard_t *shard, uint32_t block) {
+  uint32_t index = *block_cache_bucket(shard, block);
+  while (index != BLOCK_CACHE_NONE && shard->entries[index].block != block) {
+    index = shard->entries[index].next;
+  }
+  return index;
+}
+
+static void block_cache_unlink(block_cache_shard_t *shard, uint32_t index) {
+  uint32_t *link = block_cache_bucket(shard, shard->entries[index].block);
+  while (*link != index) {
+    link = &shard->entries[*link].next;
+  }
+  *link = shard->entries[index].next;
+}
+
+static void block_cache_writeback(block_cache_t *cache, block_cache_shard_t *shard, uint32_t index) {
+  block_cache_entry_t *entry = &shard->entries[index];
+  memcpy(block_cache_image(cache, entry->block), block_cache_data(cache, shard, index), cache->block_size);
+  entry->dirty = false;
+  shard->stats.num_dirty--;
+  shard->stats.writebacks++;
+}
+
+static void block_cache_drop(block_cache_shard_t *shard, uint32_t index) {
+  block_cache_entry_t *entry = &shard->entries[index];
+  if (entry->dirty) {
+    entry->dirty = false;
+    shard->stats.num_dirty--;
+  }
+  block_cache_unlink(shard, index);
+  entry->used = false;
+  shard->stats.num_entries--;
+}
+
+// CLOCK: recently used blocks get a second chance, the first one that did not is written back and reused
+static uint32_t block_cache_victim(block_cache_t *cache, block_cache_shard_t *shard) {
+  while (true) {
+    uint32_t index = shard->hand;
+    shard->hand = (shard->hand + 1) % shard->capacity;
+    block_cache_entry_t *entry = &shard->entries[index];
+    if (!entry->used) {
+      return index;
+    }
+    if (entry->referenced) {
+      entry->referenced = false;
+      continue;
+    }
+    if (entry->dirty) {
+      block_cache_writeback(cache, shard, index);
+    }
+    block_cache_drop(shard, index);
+    shard->stats.evictions++;
+    return index;
+  }
+}
+
+static uint32_t block_cache_insert(block_cache_t *cache, block_cache_shard_t *shard, uint32_t block, bool fill) {
+  uint32_t index = block_cache_victim(cache, shard);
+  block_cache_entry_t *entry = &shard->entries[index];
+  uint32_t *bucket = block_cache_bucket(shard, block);
+  entry->block = block;
+  entry->next = *bucket;
+  entry->used = true;
+  entry->dirty = false;
+  *bucket = index;
+  shard->stats.num_entries++;
+  if (fill) {
+    memcpy(block_cache_data(cache, shard, index), block_cache_image(cache, block), cache->block_size);
+  }
+  return index;
+}
+
+static void block_cache_flush_shard(block_cache_t *cache, block_cache_shard_t *shard) {
+  for (uint32_t i = 0; i < shard->capacity; i++) {
+    if (shard->entries[i].used && shard->entries[i].dirty) {
+      block_cache_writeback(cache, shard, i);
+    }
+  }
+}
+
+block_cache_t *block_cache_new(image_t *image, uint32_t block_size, size_t budget) {
+  uint32_t capacity = (uint32_t) (budget / block_size / BLOCK_CACHE_SHARDS);
+  if (!capacity) {
+    return NULL;
+  }
+  block_cache_t *cache;
+  if (posix_memalign((void **) &cache, __alignof__(block_cache_shard_t), sizeof(block_cache_t))) {
+    return NULL;
+  }
+  cache->image = image;
+  cache->block_size = block_size;
+  uint32_t num_buckets = 1;
+  while (num_buckets < capacity) {
+    num_buckets *= 2;
+  }
+  for (uint32_t i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    block_cache_shard_t *shard = &cache->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->entries = calloc(capacity, sizeof(block_cache_entry_t));
+    shard->data = malloc((size_t) capacity * block_size);
+    shard->buckets = malloc(num_buckets * sizeof(uint32_t));
+    memset(shard->buckets, 0xff, num_buckets * sizeof(uint32_t));
+    shard->num_buckets = num_buckets;
+    shard->capacity = capacity;
+    shard->hand = 0;
+    memset(&shard->stats, 0, sizeof(block_cache_stats_t));
+    shard->stats.capacity = capacity;
+  }
+  return cache;
+}
+
+void block_cache_free(block_cache_t *cache) {
+  if (!cache) return;
+  block_cache_flush_all(cache);
+  for (uint32_t i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    block_cache_shard_t *shard = &cache->shards[i];
+    pthread_mutex_destroy(&shard->lock);
+    free(shard->entries);
+    free(shard->data);
+    free(shard->buckets);
+  }
+  free(cache);
+}
+
+void block_cache_read(block_cache_t *cache, uint32_t physical, uint64_t offset, unsigned char *buffer,
+                      uint64_t size) {
+  uint32_t block_size = cache->block_size;
+  uint32_t block = physical + (uint32_t) (offset / block_size);
+  uint32_t block_offset = (uint32_t) (offset % block_size);
+  while (size) {
+    uint64_t chunk = block_size - block_offset < size ? block_size - block_offset : size;
+    block_cache_shard_t *shard = block_cache_shard(cache, block);
+    pthread_mutex_lock(&shard->lock);
+    uint32_t index = block_cache_find(shard, block);
+    if (index != BLOCK_CACHE_NONE) {
+      memcpy(buffer, block_cache_data(cache, shard, index) + block_offset, chunk);
+      shard->entries[index].referenced = true;
+      shard->stats.hits++;
+    } else {
+      memcpy(buffer, block_cache_image(cache, block) + block_offset, chunk);
+      shard->stats.misses++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    buffer += chunk;
+    size -= chunk;
+    block++;
+    block_offset = 0;
+  }
+}
+
+// a NULL buffer writes zeros
+static void block_cache_copy(block_cache_t *cache, uint32_t physical, uint64_t offset, const unsigned char *buffer,
+                             uint64_t size) {
+  uint32_t block_size = cache->block_size;
+  uint32_t block = physical + (uint32_t) (offset / block_size);
+  uint32_t block_offset = (uint32_t) (offset % block_size);
+  while (size) {
+    uint64_t chunk = block_size - block_offset < size ? block_size - block_offset : size;
+    block_cache_shard_t *shard = block_cache_shard(cache, block);
+    pthread_mutex_lock(&shard->lock);
+    uint32_t index = block_cache_find(shard, block);
+    unsigned char *target;
+    if (index != BLOCK_CACHE_NONE) {
+      shard->stats.hits++;
+      target = block_cache_data(cache, shard, index);
+    } else if (chunk == block_size) {
+      shard->stats.misses++;
+      target = block_cache_image(cache, block);
+    } else {
+      shard->stats.misses++;
+      index = block_cache_insert(cache, shard, block, true);
+      target = block_cache_data(cache, shard, index);
+    }
+    if (buffer) {
+      memcpy(target + block_offset, buffer, chunk);
+      buffer += chunk;
+    } else {
+      memset(target + block_offset, 0, chunk);
+    }
+    if (index != BLOCK_CACHE_NONE) {
+      block_cache_entry_t *entry = &shard->entries[index];
+      entry->referenced = true;
+      if (!entry->dirty) {
+        entry->dirty = true;
+        shard->stats.num_dirty++;
+      }
+      if ((uint64_t) shard->stats.num_dirty * 100 > (uint64_t) shard->capacity * BLOCK_CACHE_DIRTY_PERCENT) {
+        block_cache_flush_shard(cache, shard);
+        shard->stats.flushes++;
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    size -= chunk;
+    block++;
+    block_offset = 0;
+  }
+}
+
+void block_cache_write(block_cache_t *cache, uint32_t physical, uint64_t offset, const unsigned char *buffer,
+                       uint64_t size) {
+  block_cache_copy(cache, physical, offset, buffer, size);
+}
+
+void block_cache_zero(block_cache_t *cache, uint32_t physical, uint64_t offset, uint64_t size) {
+  block_cache_copy(cache, physical, offset, NULL, size);
+}
+
+// visits the cached blocks of a range, scanning the whole shard when that is cheaper than the lookups
+static void block_cache_range(block_cache_t *cache, uint32_t physical, uint32_t num_blocks, bool drop) {
+  uint64_t end = (uint64_t) physical + num_blocks;
+  for (uint32_t s = 0; s < BLOCK_CACHE_SHARDS; s++) {
+    block_cache_shard_t *shard = &cache->shards[s];
+    pthread_mutex_lock(&shard->lock);
+    if (shard->stats.num_entries && num_blocks / BLOCK_CACHE_SHARDS >= shard->capacity) {
+      for (uint32_t i = 0; i < shard->capacity; i++) {
+        block_cache_entry_t *entry = &shard->entries[i];
+        if (entry->used && entry->block >= physical && entry->block < end) {
+          if (drop) {
+            block_cache_drop(shard, i);
+          } else if (entry->dirty) {
+            block_cache_writeback(cache, shard, i);
+          }
+        }
+      }
+    } else if (shard->stats.num_entries) {
+      uint64_t block = physical + (s + BLOCK_CACHE_SHARDS - physical % BLOCK_CACHE_SHARDS) % BLOCK_CACHE_SHARDS;
+      for (; block < end; block += BLOCK_CACHE_SHARDS) {
+        uint32_t index = block_cache_find(shard, (uint32_t) block);
+        if (index == BLOCK_CACHE_NONE) {
+          continue;
+        }
+        if (drop) {
+          block_cache_drop(shard, index);
+        } else if (shard->entries[index].dirty) {
+          block_cache_writeback(cache, shard, index);
+        }
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+void block_cache_flush(block_cache_t *cache, uint32_t physical, uint32_t num_blocks) {
+  block_cache_range(cache, physical, num_blocks, false);
+}
+
+void block_cache_flush_all(block_cache_t *cache) {
+  for (uint32_t i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    block_cache_shard_t *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    block_cache_flush_shard(cache, shard);
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+void block_cache_invalidate(block_cache_t *cache, uint32_t physical, uint32_t num_blocks) {
+  block_cache_range(cache, physical, num_blocks, true);
+}
+
+void block_cache_stats(block_cache_t *cache, block_cache_stats_t *stats) {
+  memset(stats, 0, sizeof(block_cache_stats_t));
+  for (uint32_t i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    block_cache_shard_t *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->hits += shard->stats.hits;
+    stats->misses += shard->stats.misses;
+    stats->evictions += shard->stats.evictions;
+    stats->writebacks += shard->stats.writebacks;
+    stats->flushes += shard->stats.flushes;
+    stats->num_entries += shard->stats.num_entries;
+    stats->num_dirty += shard->stats.num_dirty;
+    stats->capacity += shard->stats.capacity;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
@@ -1,15 +1,17 @@
+#define _GNU_SOURCE // getline
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
 
 #include "filesystem.h"
 #include "command_line_parser.h"
 
 #define COMMAND_LINE_MAX_NUM_ARG 20
-#define COMMAND_LINE_MAX_TEXT_SIZE 50
-#define COMMAND_LINE_DELIM_WHITESPACE " "
+#define COMMAND_LINE_MAX_SIGNATURES 4
+#define COMMAND_LINE_COMPACT_BUDGET_US 10000
 
 typedef enum {
   CL_UNKNOWN,
@@ -22,32 +24,86 @@ typedef struct {
   char *arg;
 } command_arg_t;
 
+// One reader per run, the line buffers and arguments are reused for every line.
 typedef struct {
-  command_arg_t **argv;
+  command_arg_t argv[COMMAND_LINE_MAX_NUM_ARG];
   int argc;
+  size_t length; // length of the command name, argv[0]
+  FILE *input;
+  bool prompt; // interactive session, print the prompts
+  char *line;
+  size_t line_capacity;
+  char *data; // write payload padded to the requested size
+  size_t data_capacity;
 } command_line_t;
 
-static command_line_t *command_line_new() {
-  command_line_t *cl = malloc(sizeof(command_line_t));
-  cl->argv = (command_arg_t **) malloc(COMMAND_LINE_MAX_NUM_ARG * sizeof(command_arg_t));
-  cl->argc = 0;
+typedef void (*command_line_handler_t)(fs_ctx_t *ctx, command_line_t *cl);
+
+typedef enum {
+  CL_COMMAND_ADVISE,
+  CL_COMMAND_BCACHE,
+  CL_COMMAND_CD,
+  CL_COMMAND_CLOSE,
+  CL_COMMAND_COMPACT,
+  CL_COMMAND_CREATE,
+  CL_COMMAND_DCACHE,
+  CL_COMMAND_EXIT,
+  CL_COMMAND_FRAG,
+  CL_COMMAND_FSTAT,
+  CL_COMMAND_JOURNAL,
+  CL_COMMAND_LINK,
+  CL_COMMAND_LS,
+  CL_COMMAND_MKDIR,
+  CL_COMMAND_MKFS,
+  CL_COMMAND_MOUNT,
+  CL_COMMAND_OPEN,
+  CL_COMMAND_READ,
+  CL_COMMAND_RMDIR,
+  CL_COMMAND_RMSNAPSHOT,
+  CL_COMMAND_SNAPSHOT,
+  CL_COMMAND_STATS,
+  CL_COMMAND_SYMLINK,
+  CL_COMMAND_SYNC,
+  CL_COMMAND_TRUNCATE,
+  CL_COMMAND_UNLINK,
+  CL_COMMAND_UNMOUNT,
+  CL_COMMAND_WRITE,
+  CL_COMMAND_UNKNOWN
+} command_id_t;
+
+typedef struct {
+  const char *name;
+  // accepted argument lists, one character per argument: i - int, s - string
+  const char *signatures[COMMAND_LINE_MAX_SIGNATURES];
+  command_line_handler_t handler;
+} command_line_command_t;
+
+static command_line_t *command_line_new(FILE *input, bool prompt) {
+  command_line_t *cl = calloc(1, sizeof(command_line_t));
+  cl->input = input;
+  cl->prompt = prompt;
   return cl;
 }
 
 static void command_line_free(command_line_t *cl) {
-  cl->argc = 0;
+  if (cl->input != stdin) {
+    fclose(cl->input);
+  }
+  free(cl->line);
+  free(cl->data);
+  free(cl);
 }
 
 inline static bool command_line_arg_is_int(command_line_t *cl, int index) {
-  return cl->argv[index]->type == CL_INT;
+  return cl->argv[index].type == CL_INT;
 }
 
 inline static bool command_line_arg_is_str(command_line_t *cl, int index) {
-  return cl->argv[index]->type == CL_STRING;
+  return cl->argv[index].type == CL_STRING;
 }
 
 static bool command_line_check_arg(command_line_t *cl, int index) {
-  return !cl->argc || index > cl->argc || index < 1;
+  return !cl->argc || index >= cl->argc || index < 1;
 }
 
 static int command_line_arg_int(command_line_t *cl, int index) {
@@ -55,7 +111,7 @@ static int command_line_arg_int(command_line_t *cl, int index) {
     return -1;
   }
   if (command_line_arg_is_int(cl, index)) {
-    return atoi(cl->argv[index]->arg); // NOLINT
+    return atoi(cl->argv[index].arg); // NOLINT
   }
   return -1;
 }
@@ -65,200 +121,466 @@ static char *command_line_arg_str(command_line_t *cl, int index) {
     return NULL;
   }
   if (command_line_arg_is_str(cl, index)) {
-    return cl->argv[index]->arg; // NOLINT
+    return cl->argv[index].arg; // NOLINT
   }
   return NULL;
 }
 
-static int command_line_arg_is_number(const char *str) {
-  for (int i = 0; i < strlen(str); i++) {
-    if (!isdigit(str[i])) return 0;
+// splits the line in place, returns false on end of input
+static bool command_line_read(command_line_t *cl) {
+  if (cl->prompt) {
+    printf("Enter command: \n");
+  }
+  cl->argc = 0;
+  ssize_t read = getline(&cl->line, &cl->line_capacity, cl->input);
+  if (read == -1) {
+    return false;
   }
-  return 1;
+  char *cursor = cl->line;
+  while (true) {
+    while (*cursor && isspace((unsigned char) *cursor)) {
+      cursor++;
+    }
+    if (!*cursor) {
+      break;
+    }
+    if (cl->argc == COMMAND_LINE_MAX_NUM_ARG) {
+      cl->argc = 0; // too many arguments for any command
+      break;
+    }
+    command_arg_t *arg = &cl->argv[cl->argc++];
+    arg->arg = cursor;
+    arg->type = CL_INT;
+    for (; *cursor && !isspace((unsigned char) *cursor); cursor++) {
+      if (!isdigit((unsigned char) *cursor)) {
+        arg->type = CL_STRING;
+      }
+    }
+    if (cl->argc == 1) {
+      cl->length = (size_t) (cursor - arg->arg);
+    }
+    if (*cursor) {
+      *cursor++ = '\0';
+    }
+  }
+  return true;
 }
 
-static void command_line_set_arg(command_line_t *cl, char *token, int index) {
-  if (!token) return;
-  cl->argv[index] = (command_arg_t *) malloc(sizeof(command_arg_t));
-  if (command_line_arg_is_number(token)) {
-    cl->argv[index]->type = CL_INT;
-  } else {
-    cl->argv[index]->type = CL_STRING;
+// reads the text of a write command from the next input line, padded with zeros to size bytes;
+// the line buffer is reused, so the command's arguments are gone afterwards
+static char *command_line_read_data(command_line_t *cl, size_t size) {
+  if (cl->prompt) {
+    printf("Enter text to write: \n");
+  }
+  if (!cl->data || cl->data_capacity < size) {
+    free(cl->data);
+    cl->data = malloc(size + 1);
+    cl->data_capacity = size;
+  }
+  ssize_t read = getline(&cl->line, &cl->line_capacity, cl->input);
+  if (read == -1) {
+    return NULL;
   }
-  cl->argv[index]->arg = token;
-  cl->argc++;
+  size_t length = (size_t) read;
+  if (length && cl->line[length - 1] == '\n') {
+    length--;
+  }
+  if (length > size) {
+    length = size;
+  }
+  memcpy(cl->data, cl->line, length);
+  memset(cl->data + length, 0, size - length);
+  return cl->data;
 }
 
-static void command_line_read(command_line_t *cl) {
-  char *value = malloc(sizeof(char *) * COMMAND_LINE_MAX_TEXT_SIZE);
-  printf("Enter command: \n");
-
-  fgets(value, COMMAND_LINE_MAX_TEXT_SIZE, stdin);
-  size_t string_len = strlen(value);
-  size_t last_element = string_len - 1;
-  if (string_len > 0 && (value[last_element] == '\n')) {
-    value[last_element] = '\0';
+// mkfs <max_files, 0 for no limit> [best|next [<image> <size_mb> [<block_size>]]]
+static void command_line_mkfs(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_mkfs_options_t options;
+  fs_mkfs_options_init(&options);
+  options.num_fd = command_line_arg_int(cl, 1);
+  if (cl->argc > 2) {
+    char *policy = command_line_arg_str(cl, 2);
+    if (strcmp(policy, "best") == 0) {
+      options.alloc_policy = ALLOC_BEST_FIT;
+    } else if (strcmp(policy, "next") == 0) {
+      options.alloc_policy = ALLOC_NEXT_FIT;
+    } else {
+      printf("Unknown allocation policy: %s (best, next)\n", policy);
+      return;
+    }
   }
+  if (cl->argc > 3) {
+    options.image_path = command_line_arg_str(cl, 3);
+    options.image_size = (uint64_t) command_line_arg_int(cl, 4) << 20;
+  }
+  if (cl->argc > 5) {
+    options.block_size = command_line_arg_int(cl, 5);
+  }
+  fs_mkfs(ctx, &options);
+}
 
-  char *token = strtok(value, COMMAND_LINE_DELIM_WHITESPACE); // NOLINT
-  command_line_set_arg(cl, token, 0);
-
-  for (int i = 1; token; ++i) {
-    token = strtok(NULL, COMMAND_LINE_DELIM_WHITESPACE); // NOLINT
-    command_line_set_arg(cl, token, i);
+static void command_line_advise(fs_ctx_t *ctx, command_line_t *cl) {
+  char *advice = command_line_arg_str(cl, 2);
+  if (strcmp(advice, "sequential") == 0) {
+    fs_advise(ctx, command_line_arg_int(cl, 1), IMAGE_ADVICE_SEQUENTIAL);
+  } else if (strcmp(advice, "random") == 0) {
+    fs_advise(ctx, command_line_arg_int(cl, 1), IMAGE_ADVICE_RANDOM);
+  } else if (strcmp(advice, "normal") == 0) {
+    fs_advise(ctx, command_line_arg_int(cl, 1), IMAGE_ADVICE_NORMAL);
+  } else {
+    printf("Unknown advice: %s (sequential, random, normal)\n", advice);
   }
 }
 
-inline static bool command_line_check(command_line_t *cl, const char *command, int argc) {
-  if (cl->argv[0]->type != CL_STRING || cl->argc - 1 != argc) {
-    return false;
+static void command_line_bcache(fs_ctx_t *ctx, command_line_t *cl) {
+  block_cache_stats_t stats;
+  if (fs_bcache_stats(ctx, &stats) == 0) {
+    uint64_t lookups = stats.hits + stats.misses;
+    printf("blocks: %u/%u (dirty: %u)\n", stats.num_entries, stats.capacity, stats.num_dirty);
+    printf("hits: %llu, misses: %llu (hit rate: %.1f%%)\n", (unsigned long long) stats.hits,
+           (unsigned long long) stats.misses, lookups ? 100.0 * (double) stats.hits / (double) lookups : 0.0);
+    printf("evictions: %llu, writebacks: %llu, pressure flushes: %llu\n",
+           (unsigned long long) stats.evictions, (unsigned long long) stats.writebacks,
+           (unsigned long long) stats.flushes);
   }
-  return strcmp(cl->argv[0]->arg, command) == 0;
-}
-
-#define COMMAND_LINE_IS_EXIT(cl)      command_line_check((cl), "exit", 0)
-#define COMMAND_LINE_IS_LS(cl)        command_line_check((cl), "ls", 0)
-#define COMMAND_LINE_IS_MOUNT(cl)     command_line_check((cl), "mount", 0)
-#define COMMAND_LINE_IS_UNMOUNT(cl)   command_line_check((cl), "unmount", 0)
-
-#define COMMAND_LINE_IS_MKFS(cl)      command_line_check((cl), "mkfs", 1) && command_line_arg_is_int(cl, 1)
-#define COMMAND_LINE_IS_FSTAT(cl)     command_line_check((cl), "fstat", 1) && command_line_arg_is_int(cl, 1)
-#define COMMAND_LINE_IS_CREATE(cl)    command_line_check((cl), "create", 1) && command_line_arg_is_str(cl, 1)
-#define COMMAND_LINE_IS_UNLINK(cl)    command_line_check((cl), "unlink", 1) && command_line_arg_is_str(cl, 1)
-#define COMMAND_LINE_IS_OPEN(cl)      command_line_check((cl), "open", 1) && command_line_arg_is_str(cl, 1)
-#define COMMAND_LINE_IS_CLOSE(cl)     command_line_check((cl), "close", 1) && command_line_arg_is_int(cl, 1)
-#define COMMAND_LINE_IS_CD(cl)        command_line_check((cl), "cd", 1) && command_line_arg_is_str(cl, 1)
-#define COMMAND_LINE_IS_MKDIR(cl)     command_line_check((cl), "mkdir", 1) && command_line_arg_is_str(cl, 1)
-#define COMMAND_LINE_IS_RMDIR(cl)     command_line_check((cl), "rmdir", 1) && command_line_arg_is_str(cl, 1)
-
-#define COMMAND_LINE_IS_LINK(cl)          \
-  command_line_check((cl), "link", 2) &&  \
-  command_line_arg_is_str(cl, 1)      &&  \
-  command_line_arg_is_str(cl, 2)
-
-#define COMMAND_LINE_IS_SYMLINK(cl)          \
-  command_line_check((cl), "symlink", 2) &&  \
-  command_line_arg_is_str(cl, 1)      &&  \
-  command_line_arg_is_str(cl, 2)
-
-#define COMMAND_LINE_IS_TRUNCATE(cl)         \
-  command_line_check((cl), "truncate", 2) && \
-  command_line_arg_is_str(cl, 1)          && \
-  command_line_arg_is_int(cl, 2)
-
-#define COMMAND_LINE_IS_READ(cl)          \
-  command_line_check((cl), "read", 3) &&  \
-  command_line_arg_is_int(cl, 1)      &&  \
-  command_line_arg_is_int(cl, 2)      &&  \
-  command_line_arg_is_int(cl, 3)
-
-#define COMMAND_LINE_IS_WRITE(cl)          \
-  command_line_check((cl), "write", 3) &&  \
-  command_line_arg_is_int(cl, 1)       &&  \
-  command_line_arg_is_int(cl, 2)       &&  \
-  command_line_arg_is_int(cl, 3)
-
-static void command_line_execute(command_line_t *cl) {
-  command_line_read(cl);
-  if (COMMAND_LINE_IS_EXIT(cl)) {
-    free(cl);
-    exit(EXIT_SUCCESS);
-  }
-  if (COMMAND_LINE_IS_MKFS(cl)) {
-    fs_mkfs(command_line_arg_int(cl, 1));
+}
+
+// journal [commit interval in microseconds]
+static void command_line_journal(fs_ctx_t *ctx, command_line_t *cl) {
+  if (cl->argc == 2) {
+    fs_set_commit_interval(ctx, (uint32_t) command_line_arg_int(cl, 1));
     return;
   }
-  if (COMMAND_LINE_IS_MOUNT(cl)) {
-    fs_mount();
-    return;
+  journal_stats_t stats;
+  if (fs_journal_stats(ctx, &stats) == 0) {
+    printf("records: %llu (%llu bytes), commits: %llu\n", (unsigned long long) stats.records,
+           (unsigned long long) stats.bytes, (unsigned long long) stats.commits);
+    printf("checkpoints: %llu, replayed: %llu, dropped: %llu\n", (unsigned long long) stats.checkpoints,
+           (unsigned long long) stats.replayed, (unsigned long long) stats.dropped);
   }
-  if (COMMAND_LINE_IS_UNMOUNT(cl)) {
-    fs_unmount();
-    return;
+}
+
+static void command_line_cd(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_cd(ctx, command_line_arg_str(cl, 1));
+}
+
+static void command_line_close(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_close(ctx, command_line_arg_int(cl, 1));
+}
+
+// compact [time budget in microseconds]
+static void command_line_compact(fs_ctx_t *ctx, command_line_t *cl) {
+  uint32_t budget_us = cl->argc == 2 ? (uint32_t) command_line_arg_int(cl, 1) : COMMAND_LINE_COMPACT_BUDGET_US;
+  fs_compact_result_t result;
+  if (fs_compact(ctx, budget_us, &result) == 0) {
+    printf("files: %llu, extents moved: %llu, blocks moved: %llu%s\n", (unsigned long long) result.files,
+           (unsigned long long) result.extents_moved, (unsigned long long) result.blocks_moved,
+           result.wrapped ? " (pass done)" : "");
   }
-  if (COMMAND_LINE_IS_FSTAT(cl)) {
-    fs_fstat(command_line_arg_int(cl, 1));
-    return;
+}
+
+static void command_line_create(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_create(ctx, command_line_arg_str(cl, 1));
+}
+
+static void command_line_dcache(fs_ctx_t *ctx, command_line_t *cl) {
+  dentry_cache_stats_t stats;
+  if (fs_dcache_stats(ctx, &stats) == 0) {
+    printf("entries: %u/%u\n", stats.num_entries, stats.capacity);
+    printf("hits: %llu (negative: %llu)\n", (unsigned long long) stats.hits,
+           (unsigned long long) stats.negative_hits);
+    printf("misses: %llu\n", (unsigned long long) stats.misses);
+    printf("insertions: %llu, evictions: %llu, invalidations: %llu\n",
+           (unsigned long long) stats.insertions, (unsigned long long) stats.evictions,
+           (unsigned long long) stats.invalidations);
   }
-  if (COMMAND_LINE_IS_LS(cl)) {
-    fs_ls();
+}
+
+_Noreturn static void command_line_exit(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_ctx_free(ctx);
+  command_line_free(cl);
+  exit(EXIT_SUCCESS);
+}
+
+// free runs and extents per file, as counts per power of two
+static void command_line_frag(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_frag_report_t report;
+  if (fs_frag_report(ctx, &report) != 0) {
     return;
   }
-  if (COMMAND_LINE_IS_CREATE(cl)) {
-    fs_create(command_line_arg_str(cl, 1));
-    return;
+  printf("free blocks: %llu in %llu runs, largest run: %llu\n", (unsigned long long) report.free.num_free,
+         (unsigned long long) report.free.num_runs, (unsigned long long) report.free.largest_run);
+  for (uint32_t i = 0; i < BLOCK_ALLOCATOR_RUN_BUCKETS; i++) {
+    if (report.free.runs[i]) {
+      printf("  runs of %llu+ blocks: %llu\n", 1ULL << i, (unsigned long long) report.free.runs[i]);
+    }
   }
-  if (COMMAND_LINE_IS_OPEN(cl)) {
-    fs_open(command_line_arg_str(cl, 1));
-    return;
+  printf("files: %llu, extents: %llu, most in a file: %llu\n", (unsigned long long) report.num_files,
+         (unsigned long long) report.num_extents, (unsigned long long) report.max_extents);
+  for (uint32_t i = 0; i < FS_FRAG_BUCKETS; i++) {
+    if (report.extents[i]) {
+      printf("  files of %llu+ extents: %llu\n", 1ULL << i, (unsigned long long) report.extents[i]);
+    }
   }
-  if (COMMAND_LINE_IS_CLOSE(cl)) {
-    fs_close(command_line_arg_int(cl, 1));
-    return;
+}
+
+static void command_line_fstat(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_fstat(ctx, (uint64_t) command_line_arg_int(cl, 1));
+}
+
+static void command_line_link(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_link(ctx, command_line_arg_str(cl, 1), command_line_arg_str(cl, 2));
+}
+
+static void command_line_ls(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_ls(ctx);
+}
+
+static void command_line_mkdir(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_mkdir(ctx, command_line_arg_str(cl, 1));
+}
+
+// mount [<image> [<snapshot>]], a snapshot mounts read only
+static void command_line_mount(fs_ctx_t *ctx, command_line_t *cl) {
+  if (cl->argc > 2) {
+    fs_mount_snapshot(ctx, command_line_arg_str(cl, 1), command_line_arg_str(cl, 2));
+  } else {
+    fs_mount(ctx, cl->argc > 1 ? command_line_arg_str(cl, 1) : NULL);
   }
-  if (COMMAND_LINE_IS_READ(cl)) {
-    int fd = command_line_arg_int(cl, 1);
-    int offset = command_line_arg_int(cl, 2);
-    int size = command_line_arg_int(cl, 3);
-    fs_read(fd, offset, size);
+}
+
+static void command_line_open(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_open(ctx, command_line_arg_str(cl, 1));
+}
+
+static void command_line_fs_read(fs_ctx_t *ctx, command_line_t *cl) {
+  int fd = command_line_arg_int(cl, 1);
+  int offset = command_line_arg_int(cl, 2);
+  int size = command_line_arg_int(cl, 3);
+  fs_read(ctx, fd, offset, size);
+}
+
+static void command_line_rmdir(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_rmdir(ctx, command_line_arg_str(cl, 1));
+}
+
+static void command_line_rmsnapshot(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_snapshot_delete(ctx, command_line_arg_str(cl, 1));
+}
+
+static void command_line_snapshot(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_snapshot(ctx, command_line_arg_str(cl, 1));
+}
+
+// calls, errors and latency percentiles of every fs_* call made so far, then the internal counters
+static void command_line_stats(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_stats_t stats;
+  if (fs_stats_snapshot(&stats) != 0) {
+    printf("Stats are compiled out\n");
     return;
   }
-  if (COMMAND_LINE_IS_WRITE(cl)) {
-    int fd = command_line_arg_int(cl, 1);
-    int offset = command_line_arg_int(cl, 2);
-    int size = command_line_arg_int(cl, 3);
-    char *value = malloc(sizeof(char) * size);
-    printf("Enter text to write: \n");
-    fgets(value, COMMAND_LINE_MAX_TEXT_SIZE, stdin);
+  printf("%-20s %10s %8s %12s %10s %10s %10s %10s\n", "call", "calls", "errors", "bytes", "avg ns", "p50 ns",
+         "p99 ns", "p999 ns");
+  for (uint32_t i = 0; i < FS_NUM_OPS; i++) {
+    fs_op_stats_t *op_stats = &stats.ops[i];
+    if (!op_stats->calls) {
+      continue;
+    }
+    printf("%-20s %10llu %8llu %12llu %10llu %10llu %10llu %10llu\n", fs_stats_op_name((fs_op_t) i),
+           (unsigned long long) op_stats->calls, (unsigned long long) op_stats->errors,
+           (unsigned long long) op_stats->bytes, (unsigned long long) (op_stats->total_ns / op_stats->calls),
+           (unsigned long long) fs_stats_percentile(op_stats, 0.5),
+           (unsigned long long) fs_stats_percentile(op_stats, 0.99),
+           (unsigned long long) fs_stats_percentile(op_stats, 0.999));
+  }
+  printf("path components: %llu, bitmap words: %llu, tree nodes: %llu\n",
+         (unsigned long long) stats.path_components, (unsigned long long) stats.bitmap_words,
+         (unsigned long long) stats.tree_nodes);
+}
 
-    fs_write(fd, value, offset, size);
-    return;
+static void command_line_symlink(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_symlink(ctx, command_line_arg_str(cl, 1), command_line_arg_str(cl, 2));
+}
+
+static void command_line_sync(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_sync(ctx);
+}
+
+static void command_line_truncate(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_truncate(ctx, command_line_arg_str(cl, 1), command_line_arg_int(cl, 2));
+}
+
+static void command_line_unlink(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_unlink(ctx, command_line_arg_str(cl, 1));
+}
+
+static void command_line_unmount(fs_ctx_t *ctx, command_line_t *cl) {
+  fs_unmount(ctx);
+}
+
+// write <fd> <offset> <size>, the text follows on the next line
+static void command_line_fs_write(fs_ctx_t *ctx, command_line_t *cl) {
+  int fd = command_line_arg_int(cl, 1);
+  int offset = command_line_arg_int(cl, 2);
+  int size = command_line_arg_int(cl, 3);
+  char *value = command_line_read_data(cl, (size_t) size);
+  if (value) {
+    fs_write(ctx, fd, value, offset, size);
   }
-  if (COMMAND_LINE_IS_LINK(cl)) {
-    char *path1 = command_line_arg_str(cl, 1);
-    char *path2 = command_line_arg_str(cl, 2);
-    fs_link(path1, path2);
-    return;
+}
+
+static const command_line_command_t command_line_commands[CL_COMMAND_UNKNOWN] = {
+    [CL_COMMAND_ADVISE] = {"advise", {"is"}, command_line_advise},
+    [CL_COMMAND_BCACHE] = {"bcache", {""}, command_line_bcache},
+    [CL_COMMAND_CD] = {"cd", {"s"}, command_line_cd},
+    [CL_COMMAND_CLOSE] = {"close", {"i"}, command_line_close},
+    [CL_COMMAND_COMPACT] = {"compact", {"", "i"}, command_line_compact},
+    [CL_COMMAND_CREATE] = {"create", {"s"}, command_line_create},
+    [CL_COMMAND_DCACHE] = {"dcache", {""}, command_line_dcache},
+    [CL_COMMAND_EXIT] = {"exit", {""}, command_line_exit},
+    [CL_COMMAND_FRAG] = {"frag", {""}, command_line_frag},
+    [CL_COMMAND_FSTAT] = {"fstat", {"i"}, command_line_fstat},
+    [CL_COMMAND_JOURNAL] = {"journal", {"", "i"}, command_line_journal},
+    [CL_COMMAND_LINK] = {"link", {"ss"}, command_line_link},
+    [CL_COMMAND_LS] = {"ls", {""}, command_line_ls},
+    [CL_COMMAND_MKDIR] = {"mkdir", {"s"}, command_line_mkdir},
+    [CL_COMMAND_MKFS] = {"mkfs", {"i", "is", "issi", "issii"}, command_line_mkfs},
+    [CL_COMMAND_MOUNT] = {"mount", {"", "s", "ss"}, command_line_mount},
+    [CL_COMMAND_OPEN] = {"open", {"s"}, command_line_open},
+    [CL_COMMAND_READ] = {"read", {"iii"}, command_line_fs_read},
+    [CL_COMMAND_RMDIR] = {"rmdir", {"s"}, command_line_rmdir},
+    [CL_COMMAND_RMSNAPSHOT] = {"rmsnapshot", {"s"}, command_line_rmsnapshot},
+    [CL_COMMAND_SNAPSHOT] = {"snapshot", {"s"}, command_line_snapshot},
+    [CL_COMMAND_STATS] = {"stats", {""}, command_line_stats},
+    [CL_COMMAND_SYMLINK] = {"symlink", {"ss"}, command_line_symlink},
+    [CL_COMMAND_SYNC] = {"sync", {""}, command_line_sync},
+    [CL_COMMAND_TRUNCATE] = {"truncate", {"si"}, command_line_truncate},
+    [CL_COMMAND_UNLINK] = {"unlink", {"s"}, command_line_unlink},
+    [CL_COMMAND_UNMOUNT] = {"unmount", {""}, command_line_unmount},
+    [CL_COMMAND_WRITE] = {"write", {"iii"}, command_line_fs_write},
+};
+
+// at most one candidate per first character and length, confirmed with a single memcmp
+static command_id_t command_line_find(const char *name, size_t length) {
+  command_id_t id = CL_COMMAND_UNKNOWN;
+  switch (name[0]) {
+    case 'a':
+      id = CL_COMMAND_ADVISE;
+      break;
+    case 'b':
+      id = CL_COMMAND_BCACHE;
+      break;
+    case 'c':
+      id = length == 2 ? CL_COMMAND_CD : length == 5 ? CL_COMMAND_CLOSE : length == 6 ? CL_COMMAND_CREATE
+                                                                                     : CL_COMMAND_COMPACT;
+      break;
+    case 'd':
+      id = CL_COMMAND_DCACHE;
+      break;
+    case 'e':
+      id = CL_COMMAND_EXIT;
+      break;
+    case 'f':
+      id = length == 4 ? CL_COMMAND_FRAG : CL_COMMAND_FSTAT;
+      break;
+    case 'j':
+      id = CL_COMMAND_JOURNAL;
+      break;
+    case 'l':
+      id = length == 2 ? CL_COMMAND_LS : CL_COMMAND_LINK;
+      break;
+    case 'm':
+      id = length == 4 ? CL_COMMAND_MKFS : name[1] == 'k' ? CL_COMMAND_MKDIR : CL_COMMAND_MOUNT;
+      break;
+    case 'o':
+      id = CL_COMMAND_OPEN;
+      break;
+    case 'r':
+      id = length == 4 ? CL_COMMAND_READ : length == 5 ? CL_COMMAND_RMDIR : CL_COMMAND_RMSNAPSHOT;
+      break;
+    case 's':
+      id = length == 4 ? CL_COMMAND_SYNC : length == 5 ? CL_COMMAND_STATS : length == 7 ? CL_COMMAND_SYMLINK
+                                                                                      : CL_COMMAND_SNAPSHOT;
+      break;
+    case 't':
+      id = CL_COMMAND_TRUNCATE;
+      break;
+    case 'u':
+      id = length == 6 ? CL_COMMAND_UNLINK : CL_COMMAND_UNMOUNT;
+      break;
+    case 'w':
+      id = CL_COMMAND_WRITE;
+      break;
+    default:
+      return CL_COMMAND_UNKNOWN;
   }
-  if (COMMAND_LINE_IS_UNLINK(cl)) {
-    char *path1 = command_line_arg_str(cl, 1);
-    fs_unlink(path1);
-    return;
+  const char *candidate = command_line_commands[id].name;
+  if (strlen(candidate) != length || memcmp(candidate, name, length) != 0) {
+    return CL_COMMAND_UNKNOWN;
   }
-  if (COMMAND_LINE_IS_TRUNCATE(cl)) {
-    char *path = command_line_arg_str(cl, 1);
-    uint32_t size = command_line_arg_int(cl, 2);
-    fs_truncate(path, size);
-    return;
+  return id;
+}
+
+static bool command_line_match(command_line_t *cl, const char *signature) {
+  if (!signature || strlen(signature) != (size_t) (cl->argc - 1)) {
+    return false;
   }
-  if (COMMAND_LINE_IS_CD(cl)) {
-    char *path = command_line_arg_str(cl, 1);
-    fs_cd(path);
-    return;
+  for (int i = 1; i < cl->argc; i++) {
+    command_type_t type = signature[i - 1] == 'i' ? CL_INT : CL_STRING;
+    if (cl->argv[i].type != type) {
+      return false;
+    }
   }
-  if (COMMAND_LINE_IS_MKDIR(cl)) {
-    char *path = command_line_arg_str(cl, 1);
-    fs_mkdir(path);
-    return;
+  return true;
+}
+
+static void command_line_execute(fs_ctx_t *ctx, command_line_t *cl) {
+  if (!command_line_read(cl)) {
+    command_line_exit(ctx, cl);
   }
-  if (COMMAND_LINE_IS_RMDIR(cl)) {
-    char *path = command_line_arg_str(cl, 1);
-    fs_rmdir(path);
+  if (!cl->argc || cl->argv[0].type != CL_STRING) {
     return;
   }
-  if (COMMAND_LINE_IS_SYMLINK(cl)) {
-    char *str = command_line_arg_str(cl, 1);
-    char *path = command_line_arg_str(cl, 2);
-    fs_symlink(str, path);
+  command_id_t id = command_line_find(cl->argv[0].arg, cl->length);
+  if (id == CL_COMMAND_UNKNOWN) {
     return;
   }
+  const command_line_command_t *command = &command_line_commands[id];
+  for (int i = 0; i < COMMAND_LINE_MAX_SIGNATURES; i++) {
+    if (command_line_match(cl, command->signatures[i])) {
+      command->handler(ctx, cl);
+      return;
+    }
+  }
+}
+
+static _Noreturn void command_line_usage(const char *program) {
+  fprintf(stderr, "usage: %s [--quiet] [script]\n", program);
+  exit(EXIT_FAILURE);
 }
 
-_Noreturn void command_line_run() {
-  command_line_t *cl = command_line_new();
+_Noreturn void command_line_run(int argc, char **argv) {
+  bool quiet = false;
+  const char *script = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else if (argv[i][0] == '-' || script) {
+      command_line_usage(argv[0]);
+    } else {
+      script = argv[i];
+    }
+  }
+  FILE *input = stdin;
+  if (script && !(input = fopen(script, "r"))) {
+    fprintf(stderr, "Cannot open script %s\n", script);
+    exit(EXIT_FAILURE);
+  }
+  // prompts only make sense for a person typing at a terminal
+  command_line_t *cl = command_line_new(input, !quiet && !script && isatty(STDIN_FILENO));
+  fs_ctx_t *ctx = fs_ctx_new();
+  fs_ctx_set_quiet(ctx, quiet);
   while (true) {
-    command_line_execute(cl);
-    command_line_free(cl);
+    command_line_execute(ctx, cl);
   }
 }
-
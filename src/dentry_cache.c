@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dentry_cache.h"
+
+inline static uint32_t dentry_cache_set_index(dentry_cache_t *cache, file_t *dir, uint32_t hash) {
+  uint32_t dir_hash = (uint32_t) (((uintptr_t) dir) >> 4) * 0x9E3779B1u;
+  return (dir_hash ^ hash) & (cache->num_sets - 1);
+}
+
+inline static dentry_cache_stripe_t *dentry_cache_stripe(dentry_cache_t *cache, uint32_t set_index) {
+  return &cache->stripes[set_index & (DENTRY_CACHE_STRIPES - 1)];
+}
+
+inline static bool dentry_matches(const dentry_t *dentry, file_t *dir, const char *name, size_t length,
+                                  uint32_t hash) {
+  return dentry->dir == dir && dentry->hash == hash && dentry->length == length &&
+         memcmp(dentry->name, name, length) == 0;
+}
+
+inline static void dentry_clear(dentry_cache_stripe_t *stripe, dentry_t *dentry) {
+  dentry->dir = NULL;
+  dentry->file = NULL;
+  stripe->stats.num_entries--;
+}
+
+dentry_cache_t *dentry_cache_new(uint32_t num_entries) {
+  dentry_cache_t *cache;
+  if (posix_memalign((void **) &cache, __alignof__(dentry_cache_stripe_t), sizeof(dentry_cache_t))) {
+    return NULL;
+  }
+  uint32_t num_sets = 1;
+  while (num_sets * DENTRY_CACHE_WAYS < num_entries) {
+    num_sets *= 2;
+  }
+  cache->num_sets = num_sets;
+  cache->entries = calloc(num_sets * DENTRY_CACHE_WAYS, sizeof(dentry_t));
+  cache->victims = calloc(num_sets, sizeof(uint8_t));
+  for (uint32_t i = 0; i < DENTRY_CACHE_STRIPES; i++) {
+    pthread_mutex_init(&cache->stripes[i].lock, NULL);
+    memset(&cache->stripes[i].stats, 0, sizeof(dentry_cache_stats_t));
+  }
+  return cache;
+}
+
+void dentry_cache_free(dentry_cache_t *cache) {
+  if (!cache) return;
+  for (uint32_t i = 0; i < DENTRY_CACHE_STRIPES; i++) {
+    pthread_mutex_destroy(&cache->stripes[i].lock);
+  }
+  free(cache->entries);
+  free(cache->victims);
+  free(cache);
+}
+
+bool dentry_cache_lookup(dentry_cache_t *cache, file_t *dir, const char *name, size_t length, uint32_t hash,
+                         file_t **file) {
+  uint32_t set_index = dentry_cache_set_index(cache, dir, hash);
+  dentry_cache_stripe_t *stripe = dentry_cache_stripe(cache, set_index);
+  pthread_mutex_lock(&stripe->lock);
+  if (length <= DENTRY_CACHE_NAME_LENGTH) {
+    dentry_t *set = &cache->entries[set_index * DENTRY_CACHE_WAYS];
+    for (uint32_t way = 0; way < DENTRY_CACHE_WAYS; way++) {
+      if (dentry_matches(&set[way], dir, name, length, hash)) {
+        *file = set[way].file;
+        stripe->stats.hits++;
+        if (!*file) {
+          stripe->stats.negative_hits++;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+        return true;
+      }
+    }
+  }
+  stripe->stats.misses++;
+  pthread_mutex_unlock(&stripe->lock);
+  return false;
+}
+
+void dentry_cache_insert(dentry_cache_t *cache, file_t *dir, const char *name, size_t length, uint32_t hash,
+                         file_t *file) {
+  if (length > DENTRY_CACHE_NAME_LENGTH) return;
+  uint32_t set_index = dentry_cache_set_index(cache, dir, hash);
+  dentry_cache_stripe_t *stripe = dentry_cache_stripe(cache, set_index);
+  dentry_t *set = &cache->entries[set_index * DENTRY_CACHE_WAYS];
+  pthread_mutex_lock(&stripe->lock);
+  dentry_t *dentry = NULL;
+  for (uint32_t way = 0; way < DENTRY_CACHE_WAYS && !dentry; way++) {
+    if (!set[way].dir || dentry_matches(&set[way], dir, name, length, hash)) {
+      dentry = &set[way];
+    }
+  }
+  if (!dentry) {
+    uint8_t *victim = &cache->victims[set_index];
+    dentry = &set[*victim];
+    *victim = (*victim + 1) % DENTRY_CACHE_WAYS;
+    dentry_clear(stripe, dentry);
+    stripe->stats.evictions++;
+  } else if (dentry->dir) {
+    dentry_clear(stripe, dentry);
+  }
+  dentry->dir = dir;
+  dentry->file = file;
+  dentry->hash = hash;
+  dentry->length = (uint32_t) length;
+  memcpy(dentry->name, name, length);
+  stripe->stats.num_entries++;
+  stripe->stats.insertions++;
+  pthread_mutex_unlock(&stripe->lock);
+}
+
+void dentry_cache_invalidate(dentry_cache_t *cache, file_t *dir, const char *name, size_t length, uint32_t hash) {
+  if (length > DENTRY_CACHE_NAME_LENGTH) return;
+  uint32_t set_index = dentry_cache_set_index(cache, dir, hash);
+  dentry_cache_stripe_t *stripe = dentry_cache_stripe(cache, set_index);
+  dentry_t *set = &cache->entries[set_index * DENTRY_CACHE_WAYS];
+  pthread_mutex_lock(&stripe->lock);
+  for (uint32_t way = 0; way < DENTRY_CACHE_WAYS; way++) {
+    if (dentry_matches(&set[way], dir, name, length, hash)) {
+      dentry_clear(stripe, &set[way]);
+      stripe->stats.invalidations++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&stripe->lock);
+}
+
+void dentry_cache_invalidate_dir(dentry_cache_t *cache, file_t *dir) {
+  for (uint32_t set_index = 0; set_index < cache->num_sets; set_index++) {
+    dentry_cache_stripe_t *stripe = dentry_cache_stripe(cache, set_index);
+    dentry_t *set = &cache->entries[set_index * DENTRY_CACHE_WAYS];
+    pthread_mutex_lock(&stripe->lock);
+    for (uint32_t way = 0; way < DENTRY_CACHE_WAYS; way++) {
+      if (set[way].dir && (set[way].dir == dir || set[way].file == dir)) {
+        dentry_clear(stripe, &set[way]);
+        stripe->stats.invalidations++;
+      }
+    }
+    pthread_mutex_unlock(&stripe->lock);
+  }
+}
+
+void dentry_cache_stats(dentry_cache_t *cache, dentry_cache_stats_t *stats) {
+  memset(stats, 0, sizeof(dentry_cache_stats_t));
+  for (uint32_t i = 0; i < DENTRY_CACHE_STRIPES; i++) {
+    dentry_cache_stripe_t *stripe = &cache->stripes[i];
+    pthread_mutex_lock(&stripe->lock);
+    stats->hits += stripe->stats.hits;
+    stats->negative_hits += stripe->stats.negative_hits;
+    stats->misses += stripe->stats.misses;
+    stats->insertions += stripe->stats.insertions;
+    stats->evictions += stripe->stats.evictions;
+    stats->invalidations += stripe->stats.invalidations;
+    stats->num_entries += stripe->stats.num_entries;
+    pthread_mutex_unlock(&stripe->lock);
+  }
+  stats->capacity = cache->num_sets * DENTRY_CACHE_WAYS;
+}
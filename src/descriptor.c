@@ -1,26 +1,62 @@
 #include <stdio.h>
 #include "descriptor.h"
+#include "file.h"
 
-size_t global_fd_id; // used for generation unique fd_id
-
-fs_descriptor_t *fs_descriptor_new(fs_type_t type, int32_t file_size) {
-  fs_descriptor_t *fs_descriptor = malloc(sizeof(fs_descriptor_t));
-  fs_descriptor->links = linked_list_new();
+fs_descriptor_t *fs_descriptor_new(arena_t *arena, size_t id, fs_type_t type, int32_t file_size) {
+  fs_descriptor_t *fs_descriptor = slab_pool_alloc(&arena->descriptors);
+  pthread_rwlock_init(&fs_descriptor->lock, NULL);
+  fs_descriptor->links = NULL;
+  fs_descriptor->index = type == FS_DIRECTORY ? dir_index_new(arena) : NULL;
+  extent_map_init(&fs_descriptor->extents, &arena->extent_nodes);
   fs_descriptor->type = type;
-  fs_descriptor->id = global_fd_id++;
+  fs_descriptor->id = id;
   fs_descriptor->file_size = file_size;
+  fs_descriptor->loaded = false;
+  fs_descriptor->dirty = false;
+  fs_descriptor->num_links = 1;
   return fs_descriptor;
 }
 
+void fs_descriptor_free(arena_t *arena, fs_descriptor_t *descriptor) {
+  if (!descriptor) return;
+  if (descriptor->links) {
+    linked_list_free(descriptor->links);
+    arena_release(arena, descriptor->links, sizeof(linked_list_t));
+  }
+  dir_index_free(descriptor->index);
+  extent_map_destroy(&descriptor->extents);
+  pthread_rwlock_destroy(&descriptor->lock);
+  slab_pool_release(&arena->descriptors, descriptor);
+}
+
+linked_list_t *fs_descriptor_links(arena_t *arena, fs_descriptor_t *descriptor) {
+  if (!descriptor->links) {
+    descriptor->links = arena_alloc(arena, sizeof(linked_list_t));
+    linked_list_init(descriptor->links, &arena->list_nodes);
+  }
+  return descriptor->links;
+}
+
 void fs_descriptor_show(fs_descriptor_t *descriptor) {
   if (!descriptor) return;
   printf("id: %zu\n", descriptor->id);
   printf("file_size_in_bytes: %d\n", descriptor->file_size);
-  if (descriptor->links && descriptor->links->count) {
+  if (descriptor->type == FS_FILE) {
+    printf("num_links: %u\n", descriptor->num_links);
+  }
+  if (descriptor->index) {
+    if (descriptor->index->count) {
+      printf("links:\n");
+      for (uint32_t i = 0; i < descriptor->index->count; i++) {
+        printf("link: %s", descriptor->index->entries[i].file->name);
+      }
+      printf("\n");
+    }
+  } else if (descriptor->links && descriptor->links->count) {
     printf("links:\n");
     node_t *current = descriptor->links->head;
     while (current) {
-      printf("link: %s", ((char *) (current->value)));
+      printf("link: %s", ((file_t *) current->value)->name);
       current = current->next;
     }
     printf("\n");
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dir_index.h"
+#include "file.h"
+
+#define DIR_INDEX_DEFAULT_CAPACITY 16
+#define DIR_INDEX_MIGRATE_STEP 4 // old slots moved per insert while growing
+#define DIR_INDEX_EMPTY UINT32_MAX
+#define DIR_INDEX_TOMBSTONE (UINT32_MAX - 1)
+
+uint32_t dir_index_hash(const char *name, size_t length) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+inline static bool dir_index_slot_is_live(const dir_index_slot_t *slot) {
+  return slot->position < DIR_INDEX_TOMBSTONE;
+}
+
+inline static bool dir_entry_matches(const dir_entry_t *entry, const char *name, size_t length, uint32_t hash) {
+  return entry->hash == hash && entry->name_length == length && memcmp(entry->file->name, name, length) == 0;
+}
+
+static void dir_index_table_init(dir_index_t *dir_index, dir_index_table_t *table, uint32_t capacity) {
+  table->slots = capacity ? arena_alloc(dir_index->arena, capacity * sizeof(dir_index_slot_t)) : NULL;
+  if (table->slots) {
+    // every position reads DIR_INDEX_EMPTY
+    memset(table->slots, 0xff, capacity * sizeof(dir_index_slot_t));
+  }
+  table->capacity = capacity;
+  table->used = 0;
+}
+
+static void dir_index_table_free(dir_index_t *dir_index, dir_index_table_t *table) {
+  arena_release(dir_index->arena, table->slots, table->capacity * sizeof(dir_index_slot_t));
+}
+
+static dir_index_slot_t *dir_index_table_find(dir_index_t *dir_index, dir_index_table_t *table, const char *name,
+                                              size_t length, uint32_t hash) {
+  if (!table->slots) return NULL;
+  uint32_t mask = table->capacity - 1;
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    dir_index_slot_t *slot = &table->slots[i];
+    if (slot->position == DIR_INDEX_EMPTY) {
+      return NULL;
+    }
+    if (slot->position != DIR_INDEX_TOMBSTONE && slot->hash == hash &&
+        dir_entry_matches(&dir_index->entries[slot->position], name, length, hash)) {
+      return slot;
+    }
+  }
+}
+
+static dir_index_slot_t *dir_index_table_find_file(dir_index_t *dir_index, dir_index_table_t *table,
+                                                   struct file *file) {
+  if (!table->slots) return NULL;
+  uint32_t mask = table->capacity - 1;
+  for (uint32_t i = file->name_hash & mask;; i = (i + 1) & mask) {
+    dir_index_slot_t *slot = &table->slots[i];
+    if (slot->position == DIR_INDEX_EMPTY) {
+      return NULL;
+    }
+    if (slot->position != DIR_INDEX_TOMBSTONE && dir_index->entries[slot->position].file == file) {
+      return slot;
+    }
+  }
+}
+
+static dir_index_slot_t *dir_index_table_find_position(dir_index_table_t *table, uint32_t hash, uint32_t position) {
+  if (!table->slots) return NULL;
+  uint32_t mask = table->capacity - 1;
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    dir_index_slot_t *slot = &table->slots[i];
+    if (slot->position == DIR_INDEX_EMPTY) {
+      return NULL;
+    }
+    if (slot->position == position) {
+      return slot;
+    }
+  }
+}
+
+static void dir_index_table_insert(dir_index_table_t *table, uint32_t hash, uint32_t position) {
+  uint32_t mask = table->capacity - 1;
+  uint32_t i = hash & mask;
+  while (dir_index_slot_is_live(&table->slots[i])) {
+    i = (i + 1) & mask;
+  }
+  if (table->slots[i].position == DIR_INDEX_EMPTY) {
+    table->used++;
+  }
+  table->slots[i].hash = hash;
+  table->slots[i].position = position;
+}
+
+// the slot of the entry moved from position last to position, in whichever table holds it
+static dir_index_slot_t *dir_index_slot(dir_index_t *dir_index, uint32_t position, uint32_t last) {
+  uint32_t hash = dir_index->entries[position].hash;
+  dir_index_slot_t *slot = dir_index_table_find_position(&dir_index->table, hash, last);
+  return slot ? slot : dir_index_table_find_position(&dir_index->old_table, hash, last);
+}
+
+static void dir_index_migrate(dir_index_t *dir_index, uint32_t num_slots) {
+  dir_index_table_t *old_table = &dir_index->old_table;
+  while (num_slots-- && dir_index->migrate_cursor < old_table->capacity) {
+    dir_index_slot_t *slot = &old_table->slots[dir_index->migrate_cursor++];
+    if (dir_index_slot_is_live(slot)) {
+      dir_index_table_insert(&dir_index->table, slot->hash, slot->position);
+      slot->position = DIR_INDEX_TOMBSTONE;
+    }
+  }
+  if (dir_index->migrate_cursor == old_table->capacity) {
+    dir_index_table_free(dir_index, old_table);
+    dir_index_table_init(dir_index, old_table, 0);
+  }
+}
+
+static void dir_index_grow(dir_index_t *dir_index) {
+  if (dir_index->old_table.slots) {
+    dir_index_migrate(dir_index, dir_index->old_table.capacity);
+  }
+  uint32_t capacity = dir_index->table.capacity;
+  // a table full of tombstones is rebuilt at the same size
+  if ((dir_index->count + 1) * 2 > capacity) {
+    capacity *= 2;
+  }
+  dir_index->old_table = dir_index->table;
+  dir_index->migrate_cursor = 0;
+  dir_index_table_init(dir_index, &dir_index->table, capacity);
+}
+
+// makes room for one more entry, the inline entries move out when they are full
+static void dir_index_reserve(dir_index_t *dir_index) {
+  if (dir_index->count < dir_index->capacity) {
+    return;
+  }
+  uint32_t capacity = dir_index->capacity * 2;
+  dir_entry_t *entries = arena_alloc(dir_index->arena, capacity * sizeof(dir_entry_t));
+  memcpy(entries, dir_index->entries, dir_index->count * sizeof(dir_entry_t));
+  if (dir_index->entries != dir_index->inline_entries) {
+    arena_release(dir_index->arena, dir_index->entries, dir_index->capacity * sizeof(dir_entry_t));
+  }
+  dir_index->entries = entries;
+  dir_index->capacity = capacity;
+}
+
+dir_index_t *dir_index_new(arena_t *arena) {
+  dir_index_t *dir_index = arena_alloc(arena, sizeof(dir_index_t));
+  dir_index->arena = arena;
+  dir_index->entries = dir_index->inline_entries;
+  dir_index->count = 0;
+  dir_index->capacity = DIR_INDEX_INLINE_ENTRIES;
+  dir_index_table_init(dir_index, &dir_index->table, 0);
+  dir_index_table_init(dir_index, &dir_index->old_table, 0);
+  dir_index->migrate_cursor = 0;
+  return dir_index;
+}
+
+void dir_index_free(dir_index_t *dir_index) {
+  if (!dir_index) return;
+  if (dir_index->entries != dir_index->inline_entries) {
+    arena_release(dir_index->arena, dir_index->entries, dir_index->capacity * sizeof(dir_entry_t));
+  }
+  dir_index_table_free(dir_index, &dir_index->table);
+  dir_index_table_free(dir_index, &dir_index->old_table);
+  arena_release(dir_index->arena, dir_index, sizeof(dir_index_t));
+}
+
+struct file *dir_index_find(dir_index_t *dir_index, const char *name, size_t length, uint32_t hash) {
+  if (!dir_index->table.slots) {
+    for (uint32_t i = 0; i < dir_index->count; i++) {
+      if (dir_entry_matches(&dir_index->entries[i], name, length, hash)) {
+        return dir_index->entries[i].file;
+      }
+    }
+    return NULL;
+  }
+  dir_index_slot_t *slot = dir_index_table_find(dir_index, &dir_index->table, name, length, hash);
+  if (!slot) {
+    slot = dir_index_table_find(dir_index, &dir_index->old_table, name, length, hash);
+  }
+  return slot ? dir_index->entries[slot->position].file : NULL;
+}
+
+void dir_index_insert(dir_index_t *dir_index, struct file *file) {
+  dir_index_reserve(dir_index);
+  uint32_t position = dir_index->count++;
+  dir_entry_t *entry = &dir_index->entries[position];
+  entry->file = file;
+  entry->id = file->fd->id;
+  entry->hash = file->name_hash;
+  entry->name_length = (uint32_t) strlen(file->name);
+  entry->type = (uint8_t) file->fd->type;
+  if (!dir_index->table.slots) {
+    if (dir_index->count <= DIR_INDEX_INLINE_ENTRIES) {
+      return;
+    }
+    dir_index_table_init(dir_index, &dir_index->table, DIR_INDEX_DEFAULT_CAPACITY);
+    for (uint32_t i = 0; i < dir_index->count; i++) {
+      dir_index_table_insert(&dir_index->table, dir_index->entries[i].hash, i);
+    }
+    return;
+  }
+  if ((dir_index->table.used + 1) * 4 > dir_index->table.capacity * 3) {
+    dir_index_grow(dir_index);
+  }
+  if (dir_index->old_table.slots) {
+    dir_index_migrate(dir_index, DIR_INDEX_MIGRATE_STEP);
+  }
+  dir_index_table_insert(&dir_index->table, entry->hash, position);
+}
+
+void dir_index_remove(dir_index_t *dir_index, struct file *file) {
+  uint32_t position = 0;
+  if (dir_index->table.slots) {
+    dir_index_slot_t *slot = dir_index_table_find_file(dir_index, &dir_index->table, file);
+    if (!slot) {
+      slot = dir_index_table_find_file(dir_index, &dir_index->old_table, file);
+    }
+    if (!slot) return;
+    position = slot->position;
+    slot->position = DIR_INDEX_TOMBSTONE;
+  } else {
+    while (position < dir_index->count && dir_index->entries[position].file != file) {
+      position++;
+    }
+    if (position == dir_index->count) return;
+  }
+  uint32_t last = --dir_index->count;
+  if (position == last) {
+    return;
+  }
+  // the last entry fills the hole, its slot follows it
+  dir_index->entries[position] = dir_index->entries[last];
+  if (dir_index->table.slots) {
+    dir_index_slot(dir_index, position, last)->position = position;
+  }
+}
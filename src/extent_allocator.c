@@ -0,0 +1,181 @@
+#include "extent_allocator.h"
+
+#define EXTENT_SIZE_KEY(length, start) ((((uint64_t) (length)) << 32) | (uint64_t) (start))
+
+static void extent_insert(extent_allocator_t *allocator, uint32_t start, uint32_t length) {
+  tree_node_t tree_node = {.name = NULL, .value = start, .index = start, .num_reserved_bits = length};
+  tree_insert_node(&allocator->by_offset, &tree_node);
+  tree_node.value = EXTENT_SIZE_KEY(length, start);
+  tree_insert_node(&allocator->by_size, &tree_node);
+  allocator->num_extents++;
+}
+
+static void extent_remove(extent_allocator_t *allocator, uint32_t start, uint32_t length) {
+  tree_delete_node(&allocator->by_offset, start);
+  tree_delete_node(&allocator->by_size, EXTENT_SIZE_KEY(length, start));
+  allocator->num_extents--;
+}
+
+// next free extent at or after block, wrapping around to the first one
+static tree_node_t *extent_next(extent_allocator_t *allocator, uint32_t block) {
+  tree_node_t *tree_node = tree_find_ceil_node(allocator->by_offset.ptr, block);
+  if (!tree_node) {
+    tree_node = tree_find_ceil_node(allocator->by_offset.ptr, 0);
+  }
+  return tree_node;
+}
+
+static tree_node_t *extent_find_next_fit(extent_allocator_t *allocator, uint32_t num_blocks) {
+  tree_node_t *first = extent_next(allocator, allocator->cursor);
+  tree_node_t *tree_node = first;
+  while (tree_node) {
+    if (tree_node->num_reserved_bits >= num_blocks) {
+      return tree_node;
+    }
+    tree_node = extent_next(allocator, tree_node->index + tree_node->num_reserved_bits);
+    if (tree_node == first) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+static tree_node_t *extent_find_best_fit(extent_allocator_t *allocator, uint32_t num_blocks) {
+  tree_node_t *by_size = tree_find_ceil_node(allocator->by_size.ptr, EXTENT_SIZE_KEY(num_blocks, 0));
+  if (!by_size) {
+    return NULL;
+  }
+  return tree_find_node(allocator->by_offset.ptr, by_size->index);
+}
+
+extent_allocator_t *extent_allocator_new(bitmap_t *bitmap, alloc_policy_t policy) {
+  extent_allocator_t *allocator = malloc(sizeof(extent_allocator_t));
+  allocator->bitmap = bitmap;
+  slab_pool_init(&allocator->nodes, sizeof(tree_node_t), false);
+  tree_init(&allocator->by_offset, &allocator->nodes);
+  tree_init(&allocator->by_size, &allocator->nodes);
+  allocator->policy = policy;
+  allocator->cursor = 0;
+  allocator->num_extents = 0;
+  allocator->num_free_blocks = 0;
+
+  uint32_t length;
+  int64_t start = bitmap_next_free_run(bitmap, 0, &length);
+  while (start >= 0) {
+    extent_insert(allocator, (uint32_t) start, length);
+    allocator->num_free_blocks += length;
+    start = bitmap_next_free_run(bitmap, (uint32_t) start + length, &length);
+  }
+  return allocator;
+}
+
+void extent_allocator_free(extent_allocator_t *allocator) {
+  if (!allocator) return;
+  // both trees go with the slabs
+  slab_pool_destroy(&allocator->nodes);
+  free(allocator);
+}
+
+int64_t extent_allocator_alloc(extent_allocator_t *allocator, uint32_t num_blocks) {
+  if (!num_blocks || num_blocks > allocator->num_free_blocks) {
+    return -1;
+  }
+  tree_node_t *tree_node = allocator->policy == ALLOC_NEXT_FIT
+                           ? extent_find_next_fit(allocator, num_blocks)
+                           : extent_find_best_fit(allocator, num_blocks);
+  if (!tree_node) {
+    return -1;
+  }
+  uint32_t start = tree_node->index;
+  uint32_t length = tree_node->num_reserved_bits;
+  extent_remove(allocator, start, length);
+  if (length > num_blocks) {
+    extent_insert(allocator, start + num_blocks, length - num_blocks);
+  }
+  bitmap_set_bits(allocator->bitmap, 0, num_blocks, start);
+  allocator->num_free_blocks -= num_blocks;
+  allocator->cursor = start + num_blocks;
+  return start;
+}
+
+uint32_t extent_allocator_extend(extent_allocator_t *allocator, uint32_t index, uint32_t num_blocks) {
+  // free extents are maximal, so a free block right after a used one starts an extent
+  tree_node_t *tree_node = tree_find_node(allocator->by_offset.ptr, index);
+  if (!tree_node || !num_blocks) {
+    return 0;
+  }
+  uint32_t length = tree_node->num_reserved_bits;
+  uint32_t claimed = length < num_blocks ? length : num_blocks;
+  extent_remove(allocator, index, length);
+  if (length > claimed) {
+    extent_insert(allocator, index + claimed, length - claimed);
+  }
+  bitmap_set_bits(allocator->bitmap, 0, claimed, index);
+  allocator->num_free_blocks -= claimed;
+  return claimed;
+}
+
+bool extent_allocator_claim(extent_allocator_t *allocator, uint32_t index, uint32_t num_blocks) {
+  tree_node_t *tree_node = tree_find_floor_node(allocator->by_offset.ptr, index);
+  if (!num_blocks || !tree_node ||
+      (uint64_t) index + num_blocks > (uint64_t) tree_node->index + tree_node->num_reserved_bits) {
+    return false;
+  }
+  uint32_t start = tree_node->index;
+  uint32_t length = tree_node->num_reserved_bits;
+  extent_remove(allocator, start, length);
+  if (index > start) {
+    extent_insert(allocator, start, index - start);
+  }
+  if (start + length > index + num_blocks) {
+    extent_insert(allocator, index + num_blocks, start + length - index - num_blocks);
+  }
+  bitmap_set_bits(allocator->bitmap, 0, num_blocks, index);
+  allocator->num_free_blocks -= num_blocks;
+  return true;
+}
+
+void extent_allocator_release(extent_allocator_t *allocator, uint32_t index, uint32_t num_blocks) {
+  if (!num_blocks) return;
+  bitmap_set_bits(allocator->bitmap, 1, num_blocks, index);
+  allocator->num_free_blocks += num_blocks;
+
+  uint32_t start = index;
+  uint32_t length = num_blocks;
+  tree_node_t *left = index ? tree_find_floor_node(allocator->by_offset.ptr, index - 1) : NULL;
+  if (left && left->index + left->num_reserved_bits == index) {
+    start = left->index;
+    length += left->num_reserved_bits;
+    extent_remove(allocator, left->index, left->num_reserved_bits);
+  }
+  tree_node_t *right = tree_find_node(allocator->by_offset.ptr, index + num_blocks);
+  if (right) {
+    length += right->num_reserved_bits;
+    extent_remove(allocator, right->index, right->num_reserved_bits);
+  }
+  extent_insert(allocator, start, length);
+}
+
+int64_t extent_allocator_next_free(extent_allocator_t *allocator, uint32_t index, uint32_t *length) {
+  tree_node_t *tree_node = tree_find_ceil_node(allocator->by_offset.ptr, index);
+  if (!tree_node) {
+    return -1;
+  }
+  *length = tree_node->num_reserved_bits;
+  return tree_node->index;
+}
+
+int64_t extent_allocator_alloc_low(extent_allocator_t *allocator, uint32_t num_blocks, uint32_t limit) {
+  if (!num_blocks || num_blocks > allocator->num_free_blocks) {
+    return -1;
+  }
+  for (tree_node_t *tree_node = tree_find_ceil_node(allocator->by_offset.ptr, 0); tree_node && tree_node->index < limit;
+       tree_node = tree_find_ceil_node(allocator->by_offset.ptr, (uint64_t) tree_node->index + tree_node->num_reserved_bits)) {
+    if (tree_node->num_reserved_bits >= num_blocks) {
+      uint32_t start = tree_node->index;
+      extent_allocator_claim(allocator, start, num_blocks);
+      return start;
+    }
+  }
+  return -1;
+}
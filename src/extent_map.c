@@ -0,0 +1,140 @@
+#include "extent_map.h"
+
+inline static uint64_t extent_map_end(const tree_node_t *tree_node) {
+  return tree_node->value + tree_node->num_reserved_bits;
+}
+
+// copies the first extent out of the tree after every change to it
+static void extent_map_update_first(extent_map_t *map) {
+  tree_node_t *tree_node = tree_find_ceil_node(map->tree.ptr, 0);
+  map->first_block = tree_node ? (uint32_t) tree_node->value : 0;
+  map->first_physical = tree_node ? tree_node->index : 0;
+  map->first_length = tree_node ? tree_node->num_reserved_bits : 0;
+}
+
+// adds an extent, merging it with logical and physical neighbours
+static void extent_map_insert(extent_map_t *map, uint32_t block, uint32_t physical, uint32_t length) {
+  tree_node_t *next = tree_find_node(map->tree.ptr, (uint64_t) block + length);
+  if (next && next->index != physical + length) {
+    next = NULL;
+  }
+  tree_node_t *previous = block ? tree_find_floor_node(map->tree.ptr, block - 1) : NULL;
+  if (previous && extent_map_end(previous) == block &&
+      previous->index + previous->num_reserved_bits == physical) {
+    previous->num_reserved_bits += length;
+    if (next) {
+      previous->num_reserved_bits += next->num_reserved_bits;
+      tree_delete_node(&map->tree, next->value);
+    }
+    return;
+  }
+  if (next) {
+    length += next->num_reserved_bits;
+    tree_delete_node(&map->tree, next->value);
+  }
+  tree_node_t tree_node = {.name = NULL, .value = block, .index = physical, .num_reserved_bits = length};
+  tree_insert_node(&map->tree, &tree_node);
+}
+
+void extent_map_init(extent_map_t *map, slab_pool_t *pool) {
+  tree_init(&map->tree, pool);
+  map->first_block = 0;
+  map->first_physical = 0;
+  map->first_length = 0;
+}
+
+void extent_map_destroy(extent_map_t *map) {
+  tree_delete_all(&map->tree);
+  map->first_length = 0;
+}
+
+bool extent_map_lookup(extent_map_t *map, uint32_t block, uint32_t *physical, uint32_t *run) {
+  if (block >= map->first_block && block - map->first_block < map->first_length) {
+    *physical = map->first_physical + (block - map->first_block);
+    *run = map->first_length - (block - map->first_block);
+    return true;
+  }
+  tree_node_t *tree_node = tree_find_floor_node(map->tree.ptr, block);
+  if (tree_node && block < extent_map_end(tree_node)) {
+    *physical = tree_node->index + (block - (uint32_t) tree_node->value);
+    *run = (uint32_t) (extent_map_end(tree_node) - block);
+    return true;
+  }
+  tree_node = tree_find_ceil_node(map->tree.ptr, block);
+  *run = tree_node ? (uint32_t) (tree_node->value - block) : UINT32_MAX;
+  return false;
+}
+
+void extent_map_add(extent_map_t *map, uint32_t block, uint32_t physical, uint32_t num_blocks) {
+  extent_map_insert(map, block, physical, num_blocks);
+  extent_map_update_first(map);
+}
+
+bool extent_map_allocate(extent_map_t *map, block_allocator_t *blocks, uint32_t group, uint32_t block, uint32_t num_blocks) {
+  while (num_blocks) {
+    uint32_t physical = 0;
+    uint32_t length = 0;
+    tree_node_t *previous = block ? tree_find_floor_node(map->tree.ptr, block - 1) : NULL;
+    if (previous && extent_map_end(previous) == block) {
+      physical = previous->index + previous->num_reserved_bits;
+      length = block_allocator_extend(blocks, physical, num_blocks);
+    }
+    if (!length) {
+      // fragmented space still serves the request, in smaller runs
+      int64_t start = -1;
+      // no single group holds more than group_blocks in a row
+      length = num_blocks < blocks->group_blocks ? num_blocks : blocks->group_blocks;
+      while (length && (start = block_allocator_alloc(blocks, group, length)) == -1) {
+        length /= 2;
+      }
+      if (start == -1) {
+        extent_map_update_first(map);
+        return false;
+      }
+      physical = (uint32_t) start;
+    }
+    extent_map_insert(map, block, physical, length);
+    block += length;
+    num_blocks -= length;
+  }
+  extent_map_update_first(map);
+  return true;
+}
+
+bool extent_map_remap(extent_map_t *map, uint32_t block, uint32_t physical, uint32_t num_blocks, uint32_t *old_physical) {
+  tree_node_t *tree_node = tree_find_floor_node(map->tree.ptr, block);
+  if (!num_blocks || !tree_node || (uint64_t) block + num_blocks > extent_map_end(tree_node)) {
+    return false;
+  }
+  // what the range leaves of its extent stays mapped on both sides of it
+  uint32_t head = block - (uint32_t) tree_node->value;
+  uint32_t tail = (uint32_t) (extent_map_end(tree_node) - block - num_blocks);
+  uint32_t start = tree_node->index;
+  *old_physical = start + head;
+  if (head) {
+    tree_node->num_reserved_bits = head;
+  } else {
+    tree_delete_node(&map->tree, block);
+  }
+  if (tail) {
+    tree_node_t rest = {.name = NULL, .value = block + num_blocks, .index = start + head + num_blocks, .num_reserved_bits = tail};
+    tree_insert_node(&map->tree, &rest);
+  }
+  extent_map_insert(map, block, physical, num_blocks);
+  extent_map_update_first(map);
+  return true;
+}
+
+void extent_map_truncate(extent_map_t *map, block_allocator_t *blocks, uint32_t block) {
+  tree_node_t *tree_node = block ? tree_find_floor_node(map->tree.ptr, block - 1) : NULL;
+  if (tree_node && extent_map_end(tree_node) > block) {
+    uint32_t keep = block - (uint32_t) tree_node->value;
+    block_allocator_release(blocks, tree_node->index + keep, tree_node->num_reserved_bits - keep);
+    tree_node->num_reserved_bits = keep;
+  }
+  while ((tree_node = tree_find_ceil_node(map->tree.ptr, block))) {
+    block_allocator_release(blocks, tree_node->index, tree_node->num_reserved_bits);
+    tree_delete_node(&map->tree, tree_node->value);
+  }
+  extent_map_update_first(map);
+}
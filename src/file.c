@@ -2,27 +2,36 @@
 #include "linked_list.h"
 #include "string.h"
 
-void file_free(file_t *file) {
+void file_free(arena_t *arena, file_t *file) {
   if (!file) return;
-  if (file->fd) {
-    linked_list_free(file->fd->links);
-    free(file->fd);
-  }
-  free(file);
+  fs_descriptor_free(arena, file->fd);
+  arena_release(arena, file->name, strlen(file->name) + 1);
+  slab_pool_release(&arena->files, file);
 }
 
-file_t *file_new(char *name, bool link) {
-  file_t *file = (file_t *) malloc(sizeof(file_t));
-  file->name = name;
-  file->is_link = link;
-  file->open_ids = array_list_new();
+file_t *file_new(arena_t *arena, const char *name, size_t length) {
+  file_t *file = (file_t *) slab_pool_alloc(&arena->files);
+  file->name = arena_alloc(arena, length + 1);
+  memcpy(file->name, name, length);
+  file->name[length] = '\0';
+  file->name_hash = dir_index_hash(name, length);
   file->fd = NULL;
   file->parent_dir = NULL;
-  file->content = 0;
-  file->is_opened = false;
+  file->open_count = 0;
+  file->cwd_count = 0;
   return file;
 }
 
+// directory children are entries of the directory's index, which serves listing and lookup
+void file_dir_add(file_t *dir, file_t *file) {
+  file->parent_dir = dir;
+  dir_index_insert(dir->fd->index, file);
+}
+
+void file_dir_remove(file_t *dir, file_t *file) {
+  dir_index_remove(dir->fd->index, file);
+}
+
 file_t *linked_list_file_find_by_name(linked_list_t *linked_list, char *name) {
   node_t *current = linked_list->head;
   while (current) {
@@ -2,71 +2,97 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define FILE_PATH_DELIM_SLASH  "/"
+#define FILE_PATH_DELIM_SLASH '/'
 
 #define FILE_PATH_CURRENT "."
 #define FILE_PATH_PARENT  ".."
 #define FILE_PATH_ROOT    "root"
 
-static path_type_t path_type_parse(const char *token) {
-  if (strcmp(token, FILE_PATH_CURRENT) == 0) {
+inline static bool path_token_equals(const char *token, uint32_t length, const char *value) {
+  return strlen(value) == length && memcmp(token, value, length) == 0;
+}
+
+static path_type_t path_type_parse(const char *token, uint32_t length) {
+  if (path_token_equals(token, length, FILE_PATH_CURRENT)) {
     return PATH_RELATIVE;
   }
-  if (strcmp(token, FILE_PATH_PARENT) == 0) {
+  if (path_token_equals(token, length, FILE_PATH_PARENT)) {
     return PATH_PARENT;
   }
   return PATH_FILE;
 }
 
-static path_token_t *path_token_new(char *token) {
-  path_token_t *path_token = malloc(sizeof(path_token_t));
-  path_token->type = path_type_parse(token);
+static bool path_parse_push(path_parse_t *path_parse, const char *token, uint32_t length) {
+  if (path_parse->num_tokens == path_parse->capacity) {
+    uint32_t capacity = path_parse->capacity * 2;
+    path_token_t *tokens;
+    if (path_parse->tokens == path_parse->inline_tokens) {
+      tokens = malloc(capacity * sizeof(path_token_t));
+      if (tokens) {
+        memcpy(tokens, path_parse->inline_tokens, sizeof(path_parse->inline_tokens));
+      }
+    } else {
+      tokens = realloc(path_parse->tokens, capacity * sizeof(path_token_t));
+    }
+    if (!tokens) {
+      return false;
+    }
+    path_parse->tokens = tokens;
+    path_parse->capacity = capacity;
+  }
+  path_token_t *path_token = &path_parse->tokens[path_parse->num_tokens++];
+  path_token->type = path_type_parse(token, length);
   path_token->value = token;
-  path_token->is_last = false;
-  return path_token;
+  path_token->length = length;
+  return true;
 }
 
-static path_parse_t *path_parse_new() {
-  path_parse_t *path_parse = malloc(sizeof(path_parse_t));
-  path_parse->token_types = linked_list_new();
+// Splits path on '/' without copying it. A path starts either with "root"
+// (absolute) or with "." / ".." (relative to the working directory).
+bool file_path_parse(const char *path, path_parse_t *path_parse) {
+  path_parse->tokens = path_parse->inline_tokens;
+  path_parse->num_tokens = 0;
+  path_parse->capacity = FILE_PATH_INLINE_TOKENS;
   path_parse->is_absolute = false;
-  path_parse->name = NULL;
-  return path_parse;
-}
-
-
-path_parse_t *file_path_parse(char *path) {
   if (!path) {
-    return NULL;
-  }
-  size_t path_len = strlen(path);
-  char *buffer = malloc(sizeof(char) * path_len);
-  strcpy(buffer, path);
-  char *token = strtok(buffer, FILE_PATH_DELIM_SLASH); // NOLINT
-  if (token == NULL) {
-    return NULL;
+    return false;
   }
 
-  path_parse_t *path_parse = path_parse_new();
-  if (strcmp(token, FILE_PATH_ROOT) == 0) {
-    path_parse->is_absolute = true;
-  } else {
-    path_token_t *path_token = path_token_new(token);
-    if (path_token->type == PATH_FILE) {
-      return NULL;
+  bool is_first = true;
+  const char *current = path;
+  while (*current) {
+    if (*current == FILE_PATH_DELIM_SLASH) {
+      current++;
+      continue;
+    }
+    const char *token = current;
+    while (*current && *current != FILE_PATH_DELIM_SLASH) {
+      current++;
+    }
+    uint32_t length = (uint32_t) (current - token);
+    if (is_first) {
+      is_first = false;
+      if (path_token_equals(token, length, FILE_PATH_ROOT)) {
+        path_parse->is_absolute = true;
+        continue;
+      }
+      if (path_type_parse(token, length) == PATH_FILE) {
+        return false;
+      }
+    }
+    if (!path_parse_push(path_parse, token, length)) {
+      file_path_parse_free(path_parse);
+      return false;
     }
-    linked_list_push(path_parse->token_types, (void *) path_token);
   }
+  return !is_first;
+}
 
-  while (token) {
-    token = strtok(NULL, FILE_PATH_DELIM_SLASH); // NOLINT
-    if (token == NULL) {
-      path_token_t *path_token = (path_token_t *) path_parse->token_types->tail->value;
-      path_token->is_last = true;
-      break;
-    }
-    path_parse->name = token;
-    linked_list_push(path_parse->token_types, (void *) path_token_new(token));
+void file_path_parse_free(path_parse_t *path_parse) {
+  if (path_parse->tokens != path_parse->inline_tokens) {
+    free(path_parse->tokens);
   }
-  return path_parse;
+  path_parse->tokens = path_parse->inline_tokens;
+  path_parse->num_tokens = 0;
+  path_parse->capacity = FILE_PATH_INLINE_TOKENS;
 }
@@ -1,465 +1,1997 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
 #include "internal/bit_utils.h"
-#include "internal/bitmap.h"
 #include "internal/filesystem_macros.h"
 #include "internal/filesystem.h"
 #include "internal/file_path.h"
 
+#include <assert.h>
 #include <memory.h>
 #include <string.h>
 #include <stdio.h>
-
-filesystem_t *filesystem;
-file_t *cwd;
+#include <time.h>
 
 #define FS_SUCCESS 0
 #define FS_FAILURE 1
 
-#define FS_STORAGE_SIZE_IN_BYTES 1000
+#define FS_PRINT(ctx, ...)  \
+  do {                      \
+    if (!(ctx)->quiet) {    \
+      printf(__VA_ARGS__);  \
+    }                       \
+  } while (0)
+
+#define FS_READ_LOCK(ctx)  pthread_rwlock_rdlock(&(ctx)->fs->lock)
+#define FS_WRITE_LOCK(ctx) pthread_rwlock_wrlock(&(ctx)->fs->lock)
+#define FS_UNLOCK(ctx)     pthread_rwlock_unlock(&(ctx)->fs->lock)
+
+static uint64_t fs_clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// queues an inode for the next checkpoint, data calls may race here under the shared lock
+static void fs_inode_dirty_id(filesystem_t *fs, size_t id) {
+  pthread_mutex_lock(&fs->dirty_lock);
+  array_list_push(fs->dirty, id);
+  pthread_mutex_unlock(&fs->dirty_lock);
+}
 
-static void fs_new(int num_fd) {
-  // format disk
-  if (filesystem) {
-    free(filesystem->bitmap->map);
-    free(filesystem->bitmap);
-    filesystem->bitmap = NULL;
-    tree_delete_all(&filesystem->bst->ptr);
-    filesystem->bst->ptr = NULL;
-    free(filesystem->bst);
-    filesystem->bst = NULL;
-    linked_list_free(filesystem->files);
-    filesystem->files = NULL;
-    free(filesystem);
-    filesystem = NULL;
+static void fs_inode_dirty(filesystem_t *fs, file_t *file) {
+  if (!__atomic_exchange_n(&file->fd->dirty, true, __ATOMIC_ACQ_REL)) {
+    fs_inode_dirty_id(fs, file->fd->id);
+  }
+}
+
+// grows the table of loaded inodes to hold ids below count, never past num_inodes;
+// the table moves, so this runs at mount or with the filesystem lock held exclusively
+static void fs_inode_reserve(filesystem_t *fs, uint64_t count) {
+  if (count <= fs->inodes_capacity) {
+    return;
+  }
+  uint64_t capacity = fs->inodes_capacity ? fs->inodes_capacity : FS_MIN_INODES_CAPACITY;
+  while (capacity < count) {
+    capacity *= 2;
+  }
+  if (capacity > fs->num_inodes) {
+    capacity = fs->num_inodes;
   }
-  filesystem = malloc(sizeof(filesystem_t));
-  filesystem->max_num_fd = num_fd;
-  filesystem->format = true;
-  filesystem->mount = false;
+  fs->inodes = realloc(fs->inodes, capacity * sizeof(file_t *));
+  memset(fs->inodes + fs->inodes_capacity, 0, (capacity - fs->inodes_capacity) * sizeof(file_t *));
+  fs->inodes_capacity = capacity;
 }
 
-static bool fs_enable_exec_command() {
-  return filesystem && filesystem->format && filesystem->mount;
+inline static void fs_inode_set(filesystem_t *fs, size_t id, file_t *file) {
+  __atomic_store_n(&fs->inodes[id], file, __ATOMIC_RELEASE);
 }
 
-#define FS_ENABLE_EXECUTION()             \
-  if (!fs_enable_exec_command()) {        \
-    printf("Not mounted or formatted\n"); \
-    return FS_FAILURE;                    \
+// the stored slot of id, the tree's current one or the mounted snapshot's
+static const image_inode_t *fs_inode_slot(filesystem_t *fs, uint64_t id) {
+  return fs->view ? snapshot_view_slot(fs->view, id) : inode_table_current(fs->image, id);
+}
+
+// builds a file from its stored slot, a file's extents are read along, a directory's entries on first use
+static file_t *fs_inode_load(filesystem_t *fs, uint64_t id, const char *name, size_t length) {
+  const image_inode_t *slot = fs_inode_slot(fs, id);
+  if (!(slot->flags & IMAGE_INODE_USED) || slot->type > FS_SYMLINK || slot->size > INT32_MAX) {
+    return NULL;
+  }
+  file_t *file = file_new(fs->arena, name, length);
+  file->fd = fs_descriptor_new(fs->arena, id, (fs_type_t) slot->type, (int32_t) slot->size);
+  file->fd->num_links = slot->num_links;
+  if (slot->type == FS_FILE) {
+    inode_blob_reader_t reader;
+    inode_blob_reader_init(&reader, fs->image, slot->blob);
+    for (uint32_t i = 0; i < slot->num_entries; i++) {
+      image_extent_t extent;
+      if (i < IMAGE_INODE_EXTENTS) {
+        extent = slot->extents[i];
+      } else if (!inode_blob_read(&reader, &extent, sizeof(extent))) {
+        break;
+      }
+      extent_map_add(&file->fd->extents, extent.logical, extent.physical, extent.length);
+    }
   }
+  return file;
+}
 
-static bool file_move_to_dir(void *data, void *token) {
-  path_token_t *path_token = (path_token_t *) token;
-  file_t *file = (file_t *) ((node_t *) data)->value;
-  if (file->fd->type != FS_DIRECTORY) {
-    return false;
+static file_t *fs_inode_get(filesystem_t *fs, uint64_t id);
+
+// a symlink and its directory list each other in their links
+static void fs_file_pair(filesystem_t *fs, file_t *file, file_t *target) {
+  linked_list_push(fs_descriptor_links(fs->arena, target->fd), file);
+  linked_list_push(fs_descriptor_links(fs->arena, file->fd), target);
+}
+
+// another name of a hard linked file, sharing its descriptor
+static file_t *fs_file_name(filesystem_t *fs, file_t *inode, const char *name, size_t length) {
+  file_t *file = file_new(fs->arena, name, length);
+  file->fd = inode->fd;
+  return file;
+}
+
+// the file an entry of dir names: a name of a hard linked file shares the descriptor of the file,
+// which loads along, any other file is loaded unless it is already; NULL for an entry to skip
+static file_t *fs_entry_load(filesystem_t *fs, file_t *dir, uint64_t id, const char *name, size_t length) {
+  if (id >= fs->inodes_capacity) {
+    return NULL;
   }
-  if (strcmp(path_token->value, file->name) == 0) {
-    cwd = file;
-    return true;
+  file_t *inode = __atomic_load_n(&fs->inodes[id], __ATOMIC_ACQUIRE);
+  if (dir != fs->inodes_dir) {
+    if (!inode && fs_inode_slot(fs, id)->parent == FS_INODES_ID) {
+      inode = fs_inode_get(fs, id);
+    }
+    if (inode) {
+      return inode->parent_dir == fs->inodes_dir ? fs_file_name(fs, inode, name, length) : NULL;
+    }
+  } else if (inode) {
+    return NULL;
   }
-  return false;
+  file_t *file = fs_inode_load(fs, id, name, length);
+  if (file) {
+    fs_inode_set(fs, id, file);
+  }
+  return file;
 }
 
-static bool path_token_cd(void *data) {
-  path_token_t *path_token = (path_token_t *) ((node_t *) data)->value;
-  if (PATH_FILE == path_token->type) {
-    bool is_changed_dir = linked_list_foreach_arg(cwd->fd->links, file_move_to_dir, path_token);
-    if (!is_changed_dir && !path_token->is_last) {
-      return false;
+// reads the entries of a directory the first time it is needed; symlinks of the links directory
+// are paired with their directories, which loads those
+static void fs_dir_load(filesystem_t *fs, file_t *dir) {
+  if (__atomic_load_n(&dir->fd->loaded, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  pthread_mutex_lock(&fs->load_lock);
+  if (dir->fd->loaded) {
+    pthread_mutex_unlock(&fs->load_lock);
+    return;
+  }
+  const image_inode_t *slot = fs_inode_slot(fs, dir->fd->id);
+  inode_blob_reader_t reader;
+  inode_blob_reader_init(&reader, fs->image, slot->blob);
+  uint32_t num_entries = slot->flags & IMAGE_INODE_USED ? slot->num_entries : 0;
+  char *name = NULL;
+  size_t capacity = 0;
+  for (uint32_t i = 0; i < num_entries; i++) {
+    image_dirent_t entry;
+    if (!inode_blob_read(&reader, &entry, sizeof(entry)) || entry.name_length > UINT16_MAX) {
+      break;
+    }
+    if (entry.name_length > capacity) {
+      capacity = entry.name_length;
+      name = realloc(name, capacity);
+    }
+    if (!inode_blob_read(&reader, name, entry.name_length)) {
+      break;
+    }
+    file_t *file = fs_entry_load(fs, dir, entry.id, name, entry.name_length);
+    if (!file) {
+      continue;
+    }
+    file_dir_add(dir, file);
+    if (dir != fs->links_dir || file->fd->type != FS_SYMLINK) {
+      continue;
+    }
+    uint64_t target_id = fs_inode_slot(fs, entry.id)->target;
+    file_t *target = target_id != IMAGE_NO_INODE ? fs_inode_get(fs, target_id) : NULL;
+    if (target && target->fd->type == FS_DIRECTORY) {
+      fs_file_pair(fs, file, target);
     }
-    return true;
   }
-  if (PATH_PARENT == path_token->type) {
-    if (!cwd->parent_dir) {
-      return false;
+  free(name);
+  __atomic_store_n(&dir->fd->loaded, true, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&fs->load_lock);
+}
+
+// the file with inode number id, loading the directories on the way to it; NULL if there is none
+static file_t *fs_inode_get(filesystem_t *fs, uint64_t id) {
+  if (id >= fs->inodes_capacity) {
+    return NULL;
+  }
+  file_t *file = __atomic_load_n(&fs->inodes[id], __ATOMIC_ACQUIRE);
+  if (file) {
+    return file;
+  }
+  const image_inode_t *slot = fs_inode_slot(fs, id);
+  if (!(slot->flags & IMAGE_INODE_USED) || slot->parent == id) {
+    return NULL;
+  }
+  file_t *dir = fs_inode_get(fs, slot->parent);
+  if (!dir || dir->fd->type != FS_DIRECTORY) {
+    return NULL;
+  }
+  fs_dir_load(fs, dir);
+  return __atomic_load_n(&fs->inodes[id], __ATOMIC_ACQUIRE);
+}
+
+// the stored slot of an inode which is in use but not loaded yet, NULL for one loaded or free
+static const image_inode_t *fs_inode_stored(filesystem_t *fs, uint64_t id) {
+  if (id >= fs->inodes_capacity || __atomic_load_n(&fs->inodes[id], __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  const image_inode_t *slot = fs_inode_slot(fs, id);
+  if (!(slot->flags & IMAGE_INODE_USED) || slot->parent == id || slot->parent >= fs->inodes_capacity) {
+    return NULL;
+  }
+  // a file in a loaded directory is loaded as well, unless it was removed since
+  file_t *dir = __atomic_load_n(&fs->inodes[slot->parent], __ATOMIC_ACQUIRE);
+  if (dir) {
+    return __atomic_load_n(&dir->fd->loaded, __ATOMIC_ACQUIRE) ? NULL : slot;
+  }
+  return fs_inode_stored(fs, slot->parent) ? slot : NULL;
+}
+
+// writes a file to a slot, extents or entries which do not fit it go to a new blob listed in blobs
+static bool fs_inode_store(filesystem_t *fs, file_t *file, image_inode_t *slot, array_list_t *blobs) {
+  fs_descriptor_t *fd = file->fd;
+  inode_blob_writer_t writer;
+  inode_blob_writer_init(&writer, fs->image, fs->blocks, (uint32_t) fd->id);
+  memset(slot, 0, sizeof(image_inode_t));
+  slot->parent = file->parent_dir ? file->parent_dir->fd->id : IMAGE_NO_INODE;
+  slot->target = IMAGE_NO_INODE;
+  slot->size = (uint64_t) fd->file_size;
+  slot->type = (uint16_t) fd->type;
+  slot->flags = IMAGE_INODE_USED;
+  slot->num_links = fd->num_links;
+  bool written = true;
+  if (fd->type == FS_DIRECTORY) {
+    fs_dir_load(fs, file);
+    dir_index_t *index = fd->index;
+    for (uint32_t i = 0; i < index->count && written; i++) {
+      dir_entry_t *child = &index->entries[i];
+      image_dirent_t entry = {.id = child->id, .name_length = child->name_length};
+      written = inode_blob_write(&writer, &entry, sizeof(entry)) &&
+                inode_blob_write(&writer, child->file->name, entry.name_length);
+      slot->num_entries++;
     }
-    cwd = cwd->parent_dir;
-    return true;
+  } else if (file->parent_dir == fs->links_dir && fd->links && fd->links->head) {
+    // a symlink's only link is its directory
+    slot->target = ((file_t *) fd->links->head->value)->fd->id;
   }
-  return true;
+  if (fd->type == FS_FILE) {
+    tree_t *extents = &fd->extents.tree;
+    for (tree_node_t *tree_node = tree_find_ceil_node(extents->ptr, 0); tree_node && written;
+         tree_node = tree_find_ceil_node(extents->ptr, tree_node->value + tree_node->num_reserved_bits)) {
+      image_extent_t extent = {(uint32_t) tree_node->value, (uint32_t) tree_node->index, tree_node->num_reserved_bits};
+      if (slot->num_entries < IMAGE_INODE_EXTENTS) {
+        slot->extents[slot->num_entries] = extent;
+      } else {
+        written = inode_blob_write(&writer, &extent, sizeof(extent));
+      }
+      slot->num_entries++;
+    }
+  }
+  slot->blob = writer.first;
+  if (writer.first != IMAGE_NO_BLOCK) {
+    array_list_push(blobs, writer.first);
+  }
+  return written;
 }
 
-static bool try_change_dir(file_t *original_cwd, path_parse_t* path_parse) {
-  if (path_parse == NULL) {
-    return false;
+// checkpoint contents: every dirty inode goes to its other slot, the block bitmap and the snapshot table
+// to their other copies, the journal then makes them current; runs with the filesystem lock held exclusively
+static bool fs_checkpoint_write(void *arg, image_header_t *header) {
+  filesystem_t *fs = (filesystem_t *) arg;
+  image_t *image = fs->image;
+  array_list_t *dirty = fs->dirty;
+  array_list_t *old_blobs = array_list_new();
+  array_list_t *new_blobs = array_list_new();
+  inode_table_begin(image);
+  bool written = true;
+  for (uint32_t i = 0; i < dirty->size && written; i++) {
+    uint64_t id = dirty->array[i];
+    file_t *file = fs->inodes[id];
+    image_inode_t *current = inode_table_current(image, id);
+    if (!file && !(current->flags & IMAGE_INODE_USED)) {
+      continue;
+    }
+    image_inode_t *slot = inode_table_next(image, id);
+    if (!slot) {
+      continue;
+    }
+    // the snapshots still need the slot being replaced, and the blobs it names
+    written = snapshot_table_preserve(fs->snapshots, id, current);
+    if (written && current->flags & IMAGE_INODE_USED && current->blob != IMAGE_NO_BLOCK) {
+      array_list_push(old_blobs, current->blob);
+    }
+    if (written && file) {
+      written = fs_inode_store(fs, file, slot, new_blobs);
+    } else if (written) {
+      memset(slot, 0, sizeof(image_inode_t));
+    }
+    slot->generation = header->journal_epoch;
+  }
+  // the blobs being replaced are free in the new bitmap, nothing allocates before it is written
+  array_list_t *released = written ? old_blobs : new_blobs;
+  for (uint32_t i = 0; i < released->size; i++) {
+    inode_blob_release(image, fs->blocks, released->array[i]);
   }
-  bool is_success = linked_list_foreach_is_success(path_parse->token_types, path_token_cd);
-  if (!is_success) {
-    cwd = original_cwd;
+  array_list_free(old_blobs);
+  array_list_free(new_blobs);
+  if (written) {
+    snapshot_table_release(fs->snapshots);
+    snapshot_table_save(fs->snapshots);
+    block_allocator_save(fs->blocks, inode_table_next_bitmap(image));
+    written = image_sync_all(image);
+  }
+  if (!written) {
+    // the dirty inodes stay queued for the next try
     return false;
   }
+  for (uint32_t i = 0; i < dirty->size; i++) {
+    file_t *file = fs->inodes[dirty->array[i]];
+    if (file) {
+      file->fd->dirty = false;
+    }
+  }
+  dirty->size = 0;
+  header->tables_active ^= 1;
+  header->next_id = fs->next_fd_id;
+  header->num_files = fs->num_files;
+  header->num_snapshots = fs->snapshots->count;
   return true;
 }
 
-int fs_create(char *path) {
-  if (!filesystem || filesystem->num_files == filesystem->max_num_fd) {
-    printf("Cannot create file");
+// waits for the records the call logged, outside the filesystem lock so that concurrent calls share a commit;
+// a change which found the log full is made durable by a checkpoint instead
+static void fs_ctx_commit(fs_ctx_t *ctx) {
+  filesystem_t *fs = ctx->fs;
+  if (ctx->commit_lsn) {
+    journal_commit(fs->journal, ctx->commit_lsn, ctx->commit_generation);
+    ctx->commit_lsn = 0;
   }
-  if (!path || !fs_enable_exec_command()) {
-    printf("Cannot create file, not created filesystem or unmounted\n");
-    return FS_FAILURE;
+  if (ctx->checkpoint) {
+    ctx->checkpoint = false;
+    FS_WRITE_LOCK(ctx);
+    if (fs->mount && journal_needs_checkpoint(fs->journal)) {
+      journal_checkpoint(fs->journal, fs_checkpoint_write, fs);
+    }
+    FS_UNLOCK(ctx);
   }
+}
 
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+#ifdef FS_STATS
+// times the running fs_* call, it is recorded when the call leaves
+#define FS_STATS_BEGIN(ctx, op)           \
+  do {                                    \
+    (ctx)->stats_op = (op);               \
+    (ctx)->stats_bytes = 0;               \
+    (ctx)->stats_start = fs_stats_now_ns(); \
+  } while (0)
+#define FS_STATS_BYTES(ctx, n) ((ctx)->stats_bytes = (uint64_t) (n))
+#define FS_STATS_END(ctx, status) \
+  fs_stats_record((ctx)->stats_op, fs_stats_now_ns() - (ctx)->stats_start, (int64_t) (status), (ctx)->stats_bytes)
+#else
+#define FS_STATS_BEGIN(ctx, op) ((void) (op))
+#define FS_STATS_BYTES(ctx, n) ((void) 0)
+#define FS_STATS_END(ctx, status) ((void) 0)
+#endif
+
+// every fs_* call takes the filesystem lock first and leaves through FS_RETURN
+#define FS_RETURN(ctx, status)                \
+  do {                                        \
+    __typeof__(status) fs_status = (status);  \
+    FS_UNLOCK(ctx);                           \
+    fs_ctx_commit(ctx);                       \
+    FS_STATS_END(ctx, fs_status);             \
+    return fs_status;                         \
+  } while (0)
+
+// leaves an fs_* call which fails before it takes the filesystem lock
+#define FS_RETURN_UNLOCKED(ctx, status) \
+  do {                                  \
+    FS_STATS_END(ctx, status);          \
+    return (status);                    \
+  } while (0)
+
+static bool fs_enable_exec_command(filesystem_t *fs) {
+  return fs->format && fs->mount;
+}
+
+#define FS_ENABLE_EXECUTION(ctx)                     \
+  if (!fs_enable_exec_command((ctx)->fs)) {          \
+    FS_PRINT((ctx), "Not mounted or formatted\n");   \
+    FS_RETURN((ctx), FS_FAILURE);                    \
   }
-  file_t *found_file = linked_list_file_find_by_name(cwd->fd->links, path_parse->name);
-  if (found_file) {
-    cwd = original_cwd;
-    printf("File already exists\n");
-    return FS_FAILURE;
+
+// calls which change the tree follow FS_ENABLE_EXECUTION with this, a mounted snapshot is read only
+#define FS_ENABLE_CHANGES(ctx)                       \
+  if ((ctx)->fs->view) {                             \
+    FS_PRINT((ctx), "Read-only snapshot\n");         \
+    FS_RETURN((ctx), FS_FAILURE);                    \
   }
 
-  file_t *file = file_new(path_parse->name, false);
-  file->fd = fs_descriptor_new(FS_FILE, 0);
-  linked_list_push(filesystem->files, (void *) file);
-  linked_list_push(cwd->fd->links, file);
-  filesystem->num_files++;
-  cwd = original_cwd;
-  return FS_SUCCESS;
+fs_ctx_t *fs_ctx_new() {
+  filesystem_t *fs = calloc(1, sizeof(filesystem_t));
+  // checkpoints need the lock exclusively, a steady stream of data calls must not starve them
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&fs->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  // loading a directory of link files loads the directories of their targets
+  pthread_mutexattr_t load_attr;
+  pthread_mutexattr_init(&load_attr);
+  pthread_mutexattr_settype(&load_attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&fs->load_lock, &load_attr);
+  pthread_mutexattr_destroy(&load_attr);
+  pthread_mutex_init(&fs->dirty_lock, NULL);
+  fs->num_sessions = 1;
+  fs->cache_budget = FS_DEFAULT_BLOCK_CACHE_SIZE;
+  fs->journal = journal_new();
+  fs->commit_interval_us = FS_DEFAULT_COMMIT_INTERVAL_US;
+  fs_ctx_t *ctx = calloc(1, sizeof(fs_ctx_t));
+  ctx->fs = fs;
+  return ctx;
+}
+
+fs_ctx_t *fs_ctx_session(fs_ctx_t *ctx) {
+  FS_WRITE_LOCK(ctx);
+  ctx->fs->num_sessions++;
+  FS_UNLOCK(ctx);
+  fs_ctx_t *session = calloc(1, sizeof(fs_ctx_t));
+  session->fs = ctx->fs;
+  session->quiet = ctx->quiet;
+  return session;
+}
+
+void fs_ctx_set_quiet(fs_ctx_t *ctx, bool quiet) {
+  ctx->quiet = quiet;
 }
 
-int fs_mkfs(int num_fd) {
-  if (num_fd > FS_MAX_NUM_DESCRIPTORS) {
-    printf("Size more than max size of descriptors: %d > %d\n", num_fd, FS_MAX_NUM_DESCRIPTORS);
-    return FS_FAILURE;
+// the session's working directory, sessions from before the last mount start over at root
+static file_t *fs_ctx_cwd(fs_ctx_t *ctx) {
+  if (ctx->mount_generation != ctx->fs->mount_generation) {
+    ctx->cwd = ctx->fs->root;
+    ctx->mount_generation = ctx->fs->mount_generation;
+    __atomic_add_fetch(&ctx->cwd->cwd_count, 1, __ATOMIC_RELAXED);
   }
-  fs_new(num_fd);
-  printf("Created filesystem\n");
-  return FS_SUCCESS;
+  return ctx->cwd;
 }
 
-static void ls_print(void *data) {
-  file_t *file = (file_t *) ((node_t *) data)->value;
-  printf("file: %s\n", file->name);
+static void fs_ctx_set_cwd(fs_ctx_t *ctx, file_t *dir) {
+  file_t *cwd = fs_ctx_cwd(ctx);
+  __atomic_add_fetch(&dir->cwd_count, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&cwd->cwd_count, 1, __ATOMIC_RELAXED);
+  ctx->cwd = dir;
 }
 
-int fs_ls() {
-  FS_ENABLE_EXECUTION()
-  linked_list_foreach(cwd->fd->links, ls_print);
-  return FS_SUCCESS;
+// logs a metadata change made by the running call
+static void fs_journal(fs_ctx_t *ctx, journal_type_t type, uint64_t arg0, uint64_t arg1, uint64_t arg2,
+                       uint64_t arg3, const char *name, size_t length) {
+  journal_t *journal = ctx->fs->journal;
+  uint64_t lsn = journal_append(journal, type, arg0, arg1, arg2, arg3, name, length);
+  if (lsn) {
+    ctx->commit_lsn = lsn;
+    ctx->commit_generation = journal->generation;
+  } else {
+    ctx->checkpoint = true;
+  }
 }
 
-int fs_mount() {
-  if (!filesystem || !filesystem->format) {
-    printf("Filesystem not formatted\n");
-    return FS_FAILURE;
+// the commit thread wants a checkpoint, it stops waiting for the lock once the journal is detached
+static void fs_journal_request(void *arg) {
+  filesystem_t *fs = (filesystem_t *) arg;
+  while (!journal_stopping(fs->journal)) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += FS_CHECKPOINT_LOCK_WAIT_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    if (!pthread_rwlock_timedwrlock(&fs->lock, &deadline)) {
+      if (fs->mount) {
+        journal_checkpoint(fs->journal, fs_checkpoint_write, fs);
+      }
+      pthread_rwlock_unlock(&fs->lock);
+      return;
+    }
   }
-  filesystem->bitmap = bitmap_create((FS_STORAGE_SIZE_IN_BYTES / FS_BYTES_PER_BITMAP_BYTE) + 1);
-  filesystem->bst = tree_new();
-  filesystem->files = linked_list_new();
-  filesystem->storage = malloc(sizeof(unsigned char) * FS_STORAGE_SIZE_IN_BYTES);
+}
 
-  file_t *file = file_new("root", false);
-  file->fd = fs_descriptor_new(FS_DIRECTORY, 0);
-  filesystem->mount = true;
-  cwd = file;
-  printf("Mounted\n");
-  return FS_SUCCESS;
+// unmaps the image along with what fs_mount_image set up
+static void fs_unmount_image(filesystem_t *fs) {
+  snapshot_view_free(fs->view);
+  fs->view = NULL;
+  snapshot_table_free(fs->snapshots);
+  fs->snapshots = NULL;
+  block_allocator_free(fs->blocks);
+  fs->blocks = NULL;
+  image_close(fs->image);
+  fs->image = NULL;
+  fs->storage = NULL;
 }
 
-int fs_unmount() {
-  FS_ENABLE_EXECUTION()
-  free(filesystem->bitmap->map);
-  free(filesystem->bitmap);
-  filesystem->bitmap = NULL;
-  linked_list_free(filesystem->files);
-  filesystem->files = NULL;
-  tree_delete_all(&filesystem->bst->ptr);
-  filesystem->bst->ptr = NULL;
-  free(filesystem->bst);
-  filesystem->bst = NULL;
-  filesystem->mount = false;
-  printf("Unmounted\n");
-  return FS_SUCCESS;
+// returns false if the tables could not be written, changes which found the log full are lost then
+static bool fs_unmount_locked(fs_ctx_t *ctx) {
+  filesystem_t *fs = ctx->fs;
+  // the next mount starts from the tables instead of replaying the log, a snapshot is never written
+  bool saved = fs->view || journal_checkpoint(fs->journal, fs_checkpoint_write, fs);
+  journal_detach(fs->journal);
+  // every file, name and directory table goes with the arena's slabs
+  arena_free(fs->arena);
+  fs->arena = NULL;
+  free(fs->inodes);
+  fs->inodes = NULL;
+  fs->inodes_capacity = 0;
+  array_list_free(fs->free_ids);
+  fs->free_ids = NULL;
+  array_list_free(fs->dirty);
+  fs->dirty = NULL;
+  open_file_table_free(fs->open_files);
+  fs->open_files = NULL;
+  dentry_cache_free(fs->dcache);
+  fs->dcache = NULL;
+  block_cache_free(fs->cache);
+  fs->cache = NULL;
+  fs_unmount_image(fs);
+  fs->root = NULL;
+  fs->links_dir = NULL;
+  fs->inodes_dir = NULL;
+  fs->mount = false;
+  return saved;
 }
 
-static bool fstat(void *data, int id) {
-  file_t *file = (file_t *) ((node_t *) data)->value;
-  if (file->fd->id == id) {
-    fs_descriptor_show(file->fd);
-    return true;
+void fs_ctx_free(fs_ctx_t *ctx) {
+  if (!ctx) return;
+  filesystem_t *fs = ctx->fs;
+  FS_WRITE_LOCK(ctx);
+  if (fs->mount && ctx->mount_generation == fs->mount_generation) {
+    ctx->cwd->cwd_count--;
   }
-  return false;
+  bool last = --fs->num_sessions == 0;
+  if (last && fs->mount) {
+    fs_unmount_locked(ctx);
+  }
+  FS_UNLOCK(ctx);
+  if (last) {
+    journal_free(fs->journal);
+    pthread_mutex_destroy(&fs->dirty_lock);
+    pthread_mutex_destroy(&fs->load_lock);
+    pthread_rwlock_destroy(&fs->lock);
+    free(fs->image_path);
+    free(fs);
+  }
+  free(ctx);
 }
 
-int fs_fstat(int id) {
-  FS_ENABLE_EXECUTION()
-  linked_list_foreach_first_arg_int(filesystem->files, fstat, id);
-  return FS_FAILURE;
+// points the instance at another image, unmounting the current one
+static void fs_reset(fs_ctx_t *ctx, const char *image_path) {
+  filesystem_t *fs = ctx->fs;
+  if (fs->mount) {
+    fs_unmount_locked(ctx);
+  }
+  char *path = strdup(image_path);
+  free(fs->image_path);
+  fs->image_path = path;
+  fs->format = true;
 }
 
-int fs_link(char *path1, char *path2) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path2);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
-  }
-  file_t *file = (file_t *) linked_list_file_find_by_name(cwd->fd->links, path_parse->name);
-  if (file && file->is_link) {
-    return FS_FAILURE;
-  }
-  file->is_link = true;
-  file_t *file_link = file_new(path1, true);
-  file_link->fd = fs_descriptor_new(FS_FILE, file->fd->file_size);
-  file_link->content = file->content;
-  linked_list_push(file->fd->links, file_link);
-  linked_list_push(filesystem->files, (void *) file_link);
-  printf("file %s linked to %s\n", path1, path2);
-  return FS_SUCCESS;
+// looks a name up in dir, the dentry cache answers repeated and negative lookups
+static file_t *fs_lookup(filesystem_t *fs, file_t *dir, const char *name, size_t length) {
+  uint32_t hash = dir_index_hash(name, length);
+  file_t *file;
+  if (dentry_cache_lookup(fs->dcache, dir, name, length, hash, &file)) {
+    return file;
+  }
+  // a hit means the directory is loaded already
+  fs_dir_load(fs, dir);
+  file = dir->fd->index ? dir_index_find(dir->fd->index, name, length, hash) : NULL;
+  dentry_cache_insert(fs->dcache, dir, name, length, hash, file);
+  return file;
+}
+
+static void fs_dcache_invalidate(filesystem_t *fs, file_t *dir, const char *name, size_t length) {
+  dentry_cache_invalidate(fs->dcache, dir, name, length, dir_index_hash(name, length));
 }
 
-int fs_unlink(char *name) {
-  FS_ENABLE_EXECUTION()
-  file_t *file = linked_list_file_find_by_name(filesystem->files, name);
-  if (!file || !file->is_link) {
-    return FS_FAILURE;
+// walks the first num_tokens components from root or the session's cwd,
+// returns NULL if a component is missing or not a directory
+static file_t *fs_walk(fs_ctx_t *ctx, path_parse_t *path_parse, uint32_t num_tokens) {
+  file_t *dir = path_parse->is_absolute ? ctx->fs->root : fs_ctx_cwd(ctx);
+  for (uint32_t i = 0; i < num_tokens; i++) {
+    path_token_t *path_token = &path_parse->tokens[i];
+    FS_STATS_ADD(path_components, 1);
+    if (PATH_PARENT == path_token->type) {
+      if (!dir->parent_dir) {
+        return NULL;
+      }
+      dir = dir->parent_dir;
+    } else if (PATH_FILE == path_token->type) {
+      dir = fs_lookup(ctx->fs, dir, path_token->value, path_token->length);
+      if (!dir || dir->fd->type != FS_DIRECTORY) {
+        return NULL;
+      }
+    }
   }
-  linked_list_file_unlink(filesystem->files, file->name);
-  file_free(file);
-  return FS_SUCCESS;
+  return dir;
+}
+
+static file_t *fs_walk_path(fs_ctx_t *ctx, const char *path) {
+  path_parse_t path_parse;
+  if (!file_path_parse(path, &path_parse)) {
+    return NULL;
+  }
+  file_t *dir = fs_walk(ctx, &path_parse, path_parse.num_tokens);
+  file_path_parse_free(&path_parse);
+  return dir;
+}
+
+// returns the directory which holds the last path component, the component goes to name
+static file_t *fs_walk_parent(fs_ctx_t *ctx, const char *path, path_token_t *name) {
+  path_parse_t path_parse;
+  if (!file_path_parse(path, &path_parse)) {
+    return NULL;
+  }
+  file_t *dir = NULL;
+  if (path_parse.num_tokens && PATH_FILE == path_parse.tokens[path_parse.num_tokens - 1].type) {
+    *name = path_parse.tokens[path_parse.num_tokens - 1];
+    dir = fs_walk(ctx, &path_parse, path_parse.num_tokens - 1);
+  }
+  file_path_parse_free(&path_parse);
+  return dir;
+}
+
+// the file a path names, NULL if it does not exist
+static file_t *fs_walk_file(fs_ctx_t *ctx, const char *path) {
+  path_token_t name;
+  file_t *dir = fs_walk_parent(ctx, path, &name);
+  return dir ? fs_lookup(ctx->fs, dir, name.value, name.length) : NULL;
+}
+
+// The namespace changes below are shared by the fs_* calls and journal replay.
+
+// puts a new file or directory into dir
+static file_t *fs_file_add(filesystem_t *fs, file_t *dir, const char *name, size_t length, fs_type_t type,
+                           size_t id) {
+  file_t *file = file_new(fs->arena, name, length);
+  file->fd = fs_descriptor_new(fs->arena, id, type, 0);
+  // a new directory has nothing stored to load
+  file->fd->loaded = true;
+  if (type == FS_FILE) {
+    fs->num_files++;
+  }
+  file_dir_add(dir, file);
+  fs_inode_set(fs, id, file);
+  fs_dcache_invalidate(fs, dir, name, length);
+  fs_inode_dirty(fs, file);
+  fs_inode_dirty(fs, dir);
+  return file;
+}
+
+// puts another name of file into dir; the first link gives the file an entry of its own,
+// named by its number, which holds it from then on and whose descriptor every name shares
+static file_t *fs_file_link(filesystem_t *fs, file_t *file, file_t *dir, const char *name, size_t length) {
+  fs_descriptor_t *fd = file->fd;
+  file_t *inode = fs->inodes[fd->id];
+  if (inode->parent_dir != fs->inodes_dir) {
+    char number[24];
+    int number_length = snprintf(number, sizeof(number), "%llu", (unsigned long long) fd->id);
+    fs_dir_load(fs, fs->inodes_dir);
+    inode = fs_file_name(fs, inode, number, (size_t) number_length);
+    file_dir_add(fs->inodes_dir, inode);
+    fs_inode_set(fs, fd->id, inode);
+    fs_inode_dirty(fs, fs->inodes_dir);
+  }
+  file_t *file_link = fs_file_name(fs, inode, name, length);
+  fd->num_links++;
+  file_dir_add(dir, file_link);
+  fs_dcache_invalidate(fs, dir, name, length);
+  fs_inode_dirty(fs, inode);
+  fs_inode_dirty(fs, dir);
+  return file_link;
+}
+
+static file_t *fs_file_symlink(filesystem_t *fs, file_t *dir, const char *name, size_t length, size_t id) {
+  file_t *file = file_new(fs->arena, name, length);
+  file->fd = fs_descriptor_new(fs->arena, id, FS_SYMLINK, 0);
+  fs_file_pair(fs, file, dir);
+  file_dir_add(fs->links_dir, file);
+  fs_inode_set(fs, id, file);
+  fs_dcache_invalidate(fs, fs->links_dir, name, length);
+  fs_inode_dirty(fs, file);
+  fs_inode_dirty(fs, fs->links_dir);
+  return file;
+}
+
+// gives the file's blocks from block on back to the allocator
+static void fs_file_release(filesystem_t *fs, file_t *file, uint32_t block) {
+  uint64_t at = block;
+  uint32_t physical;
+  uint32_t run;
+  // freed blocks leave the cache unwritten, their next owner must not see old dirty data
+  while (fs->cache && at < UINT32_MAX) {
+    if (extent_map_lookup(&file->fd->extents, (uint32_t) at, &physical, &run)) {
+      block_cache_invalidate(fs->cache, physical, run);
+    } else if (run == UINT32_MAX) {
+      break;
+    }
+    at += run;
+  }
+  extent_map_truncate(&file->fd->extents, fs->blocks, block);
+}
+
+// takes a name of a file, a symlink or an empty directory out of the namespace and frees it,
+// a hard linked file is freed with its last name
+static void fs_file_remove(filesystem_t *fs, file_t *file) {
+  // symlinks pointing here must be loaded to be unpaired
+  if (file->fd->type == FS_DIRECTORY) {
+    fs_dir_load(fs, fs->links_dir);
+  }
+  file_t *parent = file->parent_dir;
+  file_dir_remove(parent, file);
+  fs_dcache_invalidate(fs, parent, file->name, strlen(file->name));
+  fs_inode_dirty(fs, parent);
+  file_t *inode = fs->inodes[file->fd->id];
+  if (inode != file) {
+    fs_descriptor_t *fd = file->fd;
+    file->fd = NULL;
+    file_free(fs->arena, file);
+    if (--fd->num_links) {
+      fs_inode_dirty(fs, inode);
+      return;
+    }
+    file = inode;
+    file_dir_remove(fs->inodes_dir, file);
+    fs_inode_dirty(fs, fs->inodes_dir);
+  }
+  if (file->fd->type == FS_DIRECTORY) {
+    dentry_cache_invalidate_dir(fs->dcache, file);
+  } else if (file->fd->type == FS_FILE) {
+    fs->num_files--;
+  }
+  // symlinks to a directory are left dangling
+  for (node_t *node = file->fd->links ? file->fd->links->head : NULL; node; node = node->next) {
+    file_t *other = (file_t *) node->value;
+    linked_list_remove(other->fd->links, file);
+    // a directory does not store the symlinks to it
+    if (other->fd->type != FS_DIRECTORY) {
+      fs_inode_dirty(fs, other);
+    }
+  }
+  if (file->fd->type == FS_FILE) {
+    fs_file_release(fs, file, 0);
+  }
+  fs_inode_set(fs, file->fd->id, NULL);
+  fs_inode_dirty_id(fs, file->fd->id);
+  array_list_push(fs->free_ids, file->fd->id);
+  file_free(fs->arena, file);
+}
+
+// sets the size of a file, growing leaves a hole and shrinking gives the blocks past the new end back;
+// file data is not touched, replay finds it as it was last written
+static void fs_file_resize(filesystem_t *fs, file_t *file, uint32_t size) {
+  uint32_t block_size = fs->block_size;
+  if (size < (uint32_t) file->fd->file_size) {
+    fs_file_release(fs, file, (uint32_t) (((uint64_t) size + block_size - 1) / block_size));
+  }
+  file->fd->file_size = (int32_t) size;
+  fs_inode_dirty(fs, file);
+}
+
+// replays one record on top of the tables of the last checkpoint, loading what it touches;
+// records which do not fit the tree are skipped, they can only come from a dropped record
+static void fs_journal_apply(void *arg, const journal_record_t *record, const char *name) {
+  filesystem_t *fs = (filesystem_t *) arg;
+  const uint64_t *args = record->args;
+  if (args[0] < FS_FIRST_FILE_ID || args[0] >= fs->num_inodes) {
+    return;
+  }
+  if ((record->type == JOURNAL_CREATE || record->type == JOURNAL_SYMLINK) && args[0] >= fs->next_fd_id) {
+    fs->next_fd_id = args[0] + 1;
+    fs_inode_reserve(fs, fs->next_fd_id);
+  }
+  file_t *file = fs_inode_get(fs, args[0]);
+  file_t *other = record->type == JOURNAL_CREATE || record->type == JOURNAL_REMOVE || record->type == JOURNAL_LINK ||
+                          record->type == JOURNAL_SYMLINK
+                      ? fs_inode_get(fs, args[1]) : NULL;
+  if (other && other->fd->type == FS_DIRECTORY) {
+    fs_dir_load(fs, other);
+  }
+  if (file && file->fd->type == FS_DIRECTORY) {
+    fs_dir_load(fs, file);
+  }
+  switch (record->type) {
+    case JOURNAL_CREATE:
+      if (!file && other && other->fd->type == FS_DIRECTORY && (args[2] == FS_FILE || args[2] == FS_DIRECTORY) &&
+          !dir_index_find(other->fd->index, name, record->name_length, dir_index_hash(name, record->name_length))) {
+        fs_file_add(fs, other, name, record->name_length, (fs_type_t) args[2], args[0]);
+      }
+      break;
+    case JOURNAL_REMOVE:
+      // the entry goes, not the inode, which other names of a hard linked file still share
+      file = other && other->fd->type == FS_DIRECTORY
+                 ? dir_index_find(other->fd->index, name, record->name_length, dir_index_hash(name, record->name_length))
+                 : NULL;
+      if (file && file->fd->id == args[0] && !(file->fd->type == FS_DIRECTORY && file->fd->index->count)) {
+        fs_file_remove(fs, file);
+      }
+      break;
+    case JOURNAL_LINK:
+      if (file && file->fd->type == FS_FILE && file->fd->num_links < UINT32_MAX && other &&
+          other->fd->type == FS_DIRECTORY && other != fs->links_dir && other != fs->inodes_dir &&
+          !dir_index_find(other->fd->index, name, record->name_length, dir_index_hash(name, record->name_length))) {
+        fs_file_link(fs, file, other, name, record->name_length);
+      }
+      break;
+    case JOURNAL_SYMLINK:
+      fs_dir_load(fs, fs->links_dir);
+      if (!file && other && other->fd->type == FS_DIRECTORY &&
+          !dir_index_find(fs->links_dir->fd->index, name, record->name_length, dir_index_hash(name, record->name_length))) {
+        fs_file_symlink(fs, other, name, record->name_length, args[0]);
+      }
+      break;
+    case JOURNAL_EXTENT:
+      if (file && file->fd->type == FS_FILE && args[1] + args[3] <= UINT32_MAX && args[2] + args[3] <= fs->num_blocks &&
+          block_allocator_claim(fs->blocks, (uint32_t) args[2], (uint32_t) args[3])) {
+        extent_map_add(&file->fd->extents, (uint32_t) args[1], (uint32_t) args[2], (uint32_t) args[3]);
+        fs_inode_dirty(fs, file);
+      }
+      break;
+    case JOURNAL_SIZE:
+      if (file && file->fd->type == FS_FILE && args[1] <= INT32_MAX) {
+        file->fd->file_size = (int32_t) args[1];
+        fs_inode_dirty(fs, file);
+      }
+      break;
+    case JOURNAL_TRUNCATE:
+      if (file && file->fd->type == FS_FILE && args[1] <= INT32_MAX) {
+        fs_file_resize(fs, file, (uint32_t) args[1]);
+      }
+      break;
+    case JOURNAL_MOVE:
+      if (file && file->fd->type == FS_FILE && args[1] + args[3] <= UINT32_MAX && args[2] + args[3] <= fs->num_blocks &&
+          block_allocator_claim(fs->blocks, (uint32_t) args[2], (uint32_t) args[3])) {
+        uint32_t old_physical;
+        if (extent_map_remap(&file->fd->extents, (uint32_t) args[1], (uint32_t) args[2], (uint32_t) args[3],
+                             &old_physical)) {
+          block_allocator_release(fs->blocks, old_physical, (uint32_t) args[3]);
+          fs_inode_dirty(fs, file);
+        } else {
+          block_allocator_release(fs->blocks, (uint32_t) args[2], (uint32_t) args[3]);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// takes a free inode number: the latest one freed, one found free in the tables by the scan,
+// or a number never used; false when every inode number of the image is taken
+static bool fs_inode_alloc(fs_ctx_t *ctx, size_t *id) {
+  filesystem_t *fs = ctx->fs;
+  array_list_t *free_ids = fs->free_ids;
+  while (free_ids->size) {
+    uint64_t free_id = free_ids->array[--free_ids->size];
+    if (!fs->inodes[free_id]) {
+      *id = free_id;
+      return true;
+    }
+  }
+  // numbers freed before this mount, a few slots per call until the scan reaches the end,
+  // all the remaining ones once no number is left unused
+  bool exhausted = fs->next_fd_id >= fs->num_inodes;
+  for (uint32_t i = 0; (i < FS_INODE_SCAN_STEP || exhausted) && fs->inode_scan < fs->next_fd_id; i++) {
+    size_t scan_id = fs->inode_scan++;
+    if (!fs->inodes[scan_id] && !(inode_table_current(fs->image, scan_id)->flags & IMAGE_INODE_USED)) {
+      *id = scan_id;
+      return true;
+    }
+  }
+  if (fs->next_fd_id >= fs->num_inodes) {
+    FS_PRINT(ctx, "No free inodes\n");
+    return false;
+  }
+  *id = fs->next_fd_id++;
+  fs_inode_reserve(fs, fs->next_fd_id);
+  return true;
+}
+
+int fs_create(fs_ctx_t *ctx, char *path) {
+  FS_STATS_BEGIN(ctx, FS_OP_CREATE);
+  FS_WRITE_LOCK(ctx);
+  filesystem_t *fs = ctx->fs;
+  if (!path || !fs_enable_exec_command(fs)) {
+    FS_PRINT(ctx, "Cannot create file, not created filesystem or unmounted\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  FS_ENABLE_CHANGES(ctx)
+  if (fs->max_num_fd && fs->num_files >= fs->max_num_fd) {
+    FS_PRINT(ctx, "Cannot create file, the filesystem holds %u files at most\n", fs->max_num_fd);
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+
+  path_token_t name;
+  file_t *dir = fs_walk_parent(ctx, path, &name);
+  if (!dir) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (fs_lookup(fs, dir, name.value, name.length)) {
+    FS_PRINT(ctx, "File already exists\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  size_t id;
+  if (!fs_inode_alloc(ctx, &id)) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+
+  file_t *file = fs_file_add(fs, dir, name.value, name.length, FS_FILE, id);
+  fs_journal(ctx, JOURNAL_CREATE, file->fd->id, dir->fd->id, FS_FILE, 0, name.value, name.length);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+void fs_mkfs_options_init(fs_mkfs_options_t *options) {
+  options->image_path = FS_DEFAULT_IMAGE_PATH;
+  options->image_size = FS_DEFAULT_IMAGE_SIZE;
+  options->block_size = FS_DEFAULT_BLOCK_SIZE;
+  options->num_fd = 0;
+  options->alloc_policy = ALLOC_BEST_FIT;
+  options->journal_size = FS_DEFAULT_JOURNAL_SIZE;
+  options->num_inodes = 0;
+}
+
+int fs_mkfs(fs_ctx_t *ctx, const fs_mkfs_options_t *options) {
+  FS_STATS_BEGIN(ctx, FS_OP_MKFS);
+  if (options->num_fd < 0) {
+    FS_PRINT(ctx, "Negative number of files: %d\n", options->num_fd);
+    FS_RETURN_UNLOCKED(ctx, FS_FAILURE);
+  }
+  uint32_t block_size = options->block_size;
+  if (block_size < FS_MIN_BLOCK_SIZE || block_size > FS_MAX_BLOCK_SIZE || (block_size & (block_size - 1))) {
+    FS_PRINT(ctx, "Block size must be a power of two in [%u, %u]\n", FS_MIN_BLOCK_SIZE, FS_MAX_BLOCK_SIZE);
+    FS_RETURN_UNLOCKED(ctx, FS_FAILURE);
+  }
+  if (options->image_size / block_size > FS_MAX_NUM_BLOCKS) {
+    FS_PRINT(ctx, "Image too large for block size %u\n", block_size);
+    FS_RETURN_UNLOCKED(ctx, FS_FAILURE);
+  }
+  uint64_t num_inodes = options->num_inodes ? options->num_inodes : options->image_size / FS_BYTES_PER_INODE;
+  if (num_inodes < FS_FIRST_FILE_ID) {
+    num_inodes = FS_FIRST_FILE_ID;
+  }
+  if (num_inodes > FS_MAX_NUM_INODES) {
+    FS_PRINT(ctx, "Too many inodes: %llu > %llu\n", (unsigned long long) num_inodes,
+             (unsigned long long) FS_MAX_NUM_INODES);
+    FS_RETURN_UNLOCKED(ctx, FS_FAILURE);
+  }
+  FS_WRITE_LOCK(ctx);
+  // the image may be the mounted one, so unmount before it gets truncated
+  fs_reset(ctx, options->image_path);
+  image_header_t header = {
+      .image_size = options->image_size,
+      .block_size = block_size,
+      .max_num_fd = (uint32_t) options->num_fd,
+      .alloc_policy = options->alloc_policy,
+      .journal_size = options->journal_size,
+      .num_inodes = num_inodes,
+  };
+  if (!image_create(options->image_path, &header)) {
+    FS_PRINT(ctx, "Cannot create image %s\n", options->image_path);
+    ctx->fs->format = false;
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  FS_PRINT(ctx, "Created filesystem\n");
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_ls(fs_ctx_t *ctx) {
+  FS_STATS_BEGIN(ctx, FS_OP_LS);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  file_t *cwd = fs_ctx_cwd(ctx);
+  fs_dir_load(ctx->fs, cwd);
+  dir_index_t *index = cwd->fd->index;
+  for (uint32_t i = 0; i < index->count; i++) {
+    FS_PRINT(ctx, "file: %s\n", index->entries[i].file->name);
+  }
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+// maps the image with its block allocator and snapshot table, printing why it cannot
+static bool fs_mount_image(fs_ctx_t *ctx, const char *image_path) {
+  filesystem_t *fs = ctx->fs;
+  if (fs->mount) {
+    FS_PRINT(ctx, "Already mounted\n");
+    return false;
+  }
+  if (image_path) {
+    fs_reset(ctx, image_path);
+  } else if (!fs->format) {
+    FS_PRINT(ctx, "Filesystem not formatted\n");
+    return false;
+  }
+  image_t *image = image_open(fs->image_path);
+  if (image && image->header->num_inodes < FS_FIRST_FILE_ID) {
+    image_close(image);
+    image = NULL;
+  }
+  if (!image) {
+    FS_PRINT(ctx, "Cannot open image %s\n", fs->image_path);
+    fs->format = false;
+    return false;
+  }
+  fs->image = image;
+  fs->storage = image->data;
+  fs->block_size = image->header->block_size;
+  fs->num_blocks = image->header->num_blocks;
+  fs->max_num_fd = image->header->max_num_fd;
+  fs->alloc_policy = (alloc_policy_t) image->header->alloc_policy;
+  fs->num_inodes = image->header->num_inodes;
+  // only the header and the snapshot table are read here, inodes and allocation groups load on first use
+  fs->blocks = block_allocator_new((uint32_t) fs->num_blocks, fs->alloc_policy, inode_table_current_bitmap(image));
+  fs->snapshots = snapshot_table_new(image, fs->blocks);
+  if (!fs->snapshots) {
+    FS_PRINT(ctx, "Cannot open image %s, broken snapshot table\n", fs->image_path);
+    fs_unmount_image(fs);
+    fs->format = false;
+    return false;
+  }
+  return true;
+}
+
+// an empty tree of next_id inode numbers over the mapped image, its root and hidden directories load on first use
+static void fs_mount_tree(filesystem_t *fs, uint64_t next_id, uint64_t num_files) {
+  fs->cache = block_cache_new(fs->image, fs->block_size, fs->cache_budget);
+  fs->open_files = open_file_table_new();
+  fs->dcache = dentry_cache_new(FS_DENTRY_CACHE_ENTRIES);
+  fs->arena = arena_new();
+  fs->dirty = array_list_new();
+  fs->free_ids = array_list_new();
+  fs->num_files = num_files;
+  fs->next_fd_id = next_id > FS_FIRST_FILE_ID ? next_id : FS_FIRST_FILE_ID;
+  if (fs->next_fd_id > fs->num_inodes) {
+    fs->next_fd_id = fs->num_inodes;
+  }
+  fs->inode_scan = FS_FIRST_FILE_ID;
+  fs->compact_cursor = FS_FIRST_FILE_ID;
+  fs->inodes = NULL;
+  fs->inodes_capacity = 0;
+  fs_inode_reserve(fs, fs->next_fd_id);
+
+  fs->root = file_new(fs->arena, "root", strlen("root"));
+  fs->root->fd = fs_descriptor_new(fs->arena, FS_ROOT_ID, FS_DIRECTORY, 0);
+  fs_inode_set(fs, FS_ROOT_ID, fs->root);
+  fs->links_dir = file_new(fs->arena, "links", strlen("links"));
+  fs->links_dir->fd = fs_descriptor_new(fs->arena, FS_LINKS_ID, FS_DIRECTORY, 0);
+  fs_inode_set(fs, FS_LINKS_ID, fs->links_dir);
+  fs->inodes_dir = file_new(fs->arena, "inodes", strlen("inodes"));
+  fs->inodes_dir->fd = fs_descriptor_new(fs->arena, FS_INODES_ID, FS_DIRECTORY, 0);
+  fs_inode_set(fs, FS_INODES_ID, fs->inodes_dir);
 }
 
-#define FS_OPEN_FILE_ID_SHIFT 0
-#define FS_OPEN_FD_SHIFT      16
+int fs_mount(fs_ctx_t *ctx, const char *image_path) {
+  FS_STATS_BEGIN(ctx, FS_OP_MOUNT);
+  FS_WRITE_LOCK(ctx);
+  filesystem_t *fs = ctx->fs;
+  if (!fs_mount_image(ctx, image_path)) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  fs_mount_tree(fs, fs->image->header->next_id, fs->image->header->num_files);
+  // the log holds what changed after the tables were written
+  journal_attach(fs->journal, fs->image, fs_journal_apply, fs);
+  journal_set_commit_interval(fs->journal, fs->commit_interval_us);
+  journal_start(fs->journal, fs_journal_request, fs);
+  fs->mount = true;
+  fs->mount_generation++;
+  FS_PRINT(ctx, "Mounted\n");
+  FS_RETURN(ctx, FS_SUCCESS);
+}
 
-#define FS_CREATE_OPEN_FILE_FD(id, fd)  \
-  (((id) << FS_OPEN_FILE_ID_SHIFT) |    \
-   ((fd) << FS_OPEN_FD_SHIFT))
+int fs_mount_snapshot(fs_ctx_t *ctx, const char *image_path, const char *name) {
+  FS_STATS_BEGIN(ctx, FS_OP_MOUNT_SNAPSHOT);
+  FS_WRITE_LOCK(ctx);
+  filesystem_t *fs = ctx->fs;
+  if (!name || !fs_mount_image(ctx, image_path)) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  int index = snapshot_table_find(fs->snapshots, name);
+  fs->view = index != -1 ? snapshot_view_new(fs->image, &fs->snapshots->entries[index]) : NULL;
+  if (!fs->view) {
+    FS_PRINT(ctx, index != -1 ? "Snapshot %s is broken\n" : "No snapshot %s\n", name);
+    fs_unmount_image(fs);
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  // the log belongs to the tree, a snapshot has nothing to replay and nothing to log
+  image_snapshot_t *entry = &fs->snapshots->entries[index];
+  fs_mount_tree(fs, entry->next_id, entry->num_files);
+  fs->mount = true;
+  fs->mount_generation++;
+  FS_PRINT(ctx, "Mounted snapshot %s\n", name);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
 
-int fs_open(char *path) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+int fs_unmount(fs_ctx_t *ctx) {
+  FS_STATS_BEGIN(ctx, FS_OP_UNMOUNT);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  if (!fs_unmount_locked(ctx)) {
+    FS_PRINT(ctx, "Unmounted, no space left to write the metadata, changes may be lost\n");
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  file_t *file = linked_list_file_find_by_name(cwd->fd->links, path_parse->name);
+  FS_PRINT(ctx, "Unmounted\n");
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_fstat(fs_ctx_t *ctx, uint64_t id) {
+  FS_STATS_BEGIN(ctx, FS_OP_FSTAT);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  filesystem_t *fs = ctx->fs;
+  file_t *file = fs_inode_get(fs, id);
   if (!file) {
-    return FS_FAILURE;
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  // the links shown are a directory's entries
+  if (file->fd->type == FS_DIRECTORY) {
+    fs_dir_load(fs, file);
+  }
+  if (!ctx->quiet) {
+    pthread_rwlock_rdlock(&file->fd->lock);
+    fs_descriptor_show(file->fd);
+    pthread_rwlock_unlock(&file->fd->lock);
   }
+  FS_RETURN(ctx, FS_SUCCESS);
+}
 
-  if (file->is_link) {
-    return FS_FAILURE;
+int fs_link(fs_ctx_t *ctx, char *path1, char *path2) {
+  FS_STATS_BEGIN(ctx, FS_OP_LINK);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  file_t *file = fs_walk_file(ctx, path2);
+  if (!file || file->fd->type != FS_FILE || file->fd->num_links == UINT32_MAX) {
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  file->is_opened = true;
-  printf("created open id: %llu\n", FS_CREATE_OPEN_FILE_FD(file->fd->id, file->open_ids->size));
-  array_list_push(file->open_ids, FS_CREATE_OPEN_FILE_FD(file->fd->id, file->open_ids->size)); // NOLINT
-  return FS_SUCCESS;
+  filesystem_t *fs = ctx->fs;
+  path_token_t name;
+  file_t *dir = fs_walk_parent(ctx, path1, &name);
+  if (!dir) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (fs_lookup(fs, dir, name.value, name.length)) {
+    FS_PRINT(ctx, "File already exists\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  fs_file_link(fs, file, dir, name.value, name.length);
+  fs_journal(ctx, JOURNAL_LINK, file->fd->id, dir->fd->id, 0, 0, name.value, name.length);
+  FS_PRINT(ctx, "file %s linked to %s\n", path1, path2);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-inline static uint32_t fs_extract_open_file_id(int fd) {
-  return extract_bit_range(fd, 15, 0);
+int fs_unlink(fs_ctx_t *ctx, char *name) {
+  FS_STATS_BEGIN(ctx, FS_OP_UNLINK);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  file_t *file = fs_walk_file(ctx, name);
+  if (!file || file->fd->type != FS_FILE) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (file->open_count) {
+    FS_PRINT(ctx, "File is opened\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  fs_journal(ctx, JOURNAL_REMOVE, file->fd->id, file->parent_dir->fd->id, 0, 0, file->name, strlen(file->name));
+  fs_file_remove(ctx->fs, file);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-inline static uint32_t fs_extract_open_fd(int fd) {
-  return extract_bit_range(fd, 31, 16);
+int fs_open(fs_ctx_t *ctx, char *path) {
+  FS_STATS_BEGIN(ctx, FS_OP_OPEN);
+  FS_WRITE_LOCK(ctx);
+  if (!fs_enable_exec_command(ctx->fs)) {
+    FS_PRINT(ctx, "Not mounted or formatted\n");
+    FS_RETURN(ctx, FS_INVALID_FD);
+  }
+  file_t *file = fs_walk_file(ctx, path);
+  if (!file || file->fd->type != FS_FILE) {
+    FS_RETURN(ctx, FS_INVALID_FD);
+  }
+  // a file of a snapshot opens read only
+  uint32_t flags = ctx->fs->view ? OPEN_FILE_READ : OPEN_FILE_READ | OPEN_FILE_WRITE;
+  int fd = open_file_table_open(ctx->fs->open_files, file, flags);
+  if (fd == FS_INVALID_FD) {
+    FS_PRINT(ctx, "Too many open files\n");
+    FS_RETURN(ctx, FS_INVALID_FD);
+  }
+  FS_PRINT(ctx, "created open id: %d\n", fd);
+  FS_RETURN(ctx, fd);
 }
 
-static bool find_file(void *data, int fd) {
-  file_t *file = (file_t *) ((node_t *) data)->value;
-  if (file->fd->id == fs_extract_open_file_id(fd)) {
-    return true;
+static file_t *fs_opened_file(fs_ctx_t *ctx, int fd, uint32_t flags) {
+  open_file_t *open_file = open_file_table_get(ctx->fs->open_files, fd);
+  if (!open_file || (open_file->flags & flags) != flags) {
+    FS_PRINT(ctx, "File is not opened\n");
+    return NULL;
   }
-  return false;
+  return open_file->file;
+}
+
+// maps a hole, fresh blocks are zeroed so that bytes past the file size always read as zeros
+static bool fs_file_map(fs_ctx_t *ctx, file_t *file, uint32_t block, uint32_t num_blocks) {
+  filesystem_t *fs = ctx->fs;
+  // files spread over the allocation groups by id, so parallel writers rarely share a group
+  uint32_t group = (uint32_t) file->fd->id;
+  bool mapped = extent_map_allocate(&file->fd->extents, fs->blocks, group, block, num_blocks);
+  fs_inode_dirty(fs, file);
+  uint32_t end = block + num_blocks;
+  uint32_t physical;
+  uint32_t run;
+  while (block < end && extent_map_lookup(&file->fd->extents, block, &physical, &run)) {
+    if (run > end - block) {
+      run = end - block;
+    }
+    memset(&fs->storage[(uint64_t) physical * fs->block_size], 0, (uint64_t) run * fs->block_size);
+    fs_journal(ctx, JOURNAL_EXTENT, file->fd->id, block, physical, run, NULL, 0);
+    block += run;
+  }
+  return mapped;
 }
 
-static bool close_fd(void *data, int fd) {
-  file_t *file = (file_t *) ((node_t *) data)->value;
-  if (file->is_opened && file->fd->id == fs_extract_open_file_id(fd)) {
-    array_list_remove_at(file->open_ids, fs_extract_open_fd(fd));
-    if (file->open_ids->size == 0) {
-      file->is_opened = false;
+// maps every hole in [offset, offset + size), blocks which are already mapped stay in place
+static bool fs_file_map_range(fs_ctx_t *ctx, file_t *file, uint64_t offset, uint64_t size) {
+  filesystem_t *fs = ctx->fs;
+  uint32_t block = (uint32_t) (offset / fs->block_size);
+  uint32_t last = (uint32_t) ((offset + size - 1) / fs->block_size);
+  uint32_t physical;
+  uint32_t run;
+  while (block <= last) {
+    if (!extent_map_lookup(&file->fd->extents, block, &physical, &run)) {
+      if (run > last - block + 1) {
+        run = last - block + 1;
+      }
+      if (!fs_file_map(ctx, file, block, run)) {
+        return false;
+      }
+    }
+    if (run > last - block) {
+      break;
     }
-    printf("fd %d closed\n", fd);
+    block += run;
+  }
+  return true;
+}
+
+static void fs_file_move(fs_ctx_t *ctx, file_t *file, uint32_t block, uint32_t physical, uint32_t num_blocks,
+                         array_list_t *freed);
+
+// copies the blocks of [offset, offset + size) a snapshot holds to blocks of the file's own, so that writing
+// leaves the snapshot as it was; false if there is no space for the copies
+static bool fs_file_unshare(fs_ctx_t *ctx, file_t *file, uint64_t offset, uint64_t size) {
+  filesystem_t *fs = ctx->fs;
+  if (!fs->blocks->held) {
     return true;
   }
-  return false;
+  uint32_t block = (uint32_t) (offset / fs->block_size);
+  uint32_t end = (uint32_t) ((offset + size - 1) / fs->block_size) + 1;
+  array_list_t *freed = array_list_new();
+  bool unshared = true;
+  while (block < end && unshared) {
+    uint32_t physical;
+    uint32_t run;
+    bool mapped = extent_map_lookup(&file->fd->extents, block, &physical, &run);
+    if (run > end - block) {
+      run = end - block;
+    }
+    bool held = false;
+    if (mapped) {
+      run = block_allocator_held_run(fs->blocks, physical, run, &held);
+    }
+    if (held) {
+      // a run the free space cannot hold in one piece is copied in smaller ones
+      int64_t target = block_allocator_alloc(fs->blocks, (uint32_t) file->fd->id, run);
+      while (target == -1 && run > 1) {
+        run /= 2;
+        target = block_allocator_alloc(fs->blocks, (uint32_t) file->fd->id, run);
+      }
+      unshared = target != -1;
+      if (unshared) {
+        fs_file_move(ctx, file, block, (uint32_t) target, run, freed);
+      }
+    }
+    block += run;
+  }
+  // the old runs stay allocated to the snapshots, they are kept rather than freed
+  for (uint32_t i = 0; i < freed->size; i += 2) {
+    block_allocator_release(fs->blocks, freed->array[i], freed->array[i + 1]);
+  }
+  array_list_free(freed);
+  return unshared;
 }
 
-int fs_close(int fd) {
-  FS_ENABLE_EXECUTION()
-  return linked_list_foreach_first_arg_int(cwd->fd->links, close_fd, fd);
+// copies between buffer and the file extent by extent, holes read as zeros,
+// writes expect the range to be mapped already and stop with false at a hole
+static bool fs_file_transfer(filesystem_t *fs, file_t *file, uint64_t offset, unsigned char *buffer,
+                             uint64_t size, bool write) {
+  uint32_t block_size = fs->block_size;
+  while (size) {
+    uint32_t block = (uint32_t) (offset / block_size);
+    uint32_t block_offset = (uint32_t) (offset % block_size);
+    uint32_t physical;
+    uint32_t run;
+    bool mapped = extent_map_lookup(&file->fd->extents, block, &physical, &run);
+    assert(mapped || !write);
+    if (!mapped && write) {
+      return false;
+    }
+    uint64_t chunk = (uint64_t) run * block_size - block_offset;
+    if (chunk > size) {
+      chunk = size;
+    }
+    if (!mapped) {
+      memset(buffer, 0, chunk);
+    } else if (fs->cache && write) {
+      block_cache_write(fs->cache, physical, block_offset, buffer, chunk);
+    } else if (fs->cache) {
+      block_cache_read(fs->cache, physical, block_offset, buffer, chunk);
+    } else if (write) {
+      memcpy(&fs->storage[(uint64_t) physical * block_size + block_offset], buffer, chunk);
+    } else {
+      memcpy(buffer, &fs->storage[(uint64_t) physical * block_size + block_offset], chunk);
+    }
+    offset += chunk;
+    buffer += chunk;
+    size -= chunk;
+  }
+  return true;
 }
 
-static bool fs_file_is_opened(file_t *file, int fd) {
-  if (!file->is_opened) {
-    return false;
+int fs_close(fs_ctx_t *ctx, int fd) {
+  FS_STATS_BEGIN(ctx, FS_OP_CLOSE);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  filesystem_t *fs = ctx->fs;
+  file_t *file = fs_opened_file(ctx, fd, 0);
+  if (!file) {
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  for (int i = 0; i < file->open_ids->size; ++i) {
-    if (fs_extract_open_fd(fd) == fs_extract_open_fd(file->open_ids->array[i])) {
-      return true;
+  tree_t *extents = &file->fd->extents.tree;
+  for (tree_node_t *tree_node = tree_find_ceil_node(extents->ptr, 0); tree_node;
+       tree_node = tree_find_ceil_node(extents->ptr, tree_node->value + tree_node->num_reserved_bits)) {
+    if (fs->cache) {
+      block_cache_flush(fs->cache, (uint32_t) tree_node->index, tree_node->num_reserved_bits);
     }
+    image_sync(fs->image, (uint64_t) tree_node->index * fs->block_size,
+               (uint64_t) tree_node->num_reserved_bits * fs->block_size);
   }
-  return false;
+  open_file_table_close(fs->open_files, fd);
+  FS_PRINT(ctx, "fd %d closed\n", fd);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-int fs_read(int fd, uint32_t offset, uint32_t size) {
-  FS_ENABLE_EXECUTION()
-  node_t *node = linked_list_foreach_first_node_arg_int(filesystem->files, find_file, fd);
-  if (!node) {
-    return FS_FAILURE;
+int fs_advise(fs_ctx_t *ctx, int fd, image_advice_t advice) {
+  FS_STATS_BEGIN(ctx, FS_OP_ADVISE);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  filesystem_t *fs = ctx->fs;
+  file_t *file = fs_opened_file(ctx, fd, 0);
+  if (!file) {
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  file_t *file = (file_t *) node->value;
-  if (!fs_file_is_opened(file, fd)) {
-    printf("File is not opened\n");
-    return FS_FAILURE;
+  pthread_rwlock_rdlock(&file->fd->lock);
+  tree_t *extents = &file->fd->extents.tree;
+  for (tree_node_t *tree_node = tree_find_ceil_node(extents->ptr, 0); tree_node;
+       tree_node = tree_find_ceil_node(extents->ptr, tree_node->value + tree_node->num_reserved_bits)) {
+    image_advise(fs->image, (uint64_t) tree_node->index * fs->block_size,
+                 (uint64_t) tree_node->num_reserved_bits * fs->block_size, advice);
   }
-  if (!file->fd->file_size) {
-    return FS_FAILURE;
+  pthread_rwlock_unlock(&file->fd->lock);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+// takes the shared lock for a data call on an open file, on failure the lock is released again
+static file_t *fs_io_begin(fs_ctx_t *ctx, int fd, uint32_t flags) {
+  FS_READ_LOCK(ctx);
+  if (!fs_enable_exec_command(ctx->fs)) {
+    FS_PRINT(ctx, "Not mounted or formatted\n");
+    FS_UNLOCK(ctx);
+    return NULL;
   }
-  tree_node_t *tree_node = tree_find_node(filesystem->bst->ptr, file->content);
-  if (!tree_node) {
-    return FS_FAILURE;
+  file_t *file = fs_opened_file(ctx, fd, flags);
+  if (!file) {
+    FS_UNLOCK(ctx);
   }
-  uint32_t length = tree_node->num_reserved_bits * FS_BYTES_PER_BITMAP_BIT;
-  if (size + offset >= length) {
-    return FS_FAILURE;
+  return file;
+}
+
+// gathers from offset up to the end of the file into iov, returns the number of bytes read
+static ssize_t fs_file_readv(filesystem_t *fs, file_t *file, const struct iovec *iov, int iovcnt,
+                             uint64_t offset) {
+  pthread_rwlock_rdlock(&file->fd->lock);
+  uint64_t file_size = (uint64_t) file->fd->file_size;
+  uint64_t left = offset < file_size ? file_size - offset : 0;
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt && left; i++) {
+    uint64_t size = iov[i].iov_len < left ? iov[i].iov_len : left;
+    fs_file_transfer(fs, file, offset, (unsigned char *) iov[i].iov_base, size, false);
+    offset += size;
+    left -= size;
+    total += (ssize_t) size;
   }
-  unsigned char *content = &filesystem->storage[tree_node->index * FS_BYTES_PER_BITMAP_BIT];
-  printf("%.*s\n", size, content);
-  return FS_SUCCESS;
+  pthread_rwlock_unlock(&file->fd->lock);
+  return total;
 }
 
-int fs_write(int fd, char *buffer, uint32_t offset, uint32_t size) {
-  FS_ENABLE_EXECUTION()
-  node_t *node = linked_list_foreach_first_node_arg_int(filesystem->files, find_file, fd);
-  if (!node) {
-    return FS_FAILURE;
-  }
-  file_t *file = (file_t *) node->value;
-  if (!fs_file_is_opened(file, fd)) {
-    printf("File is not opened\n");
-    return FS_FAILURE;
-  }
-  uint32_t run_bits = (size / FS_BYTES_PER_BITMAP_BIT) + 1;
-  int32_t index = bitmap_get_bit_run(filesystem->bitmap, run_bits);
-  if (index == -1) return FS_FAILURE;
-  bitmap_set_bits(filesystem->bitmap, 0, run_bits, index);
-
-  tree_node_t *tree_node = malloc(sizeof(tree_node_t));
-  tree_node->index = index;
-  tree_node->num_reserved_bits = run_bits;
-
-  uint32_t storage_index = index * FS_BYTES_PER_BITMAP_BIT;
-  uint32_t copy_size = run_bits * FS_BYTES_PER_BITMAP_BIT;
-  if (storage_index + offset + copy_size >= FS_STORAGE_SIZE_IN_BYTES) {
-    return FS_FAILURE;
-  }
-  memmove(&filesystem->storage[storage_index], &buffer[0], copy_size);
-  uint32_t storage_location = (uint32_t) ((intptr_t) (&filesystem->storage[storage_index]));
-  file->content = storage_location;
-  file->fd->file_size = size;
-  tree_node->value = storage_location;
-  tree_node->name = file->name;
-  tree_insert_node(&filesystem->bst->ptr, tree_node);
-  printf("Write file %s\n", file->name);
-  return FS_SUCCESS;
+// scatters iov to the file at offset, all or nothing, returns the number of bytes written or -1
+static ssize_t fs_file_writev(fs_ctx_t *ctx, file_t *file, const struct iovec *iov, int iovcnt,
+                              uint64_t offset) {
+  // the lengths and the end are bounded before they are added up, so neither can wrap
+  uint64_t size = 0;
+  bool too_large = offset > INT32_MAX;
+  for (int i = 0; i < iovcnt && !too_large; i++) {
+    too_large = iov[i].iov_len > INT32_MAX - size;
+    size += iov[i].iov_len;
+  }
+  if (!too_large && !size) {
+    return 0;
+  }
+  if (too_large || size > INT32_MAX - offset) {
+    FS_PRINT(ctx, "File too large\n");
+    return -1;
+  }
+  uint64_t end = offset + size;
+  pthread_rwlock_wrlock(&file->fd->lock);
+  // holes are mapped and shared blocks copied up front, so running out of space leaves the file as it was
+  if (!fs_file_map_range(ctx, file, offset, size) || !fs_file_unshare(ctx, file, offset, size)) {
+    pthread_rwlock_unlock(&file->fd->lock);
+    FS_PRINT(ctx, "No space left\n");
+    return -1;
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    if (!fs_file_transfer(ctx->fs, file, offset, (unsigned char *) iov[i].iov_base, iov[i].iov_len, true)) {
+      pthread_rwlock_unlock(&file->fd->lock);
+      FS_PRINT(ctx, "Write to an unmapped block\n");
+      return -1;
+    }
+    offset += iov[i].iov_len;
+  }
+  if (end > (uint64_t) file->fd->file_size) {
+    file->fd->file_size = (int32_t) end;
+    fs_inode_dirty(ctx->fs, file);
+    fs_journal(ctx, JOURNAL_SIZE, file->fd->id, end, 0, 0, NULL, 0);
+  }
+  pthread_rwlock_unlock(&file->fd->lock);
+  return (ssize_t) size;
 }
 
-int fs_truncate(char *path, uint32_t size) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+int fs_read(fs_ctx_t *ctx, int fd, uint32_t offset, uint32_t size) {
+  FS_STATS_BEGIN(ctx, FS_OP_READ);
+  file_t *file = fs_io_begin(ctx, fd, OPEN_FILE_READ);
+  if (!file) {
+    FS_RETURN_UNLOCKED(ctx, FS_FAILURE);
+  }
+  pthread_rwlock_rdlock(&file->fd->lock);
+  bool past_end = (uint64_t) offset + size > (uint64_t) file->fd->file_size;
+  pthread_rwlock_unlock(&file->fd->lock);
+  if (past_end) {
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  file_t *file = linked_list_file_find_by_name(cwd->fd->links, path_parse->name);
+  // %.*s needs no terminator
+  unsigned char *buffer = malloc(size ? size : 1);
+  struct iovec iov = {.iov_base = buffer, .iov_len = size};
+  if (fs_file_readv(ctx->fs, file, &iov, 1, offset) != (ssize_t) size) {
+    free(buffer);
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  FS_STATS_BYTES(ctx, size);
+  FS_PRINT(ctx, "%.*s\n", size, buffer);
+  free(buffer);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_write(fs_ctx_t *ctx, int fd, char *buffer, uint32_t offset, uint32_t size) {
+  FS_STATS_BEGIN(ctx, FS_OP_WRITE);
+  file_t *file = fs_io_begin(ctx, fd, OPEN_FILE_WRITE);
   if (!file) {
-    return FS_FAILURE;
+    FS_RETURN_UNLOCKED(ctx, FS_FAILURE);
   }
-  tree_node_t *tree_node = tree_find_node(filesystem->bst->ptr, file->content);
-  if (!tree_node) {
-    return FS_FAILURE;
+  struct iovec iov = {.iov_base = buffer, .iov_len = size};
+  if (fs_file_writev(ctx, file, &iov, 1, offset) == -1) {
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  if (size == 0) {
-    bitmap_set_bits(filesystem->bitmap, 1, tree_node->num_reserved_bits, tree_node->index);
-    tree_delete_node(&filesystem->bst->ptr, file->content);
+  FS_STATS_BYTES(ctx, size);
+  if (size) {
+    FS_PRINT(ctx, "Write file %s\n", file->name);
+  }
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+// fs_pread and fs_readv, counted as op
+static ssize_t fs_readv_op(fs_ctx_t *ctx, fs_op_t op, int fd, const struct iovec *iov, int iovcnt,
+                           uint64_t offset) {
+  FS_STATS_BEGIN(ctx, op);
+  if (iovcnt < 0) {
+    FS_RETURN_UNLOCKED(ctx, (ssize_t) -1);
+  }
+  file_t *file = fs_io_begin(ctx, fd, OPEN_FILE_READ);
+  if (!file) {
+    FS_RETURN_UNLOCKED(ctx, (ssize_t) -1);
+  }
+  ssize_t total = fs_file_readv(ctx->fs, file, iov, iovcnt, offset);
+  FS_STATS_BYTES(ctx, total > 0 ? total : 0);
+  FS_RETURN(ctx, total);
+}
+
+// fs_pwrite and fs_writev, counted as op
+static ssize_t fs_writev_op(fs_ctx_t *ctx, fs_op_t op, int fd, const struct iovec *iov, int iovcnt,
+                            uint64_t offset) {
+  FS_STATS_BEGIN(ctx, op);
+  if (iovcnt < 0) {
+    FS_RETURN_UNLOCKED(ctx, (ssize_t) -1);
   }
-  if (tree_node->num_reserved_bits * FS_BYTES_PER_BITMAP_BIT == size) {
-    return FS_SUCCESS;
+  file_t *file = fs_io_begin(ctx, fd, OPEN_FILE_WRITE);
+  if (!file) {
+    FS_RETURN_UNLOCKED(ctx, (ssize_t) -1);
   }
-  uint32_t temp_size = tree_node->num_reserved_bits * FS_BYTES_PER_BITMAP_BIT;
-  bitmap_set_bits(filesystem->bitmap, 1, tree_node->num_reserved_bits, tree_node->index);
-  uint32_t run_bits = (size / FS_BYTES_PER_BITMAP_BIT) + 1;
-  int32_t index = bitmap_get_bit_run(filesystem->bitmap, run_bits);
-  if (index == -1) return FS_FAILURE;
-  bitmap_set_bits(filesystem->bitmap, 0, run_bits, index);
+  ssize_t total = fs_file_writev(ctx, file, iov, iovcnt, offset);
+  FS_STATS_BYTES(ctx, total > 0 ? total : 0);
+  FS_RETURN(ctx, total);
+}
+
+ssize_t fs_pread(fs_ctx_t *ctx, int fd, void *buffer, size_t size, uint64_t offset) {
+  struct iovec iov = {.iov_base = buffer, .iov_len = size};
+  return fs_readv_op(ctx, FS_OP_PREAD, fd, &iov, 1, offset);
+}
+
+ssize_t fs_pwrite(fs_ctx_t *ctx, int fd, const void *buffer, size_t size, uint64_t offset) {
+  struct iovec iov = {.iov_base = (void *) buffer, .iov_len = size};
+  return fs_writev_op(ctx, FS_OP_PWRITE, fd, &iov, 1, offset);
+}
 
-  tree_node->index = index;
-  tree_node->num_reserved_bits = run_bits;
+ssize_t fs_readv(fs_ctx_t *ctx, int fd, const struct iovec *iov, int iovcnt, uint64_t offset) {
+  return fs_readv_op(ctx, FS_OP_READV, fd, iov, iovcnt, offset);
+}
+
+ssize_t fs_writev(fs_ctx_t *ctx, int fd, const struct iovec *iov, int iovcnt, uint64_t offset) {
+  return fs_writev_op(ctx, FS_OP_WRITEV, fd, iov, iovcnt, offset);
+}
+
+int fs_read_view(fs_ctx_t *ctx, int fd, uint64_t offset, size_t size, fs_view_t *views, int max_views) {
+  FS_STATS_BEGIN(ctx, FS_OP_READ_VIEW);
+  file_t *file = fs_io_begin(ctx, fd, OPEN_FILE_READ);
+  if (!file) {
+    FS_RETURN_UNLOCKED(ctx, -1);
+  }
+  filesystem_t *fs = ctx->fs;
+  uint32_t block_size = fs->block_size;
+  pthread_rwlock_rdlock(&file->fd->lock);
+  uint64_t file_size = (uint64_t) file->fd->file_size;
+  if (offset >= file_size) {
+    size = 0;
+  } else if (size > file_size - offset) {
+    size = file_size - offset;
+  }
+  int num_views = 0;
+  while (size && num_views < max_views) {
+    uint32_t block = (uint32_t) (offset / block_size);
+    uint32_t block_offset = (uint32_t) (offset % block_size);
+    uint32_t physical;
+    uint32_t run;
+    bool mapped = extent_map_lookup(&file->fd->extents, block, &physical, &run);
+    uint64_t chunk = (uint64_t) run * block_size - block_offset;
+    if (chunk > size) {
+      chunk = size;
+    }
+    if (mapped && fs->cache) {
+      // the span shows the image, so cached changes go there first
+      block_cache_flush(fs->cache, physical, (uint32_t) ((block_offset + chunk + block_size - 1) / block_size));
+    }
+    views[num_views].data = mapped ? &fs->storage[(uint64_t) physical * block_size + block_offset] : NULL;
+    views[num_views].length = chunk;
+    num_views++;
+    offset += chunk;
+    size -= chunk;
+  }
+  pthread_rwlock_unlock(&file->fd->lock);
+  FS_RETURN(ctx, num_views);
+}
 
-  uint32_t storage_index = index * FS_BYTES_PER_BITMAP_BIT;
-  if (temp_size < size) {
-    uint32_t temp_index = temp_size - 1;
-    for (uint32_t i = storage_index + temp_index; i < size - 1; ++i) {
-      filesystem->storage[i] = '\0';
+int fs_truncate(fs_ctx_t *ctx, char *path, uint32_t size) {
+  FS_STATS_BEGIN(ctx, FS_OP_TRUNCATE);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  filesystem_t *fs = ctx->fs;
+  file_t *file = fs_walk_file(ctx, path);
+  if (!file || file->fd->type != FS_FILE || size > INT32_MAX) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  pthread_rwlock_wrlock(&file->fd->lock);
+  // the kept part of the last block reads as zeros past the new end, a snapshot holding it keeps the old bytes
+  uint32_t block_size = fs->block_size;
+  uint32_t tail = size % block_size;
+  bool zero = tail && size < (uint32_t) file->fd->file_size;
+  uint32_t physical;
+  uint32_t run;
+  if (zero && !fs_file_unshare(ctx, file, size, 1)) {
+    pthread_rwlock_unlock(&file->fd->lock);
+    FS_PRINT(ctx, "No space left\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (zero && extent_map_lookup(&file->fd->extents, size / block_size, &physical, &run)) {
+    if (fs->cache) {
+      block_cache_zero(fs->cache, physical, tail, block_size - tail);
+    } else {
+      memset(&fs->storage[(uint64_t) physical * block_size + tail], 0, block_size - tail);
     }
   }
-  file->fd->file_size = size;
-  return FS_SUCCESS;
+  fs_file_resize(fs, file, size);
+  fs_journal(ctx, JOURNAL_TRUNCATE, file->fd->id, size, 0, 0, NULL, 0);
+  pthread_rwlock_unlock(&file->fd->lock);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-int fs_cd(char *path) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+int fs_cd(fs_ctx_t *ctx, char *path) {
+  FS_STATS_BEGIN(ctx, FS_OP_CD);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  file_t *dir = fs_walk_path(ctx, path);
+  if (!dir) {
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  return FS_SUCCESS;
+  fs_ctx_set_cwd(ctx, dir);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_mkdir(fs_ctx_t *ctx, char *path) {
+  FS_STATS_BEGIN(ctx, FS_OP_MKDIR);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  filesystem_t *fs = ctx->fs;
+  path_token_t name;
+  file_t *dir = fs_walk_parent(ctx, path, &name);
+  if (!dir) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (fs_lookup(fs, dir, name.value, name.length)) {
+    FS_PRINT(ctx, "File already exists\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  size_t id;
+  if (!fs_inode_alloc(ctx, &id)) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  file_t *sub_directory = fs_file_add(fs, dir, name.value, name.length, FS_DIRECTORY, id);
+  fs_journal(ctx, JOURNAL_CREATE, sub_directory->fd->id, dir->fd->id, FS_DIRECTORY, 0, name.value, name.length);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_rmdir(fs_ctx_t *ctx, char *path) {
+  FS_STATS_BEGIN(ctx, FS_OP_RMDIR);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  filesystem_t *fs = ctx->fs;
+  path_token_t name;
+  file_t *parent = fs_walk_parent(ctx, path, &name);
+  file_t *dir = parent ? fs_lookup(fs, parent, name.value, name.length) : NULL;
+  if (!dir || dir->fd->type != FS_DIRECTORY || dir->cwd_count) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  fs_dir_load(fs, dir);
+  if (dir->fd->index->count) {
+    FS_PRINT(ctx, "Directory is not empty\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  fs_journal(ctx, JOURNAL_REMOVE, dir->fd->id, parent->fd->id, 0, 0, name.value, name.length);
+  fs_file_remove(fs, dir);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_symlink(fs_ctx_t *ctx, char *str, char *path) {
+  FS_STATS_BEGIN(ctx, FS_OP_SYMLINK);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  file_t *dir = fs_walk_path(ctx, path);
+  if (!dir) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  filesystem_t *fs = ctx->fs;
+  if (fs_lookup(fs, fs->links_dir, str, strlen(str))) {
+    FS_PRINT(ctx, "File already exists\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  size_t id;
+  if (!fs_inode_alloc(ctx, &id)) {
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  file_t *file = fs_file_symlink(fs, dir, str, strlen(str), id);
+  fs_journal(ctx, JOURNAL_SYMLINK, file->fd->id, dir->fd->id, 0, 0, str, strlen(str));
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_dcache_stats(fs_ctx_t *ctx, dentry_cache_stats_t *stats) {
+  FS_STATS_BEGIN(ctx, FS_OP_DCACHE_STATS);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  dentry_cache_stats(ctx->fs->dcache, stats);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-int fs_mkdir(char *path) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+int fs_sync(fs_ctx_t *ctx) {
+  FS_STATS_BEGIN(ctx, FS_OP_SYNC);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  filesystem_t *fs = ctx->fs;
+  if (fs->cache) {
+    block_cache_flush_all(fs->cache);
   }
-  file_t *sub_directory = file_new(path_parse->name, false);
-  sub_directory->fd = fs_descriptor_new(FS_DIRECTORY, 0);
-  sub_directory->parent_dir = cwd;
-  if (!cwd->parent_dir) {
-    linked_list_push(cwd->fd->links, (void *) sub_directory);
+  journal_sync(fs->journal);
+  FS_RETURN(ctx, image_sync_all(fs->image) ? FS_SUCCESS : FS_FAILURE);
+}
+
+int fs_set_cache_budget(fs_ctx_t *ctx, size_t budget) {
+  FS_STATS_BEGIN(ctx, FS_OP_SET_CACHE_BUDGET);
+  FS_WRITE_LOCK(ctx);
+  filesystem_t *fs = ctx->fs;
+  fs->cache_budget = budget;
+  if (fs->mount) {
+    block_cache_free(fs->cache);
+    fs->cache = block_cache_new(fs->image, fs->block_size, budget);
+  }
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_bcache_stats(fs_ctx_t *ctx, block_cache_stats_t *stats) {
+  FS_STATS_BEGIN(ctx, FS_OP_BCACHE_STATS);
+  FS_READ_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  if (ctx->fs->cache) {
+    block_cache_stats(ctx->fs->cache, stats);
   } else {
-    linked_list_push(cwd->parent_dir->fd->links, (void *) sub_directory);
+    memset(stats, 0, sizeof(block_cache_stats_t));
   }
-  cwd = original_cwd;
-  return FS_SUCCESS;
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_set_commit_interval(fs_ctx_t *ctx, uint32_t commit_interval_us) {
+  FS_STATS_BEGIN(ctx, FS_OP_SET_COMMIT_INTERVAL);
+  FS_WRITE_LOCK(ctx);
+  ctx->fs->commit_interval_us = commit_interval_us;
+  journal_set_commit_interval(ctx->fs->journal, commit_interval_us);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-static bool remove_empty_dir(void *data) {
-  file_t *file = (file_t *) ((node_t *) data)->value;
-  return file->fd->type == FS_DIRECTORY && !file->fd->links->count;
+int fs_journal_stats(fs_ctx_t *ctx, journal_stats_t *stats) {
+  FS_STATS_BEGIN(ctx, FS_OP_JOURNAL_STATS);
+  FS_READ_LOCK(ctx);
+  journal_stats(ctx->fs->journal, stats);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-int fs_rmdir(char *path) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+int fs_frag_report(fs_ctx_t *ctx, fs_frag_report_t *report) {
+  FS_STATS_BEGIN(ctx, FS_OP_FRAG_REPORT);
+  FS_READ_LOCK(ctx);
+  memset(report, 0, sizeof(fs_frag_report_t));
+  FS_ENABLE_EXECUTION(ctx)
+  filesystem_t *fs = ctx->fs;
+  block_allocator_free_runs(fs->blocks, &report->free);
+  for (size_t id = FS_FIRST_FILE_ID; id < fs->next_fd_id; id++) {
+    file_t *file = __atomic_load_n(&fs->inodes[id], __ATOMIC_ACQUIRE);
+    // a stored file has a slot entry per extent, it is counted without being loaded
+    const image_inode_t *slot = file ? NULL : fs_inode_stored(fs, id);
+    uint64_t num_extents = 0;
+    if (file && file->fd->type == FS_FILE) {
+      pthread_rwlock_rdlock(&file->fd->lock);
+      tree_t *extents = &file->fd->extents.tree;
+      for (tree_node_t *tree_node = tree_find_ceil_node(extents->ptr, 0); tree_node;
+           tree_node = tree_find_ceil_node(extents->ptr, tree_node->value + tree_node->num_reserved_bits)) {
+        num_extents++;
+      }
+      pthread_rwlock_unlock(&file->fd->lock);
+    } else if (slot && slot->type == FS_FILE) {
+      num_extents = slot->num_entries;
+    } else {
+      continue;
+    }
+    report->num_files++;
+    report->num_extents += num_extents;
+    if (num_extents > report->max_extents) {
+      report->max_extents = num_extents;
+    }
+    if (num_extents) {
+      report->extents[63 - bit_clz64(num_extents)]++;
+    }
   }
-  linked_list_remove_if(cwd->parent_dir->fd->links, remove_empty_dir);
-  cwd = original_cwd;
-  return FS_SUCCESS;
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+// points logical [block, block + num_blocks) of a file at the run at physical, which the caller claimed;
+// the data reaches the image before the move is logged, the old run goes to freed as its start and length
+static void fs_file_move(fs_ctx_t *ctx, file_t *file, uint32_t block, uint32_t physical, uint32_t num_blocks,
+                         array_list_t *freed) {
+  filesystem_t *fs = ctx->fs;
+  uint64_t size = (uint64_t) num_blocks * fs->block_size;
+  uint32_t old_physical;
+  uint32_t run;
+  extent_map_lookup(&file->fd->extents, block, &old_physical, &run);
+  if (fs->cache) {
+    block_cache_flush(fs->cache, old_physical, num_blocks);
+  }
+  memcpy(&fs->storage[(uint64_t) physical * fs->block_size], &fs->storage[(uint64_t) old_physical * fs->block_size],
+         size);
+  image_sync(fs->image, (uint64_t) physical * fs->block_size, size);
+  extent_map_remap(&file->fd->extents, block, physical, num_blocks, &old_physical);
+  if (fs->cache) {
+    block_cache_invalidate(fs->cache, old_physical, num_blocks);
+  }
+  array_list_push(freed, old_physical);
+  array_list_push(freed, num_blocks);
+  fs_inode_dirty(fs, file);
+  fs_journal(ctx, JOURNAL_MOVE, file->fd->id, block, physical, num_blocks, NULL, 0);
+}
+
+// whether a snapshot holds any block of logical [block, end), which is mapped throughout
+static bool fs_file_shared(filesystem_t *fs, file_t *file, uint32_t block, uint64_t end) {
+  if (!fs->blocks->held) {
+    return false;
+  }
+  uint32_t physical;
+  uint32_t run;
+  for (uint64_t at = block; at < end; at += run) {
+    extent_map_lookup(&file->fd->extents, (uint32_t) at, &physical, &run);
+    if (run > end - at) {
+      run = (uint32_t) (end - at);
+    }
+    bool held;
+    if (block_allocator_held_run(fs->blocks, physical, run, &held) < run || held) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// extents back to back logically are apart physically, or they would be one; such a chain is gathered into
+// the lowest run which holds it, a chain of one extent or one too long for a group only moves down;
+// chains sharing blocks with a snapshot stay, moving them would copy what the snapshot keeps anyway
+static void fs_file_compact(fs_ctx_t *ctx, file_t *file, array_list_t *freed, fs_compact_result_t *result) {
+  filesystem_t *fs = ctx->fs;
+  tree_t *extents = &file->fd->extents.tree;
+  tree_node_t *tree_node = tree_find_ceil_node(extents->ptr, 0);
+  while (tree_node) {
+    uint32_t block = (uint32_t) tree_node->value;
+    uint64_t end = block;
+    uint32_t count = 0;
+    for (; tree_node && tree_node->value == end; tree_node = tree_find_ceil_node(extents->ptr, end)) {
+      end += tree_node->num_reserved_bits;
+      count++;
+    }
+    if (fs_file_shared(fs, file, block, end)) {
+      tree_node = tree_find_ceil_node(extents->ptr, end);
+      continue;
+    }
+    uint32_t length = (uint32_t) (end - block);
+    int64_t start = count > 1 && length <= fs->blocks->group_blocks
+                        ? block_allocator_alloc_low(fs->blocks, length, UINT32_MAX) : -1;
+    uint32_t physical;
+    uint32_t run;
+    for (uint64_t at = block; at < end; at += run) {
+      extent_map_lookup(&file->fd->extents, (uint32_t) at, &physical, &run);
+      if (run > end - at) {
+        run = (uint32_t) (end - at);
+      }
+      int64_t target = start != -1 ? start + (int64_t) (at - block) : block_allocator_alloc_low(fs->blocks, run, physical);
+      if (target != -1) {
+        fs_file_move(ctx, file, (uint32_t) at, (uint32_t) target, run, freed);
+        result->extents_moved++;
+        result->blocks_moved += run;
+      }
+    }
+    tree_node = tree_find_ceil_node(extents->ptr, end);
+  }
+}
+
+int fs_compact(fs_ctx_t *ctx, uint32_t budget_us, fs_compact_result_t *result) {
+  FS_STATS_BEGIN(ctx, FS_OP_COMPACT);
+  FS_READ_LOCK(ctx);
+  fs_compact_result_t discard;
+  if (!result) {
+    result = &discard;
+  }
+  memset(result, 0, sizeof(fs_compact_result_t));
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  filesystem_t *fs = ctx->fs;
+  array_list_t *freed = array_list_new();
+  uint64_t deadline = fs_clock_ns() + (uint64_t) budget_us * 1000;
+  // at least one file per call, so that a tiny budget still makes progress
+  do {
+    size_t id = __atomic_fetch_add(&fs->compact_cursor, 1, __ATOMIC_RELAXED);
+    if (id >= fs->next_fd_id) {
+      __atomic_store_n(&fs->compact_cursor, FS_FIRST_FILE_ID, __ATOMIC_RELAXED);
+      result->wrapped = true;
+      break;
+    }
+    file_t *file = fs_inode_get(fs, id);
+    // a file some call is using right now waits for the next pass
+    if (!file || file->fd->type != FS_FILE || pthread_rwlock_trywrlock(&file->fd->lock)) {
+      continue;
+    }
+    result->files++;
+    fs_file_compact(ctx, file, freed, result);
+    pthread_rwlock_unlock(&file->fd->lock);
+  } while (fs_clock_ns() < deadline);
+  // the old runs are reused only once the moves are durable, a crash must not find them overwritten
+  if (freed->size) {
+    journal_sync(fs->journal);
+  }
+  for (uint32_t i = 0; i < freed->size; i += 2) {
+    block_allocator_release(fs->blocks, freed->array[i], freed->array[i + 1]);
+  }
+  array_list_free(freed);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_snapshot(fs_ctx_t *ctx, const char *name) {
+  FS_STATS_BEGIN(ctx, FS_OP_SNAPSHOT);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  filesystem_t *fs = ctx->fs;
+  if (!name || !*name || strlen(name) >= IMAGE_SNAPSHOT_NAME_SIZE) {
+    FS_PRINT(ctx, "Snapshot names have 1 to %d characters\n", IMAGE_SNAPSHOT_NAME_SIZE - 1);
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (snapshot_table_find(fs->snapshots, name) != -1) {
+    FS_PRINT(ctx, "Snapshot already exists\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (fs->snapshots->count == IMAGE_MAX_SNAPSHOTS) {
+    FS_PRINT(ctx, "Too many snapshots, %d at most\n", IMAGE_MAX_SNAPSHOTS);
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  // the first checkpoint writes the tree out, its slots and used blocks are then the snapshot's;
+  // the second one makes the snapshot durable
+  if (fs->cache) {
+    block_cache_flush_all(fs->cache);
+  }
+  if (!journal_checkpoint(fs->journal, fs_checkpoint_write, fs)) {
+    FS_PRINT(ctx, "No space left to write the metadata\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (!snapshot_table_add(fs->snapshots, name, fs->image->header->journal_epoch, fs->next_fd_id, fs->num_files)) {
+    FS_PRINT(ctx, "No space left for the snapshot\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  if (!journal_checkpoint(fs->journal, fs_checkpoint_write, fs)) {
+    snapshot_table_remove(fs->snapshots, fs->snapshots->count - 1);
+    FS_PRINT(ctx, "No space left to write the metadata\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  FS_PRINT(ctx, "Snapshot %s created\n", name);
+  FS_RETURN(ctx, FS_SUCCESS);
 }
 
-int fs_symlink(char *str, char *path) {
-  FS_ENABLE_EXECUTION()
-  path_parse_t *path_parse = file_path_parse(path);
-  file_t *original_cwd = cwd;
-  if (!try_change_dir(original_cwd, path_parse)) {
-    return FS_FAILURE;
+int fs_snapshot_delete(fs_ctx_t *ctx, const char *name) {
+  FS_STATS_BEGIN(ctx, FS_OP_SNAPSHOT_DELETE);
+  FS_WRITE_LOCK(ctx);
+  FS_ENABLE_EXECUTION(ctx)
+  FS_ENABLE_CHANGES(ctx)
+  filesystem_t *fs = ctx->fs;
+  int index = name ? snapshot_table_find(fs->snapshots, name) : -1;
+  if (index == -1) {
+    FS_PRINT(ctx, "No such snapshot\n");
+    FS_RETURN(ctx, FS_FAILURE);
+  }
+  // the checkpoint frees the blocks only the snapshot held, with the table which no longer lists it
+  snapshot_table_remove(fs->snapshots, (uint32_t) index);
+  if (!journal_checkpoint(fs->journal, fs_checkpoint_write, fs)) {
+    FS_PRINT(ctx, "Snapshot deleted, no space left to write the metadata, it may come back\n");
+    FS_RETURN(ctx, FS_FAILURE);
   }
-  file_t *file = file_new(str, false);
-  file->fd = fs_descriptor_new(FS_SYMLINK, 0);
-  linked_list_push(file->fd->links, cwd);
-  linked_list_push(filesystem->files, (void *) file);
-  cwd = original_cwd;
+  FS_PRINT(ctx, "Snapshot %s deleted\n", name);
+  FS_RETURN(ctx, FS_SUCCESS);
+}
+
+int fs_stats_snapshot(fs_stats_t *stats) {
+#ifdef FS_STATS
+  fs_stats_collect(stats);
   return FS_SUCCESS;
+#else
+  memset(stats, 0, sizeof(fs_stats_t));
+  return FS_FAILURE;
+#endif
 }
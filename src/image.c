@@ -0,0 +1,160 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+
+static uint64_t image_page_size() {
+  static uint64_t page_size;
+  if (!page_size) {
+    page_size = (uint64_t) sysconf(_SC_PAGESIZE);
+  }
+  return page_size;
+}
+
+// widens [offset, offset + length) of the file to whole pages of the mapping
+static void image_page_range(image_t *image, uint64_t offset, uint64_t length,
+                             unsigned char **start, size_t *size) {
+  uint64_t page_size = image_page_size();
+  uint64_t begin = offset;
+  uint64_t end = begin + length;
+  if (end > image->size) {
+    end = image->size;
+  }
+  begin &= ~(page_size - 1);
+  *start = image->base + begin;
+  *size = end > begin ? (size_t) (end - begin) : 0;
+}
+
+inline static uint64_t image_align(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+bool image_create(const char *path, image_header_t *header) {
+  uint64_t block_size = header->block_size;
+  // both journal halves start on a page so that they sync independently
+  uint64_t alignment = block_size > image_page_size() ? block_size : image_page_size();
+  header->magic = IMAGE_MAGIC;
+  header->version = IMAGE_VERSION;
+  header->journal_offset = image_align(IMAGE_HEADER_SIZE, alignment);
+  header->journal_size = image_align(header->journal_size, 2 * alignment);
+  header->journal_epoch = 1;
+  header->journal_active = 0;
+  header->tables_active = 0;
+  header->inode_table_offset = header->journal_offset + header->journal_size;
+  header->inode_map_offset = header->inode_table_offset +
+                             image_align(header->num_inodes * 2 * sizeof(image_inode_t), alignment);
+  header->inode_map_size = image_align((header->num_inodes + 7) / 8, alignment);
+  header->bitmap_offset = header->inode_map_offset + 2 * header->inode_map_size;
+  if (header->image_size <= header->bitmap_offset) {
+    return false;
+  }
+  // sized for every block past the bitmaps, the data region ends up a little smaller
+  uint64_t max_blocks = (header->image_size - header->bitmap_offset) / block_size;
+  header->bitmap_size = image_align((max_blocks + 63) / 64 * sizeof(uint64_t), alignment);
+  header->snapshot_offset = header->bitmap_offset + 2 * header->bitmap_size;
+  header->snapshot_size = image_align(IMAGE_MAX_SNAPSHOTS * sizeof(image_snapshot_t), alignment);
+  header->kept_offset = header->snapshot_offset + 2 * header->snapshot_size;
+  header->data_offset = header->kept_offset + 2 * header->bitmap_size;
+  header->next_id = 0;
+  header->num_files = 0;
+  header->num_snapshots = 0;
+  if (header->image_size <= header->data_offset) {
+    return false;
+  }
+  header->num_blocks = (header->image_size - header->data_offset) / block_size;
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  // ftruncate leaves the file sparse, blocks get allocated on first write,
+  // a journal of zeros holds no records and tables of zeros no inodes
+  bool created = ftruncate(fd, (off_t) header->image_size) == 0 &&
+                 pwrite(fd, header, sizeof(image_header_t), 0) == sizeof(image_header_t) &&
+                 fsync(fd) == 0;
+  close(fd);
+  return created;
+}
+
+image_t *image_open(const char *path) {
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    return NULL;
+  }
+  image_header_t header;
+  struct stat st;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) == -1 ||
+      header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION ||
+      header.image_size != (uint64_t) st.st_size || header.journal_offset < IMAGE_HEADER_SIZE ||
+      header.journal_offset + header.journal_size > header.inode_table_offset || header.journal_active > 1 ||
+      header.tables_active > 1 ||
+      header.inode_table_offset + header.num_inodes * 2 * sizeof(image_inode_t) > header.inode_map_offset ||
+      header.inode_map_offset + 2 * header.inode_map_size > header.bitmap_offset ||
+      header.inode_map_size * 8 < header.num_inodes ||
+      header.bitmap_offset + 2 * header.bitmap_size > header.snapshot_offset ||
+      header.snapshot_offset + 2 * header.snapshot_size > header.kept_offset ||
+      header.snapshot_size < IMAGE_MAX_SNAPSHOTS * sizeof(image_snapshot_t) ||
+      header.kept_offset + 2 * header.bitmap_size > header.data_offset || header.num_snapshots > IMAGE_MAX_SNAPSHOTS ||
+      header.bitmap_size * 8 < header.num_blocks || !header.block_size ||
+      header.data_offset + header.num_blocks * header.block_size > header.image_size) {
+    close(fd);
+    return NULL;
+  }
+  // nothing is read here, so mounting costs the same for any image size
+  void *base = mmap(NULL, header.image_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  image_t *image = malloc(sizeof(image_t));
+  image->fd = fd;
+  image->base = base;
+  image->size = header.image_size;
+  image->header = (image_header_t *) base;
+  image->data = image->base + header.data_offset;
+  return image;
+}
+
+void image_close(image_t *image) {
+  if (!image) {
+    return;
+  }
+  image_sync_all(image);
+  munmap(image->base, image->size);
+  close(image->fd);
+  free(image);
+}
+
+void image_advise(image_t *image, uint64_t offset, uint64_t length, image_advice_t advice) {
+  unsigned char *start;
+  size_t size;
+  image_page_range(image, image->header->data_offset + offset, length, &start, &size);
+  if (!size) {
+    return;
+  }
+  int flags = MADV_NORMAL;
+  if (advice == IMAGE_ADVICE_SEQUENTIAL) {
+    flags = MADV_SEQUENTIAL;
+  } else if (advice == IMAGE_ADVICE_RANDOM) {
+    flags = MADV_RANDOM;
+  }
+  madvise(start, size, flags);
+}
+
+bool image_sync(image_t *image, uint64_t offset, uint64_t length) {
+  return image_sync_range(image, image->header->data_offset + offset, length);
+}
+
+bool image_sync_range(image_t *image, uint64_t offset, uint64_t length) {
+  unsigned char *start;
+  size_t size;
+  image_page_range(image, offset, length, &start, &size);
+  return !size || msync(start, size, MS_SYNC) == 0;
+}
+
+bool image_sync_all(image_t *image) {
+  return msync(image->base, image->size, MS_SYNC) == 0;
+}
@@ -0,0 +1,163 @@
+#include <string.h>
+
+#include "inode_table.h"
+
+inline static unsigned char *inode_table_map(image_t *image, uint32_t copy) {
+  return image->base + image->header->inode_map_offset + copy * image->header->inode_map_size;
+}
+
+inline static image_inode_t *inode_table_slot(image_t *image, uint64_t id, uint32_t slot) {
+  return (image_inode_t *) (image->base + image->header->inode_table_offset) + id * 2 + slot;
+}
+
+inline static uint32_t inode_table_bit(const unsigned char *map, uint64_t id) {
+  return (map[id / 8] >> (id % 8)) & 1;
+}
+
+inline static image_blob_t *inode_blob(image_t *image, uint32_t block) {
+  return (image_blob_t *) (image->data + (uint64_t) block * image->header->block_size);
+}
+
+image_inode_t *inode_table_current(image_t *image, uint64_t id) {
+  return inode_table_slot(image, id, inode_table_bit(inode_table_map(image, image->header->tables_active), id));
+}
+
+void inode_table_begin(image_t *image) {
+  uint32_t active = image->header->tables_active;
+  memcpy(inode_table_map(image, active ^ 1), inode_table_map(image, active), (image->header->num_inodes + 7) / 8);
+}
+
+image_inode_t *inode_table_next(image_t *image, uint64_t id) {
+  uint32_t active = image->header->tables_active;
+  uint32_t current = inode_table_bit(inode_table_map(image, active), id);
+  unsigned char *next = inode_table_map(image, active ^ 1);
+  if (inode_table_bit(next, id) != current) {
+    return NULL;
+  }
+  next[id / 8] ^= (unsigned char) (1u << (id % 8));
+  return inode_table_slot(image, id, current ^ 1);
+}
+
+uint64_t *inode_table_next_bitmap(image_t *image) {
+  image_header_t *header = image->header;
+  return (uint64_t *) (image->base + header->bitmap_offset + (header->tables_active ^ 1) * header->bitmap_size);
+}
+
+const uint64_t *inode_table_current_bitmap(image_t *image) {
+  image_header_t *header = image->header;
+  return (const uint64_t *) (image->base + header->bitmap_offset + header->tables_active * header->bitmap_size);
+}
+
+void inode_blob_reader_init(inode_blob_reader_t *reader, image_t *image, uint32_t block) {
+  reader->image = image;
+  reader->block = block;
+  reader->position = 0;
+}
+
+bool inode_blob_read(inode_blob_reader_t *reader, void *buffer, size_t length) {
+  image_header_t *header = reader->image->header;
+  uint32_t capacity = header->block_size - (uint32_t) sizeof(image_blob_t);
+  unsigned char *out = (unsigned char *) buffer;
+  while (length) {
+    if (reader->block >= header->num_blocks) {
+      return false;
+    }
+    image_blob_t *blob = inode_blob(reader->image, reader->block);
+    if (blob->length > capacity) {
+      return false;
+    }
+    if (reader->position == blob->length) {
+      reader->block = blob->next;
+      reader->position = 0;
+      continue;
+    }
+    uint32_t chunk = blob->length - reader->position;
+    if (chunk > length) {
+      chunk = (uint32_t) length;
+    }
+    memcpy(out, (unsigned char *) (blob + 1) + reader->position, chunk);
+    reader->position += chunk;
+    out += chunk;
+    length -= chunk;
+  }
+  return true;
+}
+
+void inode_blob_writer_init(inode_blob_writer_t *writer, image_t *image, block_allocator_t *blocks, uint32_t group) {
+  writer->image = image;
+  writer->blocks = blocks;
+  writer->group = group;
+  writer->first = IMAGE_NO_BLOCK;
+  writer->block = IMAGE_NO_BLOCK;
+  writer->kept = false;
+}
+
+void inode_blob_writer_resume(inode_blob_writer_t *writer, uint32_t first, uint32_t last, uint32_t length) {
+  image_blob_t *blob = inode_blob(writer->image, last);
+  blob->next = IMAGE_NO_BLOCK;
+  blob->length = length;
+  writer->first = first;
+  writer->block = last;
+}
+
+uint32_t inode_blob_writer_tail(const inode_blob_writer_t *writer) {
+  return writer->block == IMAGE_NO_BLOCK ? 0 : inode_blob(writer->image, writer->block)->length;
+}
+
+bool inode_blob_write(inode_blob_writer_t *writer, const void *data, size_t length) {
+  image_t *image = writer->image;
+  uint32_t capacity = image->header->block_size - (uint32_t) sizeof(image_blob_t);
+  const unsigned char *in = (const unsigned char *) data;
+  while (length) {
+    image_blob_t *blob = writer->block == IMAGE_NO_BLOCK ? NULL : inode_blob(image, writer->block);
+    if (!blob || blob->length == capacity) {
+      int64_t next = -1;
+      if (blob && writer->block + 1 < image->header->num_blocks &&
+          block_allocator_extend(writer->blocks, writer->block + 1, 1)) {
+        next = writer->block + 1;
+      } else {
+        next = block_allocator_alloc(writer->blocks, writer->group, 1);
+      }
+      if (next == -1) {
+        return false;
+      }
+      if (writer->kept) {
+        block_allocator_keep(writer->blocks, (uint32_t) next, 1);
+      }
+      image_blob_t *next_blob = inode_blob(image, (uint32_t) next);
+      next_blob->next = IMAGE_NO_BLOCK;
+      next_blob->length = 0;
+      if (blob) {
+        blob->next = (uint32_t) next;
+      } else {
+        writer->first = (uint32_t) next;
+      }
+      writer->block = (uint32_t) next;
+      continue;
+    }
+    uint32_t chunk = capacity - blob->length;
+    if (chunk > length) {
+      chunk = (uint32_t) length;
+    }
+    memcpy((unsigned char *) (blob + 1) + blob->length, in, chunk);
+    blob->length += chunk;
+    in += chunk;
+    length -= chunk;
+  }
+  return true;
+}
+
+void inode_blob_release(image_t *image, block_allocator_t *blocks, uint32_t block) {
+  while (block < image->header->num_blocks) {
+    uint32_t next = inode_blob(image, block)->next;
+    block_allocator_release(blocks, block, 1);
+    block = next;
+  }
+}
+
+void inode_blob_truncate(image_t *image, block_allocator_t *blocks, uint32_t block, uint32_t length) {
+  image_blob_t *blob = inode_blob(image, block);
+  inode_blob_release(image, blocks, blob->next);
+  blob->next = IMAGE_NO_BLOCK;
+  blob->length = length;
+}
@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "journal.h"
+
+#define JOURNAL_IDLE_WAKEUP_US 100000 // how often the commit thread looks around without an interval
+
+inline static uint64_t journal_record_size(size_t name_length) {
+  return (sizeof(journal_record_t) + name_length + 7) & ~7ull;
+}
+
+inline static uint64_t journal_half_offset(journal_t *journal, uint32_t half) {
+  return journal->image->header->journal_offset + half * journal->half_size;
+}
+
+inline static unsigned char *journal_half(journal_t *journal) {
+  return journal->image->base + journal_half_offset(journal, journal->active);
+}
+
+// FNV-1a over the record after its checksum field and the name
+static uint32_t journal_checksum(const journal_record_t *record, const char *name) {
+  uint32_t hash = 2166136261u;
+  const unsigned char *bytes = (const unsigned char *) &record->prev_checksum;
+  for (size_t i = 0; i < sizeof(journal_record_t) - offsetof(journal_record_t, prev_checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  for (size_t i = 0; i < record->name_length; i++) {
+    hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+inline static bool journal_wants_checkpoint(journal_t *journal) {
+  return journal->overflow || journal->head * 100 > journal->half_size * JOURNAL_CHECKPOINT_PERCENT;
+}
+
+// syncs the log up to lsn, one caller syncs for everyone waiting, called with the lock held
+static void journal_flush_locked(journal_t *journal, uint64_t lsn) {
+  if (lsn >= journal->next_lsn) {
+    lsn = journal->next_lsn - 1;
+  }
+  while (journal->attached && journal->durable_lsn < lsn) {
+    if (journal->flushing) {
+      pthread_cond_wait(&journal->flushed, &journal->lock);
+      continue;
+    }
+    journal->flushing = true;
+    uint64_t offset = journal_half_offset(journal, journal->active) + journal->committed;
+    uint64_t head = journal->head;
+    uint64_t last = journal->next_lsn - 1;
+    uint64_t length = head - journal->committed;
+    pthread_mutex_unlock(&journal->lock);
+    image_sync_range(journal->image, offset, length);
+    pthread_mutex_lock(&journal->lock);
+    journal->committed = head;
+    journal->durable_lsn = last;
+    journal->flushing = false;
+    journal->stats.commits++;
+    pthread_cond_broadcast(&journal->flushed);
+  }
+}
+
+static void *journal_run(void *arg) {
+  journal_t *journal = (journal_t *) arg;
+  pthread_mutex_lock(&journal->lock);
+  while (!journal->stop) {
+    uint32_t interval = journal->commit_interval_us ? journal->commit_interval_us : JOURNAL_IDLE_WAKEUP_US;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t nsec = (uint64_t) deadline.tv_nsec + (uint64_t) interval * 1000;
+    deadline.tv_sec += (time_t) (nsec / 1000000000);
+    deadline.tv_nsec = (long) (nsec % 1000000000);
+    pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline);
+    if (journal->stop) {
+      break;
+    }
+    if (journal->head > journal->committed) {
+      journal_flush_locked(journal, journal->next_lsn - 1);
+    }
+    if (journal->request && journal_wants_checkpoint(journal)) {
+      pthread_mutex_unlock(&journal->lock);
+      journal->request(journal->request_arg);
+      pthread_mutex_lock(&journal->lock);
+    }
+  }
+  pthread_mutex_unlock(&journal->lock);
+  return NULL;
+}
+
+journal_t *journal_new() {
+  journal_t *journal = calloc(1, sizeof(journal_t));
+  pthread_mutex_init(&journal->lock, NULL);
+  pthread_cond_init(&journal->flushed, NULL);
+  pthread_cond_init(&journal->wake, NULL);
+  journal->next_lsn = 1;
+  return journal;
+}
+
+void journal_free(journal_t *journal) {
+  if (!journal) return;
+  journal_detach(journal);
+  pthread_cond_destroy(&journal->wake);
+  pthread_cond_destroy(&journal->flushed);
+  pthread_mutex_destroy(&journal->lock);
+  free(journal);
+}
+
+void journal_attach(journal_t *journal, image_t *image, journal_apply_t apply, void *apply_arg) {
+  pthread_mutex_lock(&journal->lock);
+  journal->image = image;
+  journal->half_size = image->header->journal_size / 2;
+  journal->active = image->header->journal_active;
+  journal->epoch = image->header->journal_epoch;
+  journal->overflow = false;
+  memset(&journal->stats, 0, sizeof(journal_stats_t));
+
+  // the log ends at the first record that is torn, from an older epoch or out of sequence
+  unsigned char *half = journal_half(journal);
+  uint64_t position = 0;
+  uint32_t prev_checksum = 0;
+  uint64_t next_lsn = 0;
+  while (position + sizeof(journal_record_t) <= journal->half_size) {
+    const journal_record_t *record = (const journal_record_t *) (half + position);
+    uint64_t size = journal_record_size(record->name_length);
+    const char *name = (const char *) (record + 1);
+    if (record->magic != JOURNAL_RECORD_MAGIC || record->epoch != journal->epoch ||
+        record->prev_checksum != prev_checksum || (next_lsn && record->lsn != next_lsn) ||
+        position + size > journal->half_size || journal_checksum(record, name) != record->checksum) {
+      break;
+    }
+    apply(apply_arg, record, name);
+    journal->stats.replayed++;
+    prev_checksum = record->checksum;
+    next_lsn = record->lsn + 1;
+    position += size;
+  }
+  journal->head = position;
+  journal->committed = position;
+  journal->prev_checksum = prev_checksum;
+  if (next_lsn > journal->next_lsn) {
+    journal->next_lsn = next_lsn;
+  }
+  journal->durable_lsn = journal->next_lsn - 1;
+  journal->generation++;
+  journal->attached = true;
+  pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_start(journal_t *journal, journal_request_t request, void *request_arg) {
+  pthread_mutex_lock(&journal->lock);
+  journal->request = request;
+  journal->request_arg = request_arg;
+  journal->stop = false;
+  pthread_mutex_unlock(&journal->lock);
+  pthread_create(&journal->thread, NULL, journal_run, journal);
+}
+
+void journal_detach(journal_t *journal) {
+  pthread_mutex_lock(&journal->lock);
+  if (!journal->attached) {
+    pthread_mutex_unlock(&journal->lock);
+    return;
+  }
+  bool started = journal->request != NULL;
+  journal->stop = true;
+  pthread_cond_signal(&journal->wake);
+  pthread_mutex_unlock(&journal->lock);
+  if (started) {
+    pthread_join(journal->thread, NULL);
+  }
+  pthread_mutex_lock(&journal->lock);
+  journal_flush_locked(journal, journal->next_lsn - 1);
+  journal->attached = false;
+  journal->request = NULL;
+  journal->image = NULL;
+  pthread_cond_broadcast(&journal->flushed);
+  pthread_mutex_unlock(&journal->lock);
+}
+
+bool journal_stopping(journal_t *journal) {
+  pthread_mutex_lock(&journal->lock);
+  bool stop = journal->stop;
+  pthread_mutex_unlock(&journal->lock);
+  return stop;
+}
+
+void journal_set_commit_interval(journal_t *journal, uint32_t commit_interval_us) {
+  pthread_mutex_lock(&journal->lock);
+  journal->commit_interval_us = commit_interval_us;
+  pthread_cond_signal(&journal->wake);
+  pthread_mutex_unlock(&journal->lock);
+}
+
+uint64_t journal_append(journal_t *journal, journal_type_t type, uint64_t arg0, uint64_t arg1, uint64_t arg2,
+                        uint64_t arg3, const char *name, size_t name_length) {
+  uint64_t size = journal_record_size(name_length);
+  pthread_mutex_lock(&journal->lock);
+  if (!journal->attached) {
+    pthread_mutex_unlock(&journal->lock);
+    return 0;
+  }
+  if (journal->head + size > journal->half_size) {
+    journal->overflow = true;
+    journal->stats.dropped++;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+    return 0;
+  }
+  // the record goes straight into the mapped log, it becomes durable with the next commit
+  journal_record_t *record = (journal_record_t *) (journal_half(journal) + journal->head);
+  record->magic = JOURNAL_RECORD_MAGIC;
+  record->prev_checksum = journal->prev_checksum;
+  record->type = (uint16_t) type;
+  record->name_length = (uint16_t) name_length;
+  record->epoch = journal->epoch;
+  record->lsn = journal->next_lsn++;
+  record->args[0] = arg0;
+  record->args[1] = arg1;
+  record->args[2] = arg2;
+  record->args[3] = arg3;
+  if (name_length) {
+    memcpy(record + 1, name, name_length);
+  }
+  record->checksum = journal_checksum(record, name);
+  journal->prev_checksum = record->checksum;
+  journal->head += size;
+  journal->stats.records++;
+  journal->stats.bytes += size;
+  uint64_t lsn = record->lsn;
+  if (journal_wants_checkpoint(journal)) {
+    pthread_cond_signal(&journal->wake);
+  }
+  pthread_mutex_unlock(&journal->lock);
+  return lsn;
+}
+
+void journal_commit(journal_t *journal, uint64_t lsn, uint64_t generation) {
+  pthread_mutex_lock(&journal->lock);
+  if (!journal->commit_interval_us && generation == journal->generation) {
+    journal_flush_locked(journal, lsn);
+  }
+  pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_sync(journal_t *journal) {
+  pthread_mutex_lock(&journal->lock);
+  journal_flush_locked(journal, journal->next_lsn - 1);
+  pthread_mutex_unlock(&journal->lock);
+}
+
+bool journal_needs_checkpoint(journal_t *journal) {
+  pthread_mutex_lock(&journal->lock);
+  bool needed = journal->attached && journal_wants_checkpoint(journal);
+  pthread_mutex_unlock(&journal->lock);
+  return needed;
+}
+
+bool journal_checkpoint(journal_t *journal, journal_snapshot_t snapshot, void *arg) {
+  pthread_mutex_lock(&journal->lock);
+  if (!journal->attached) {
+    pthread_mutex_unlock(&journal->lock);
+    return false;
+  }
+  image_t *image = journal->image;
+  image_header_t header = *image->header;
+  pthread_mutex_unlock(&journal->lock);
+
+  if (!snapshot(arg, &header)) {
+    return false;
+  }
+
+  pthread_mutex_lock(&journal->lock);
+  while (journal->flushing) {
+    pthread_cond_wait(&journal->flushed, &journal->lock);
+  }
+  journal->active ^= 1;
+  journal->epoch++;
+  journal->head = 0;
+  journal->committed = 0;
+  journal->prev_checksum = 0;
+  journal->overflow = false;
+  // the switch is a single sector write, a crash before it leaves the previous tables and half in charge
+  header.journal_epoch = journal->epoch;
+  header.journal_active = journal->active;
+  *image->header = header;
+  image_sync_range(image, 0, sizeof(image_header_t));
+  journal->durable_lsn = journal->next_lsn - 1;
+  journal->stats.checkpoints++;
+  pthread_cond_broadcast(&journal->flushed);
+  pthread_mutex_unlock(&journal->lock);
+  return true;
+}
+
+void journal_stats(journal_t *journal, journal_stats_t *stats) {
+  pthread_mutex_lock(&journal->lock);
+  *stats = journal->stats;
+  pthread_mutex_unlock(&journal->lock);
+}
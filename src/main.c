@@ -1,5 +1,5 @@
 #include "command_line_parser.h"
 
-int main() {
-  command_line_run();
+int main(int argc, char **argv) {
+  command_line_run(argc, argv);
 }
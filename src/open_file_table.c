@@ -0,0 +1,102 @@
+#include <stdlib.h>
+
+#include "open_file_table.h"
+#include "bit_utils.h"
+
+#define OPEN_FILE_TABLE_DEFAULT_CAPACITY 16
+#define OPEN_FILE_GENERATION_MASK ((1u << OPEN_FILE_GENERATION_BITS) - 1)
+
+#define OPEN_FILE_CREATE_FD(slot, generation) \
+  ((int) (((generation) << OPEN_FILE_SLOT_BITS) | (slot)))
+
+inline static uint32_t open_file_extract_slot(int fd) {
+  return extract_bit_range((uint32_t) fd, OPEN_FILE_SLOT_BITS - 1, 0);
+}
+
+inline static uint32_t open_file_extract_generation(int fd) {
+  return extract_bit_range((uint32_t) fd, OPEN_FILE_SLOT_BITS + OPEN_FILE_GENERATION_BITS - 1, OPEN_FILE_SLOT_BITS);
+}
+
+static bool open_file_table_grow(open_file_table_t *table) {
+  if (table->capacity == OPEN_FILE_MAX_SLOTS) {
+    return false;
+  }
+  uint32_t capacity = table->capacity ? table->capacity * 2 : OPEN_FILE_TABLE_DEFAULT_CAPACITY;
+  if (capacity > OPEN_FILE_MAX_SLOTS) {
+    capacity = OPEN_FILE_MAX_SLOTS;
+  }
+  open_file_t *slots = realloc(table->slots, capacity * sizeof(open_file_t));
+  if (!slots) {
+    return false;
+  }
+  // new slots are chained in order in front of the (empty) free list
+  for (uint32_t i = table->capacity; i < capacity; i++) {
+    slots[i].file = NULL;
+    slots[i].generation = 0;
+    slots[i].next_free = i + 1 < capacity ? (int32_t) (i + 1) : table->free_head;
+  }
+  table->free_head = (int32_t) table->capacity;
+  table->slots = slots;
+  table->capacity = capacity;
+  return true;
+}
+
+open_file_table_t *open_file_table_new() {
+  open_file_table_t *table = malloc(sizeof(open_file_table_t));
+  table->slots = NULL;
+  table->capacity = 0;
+  table->count = 0;
+  table->free_head = -1;
+  return table;
+}
+
+void open_file_table_free(open_file_table_t *table) {
+  if (!table) return;
+  free(table->slots);
+  free(table);
+}
+
+int open_file_table_open(open_file_table_t *table, file_t *file, uint32_t flags) {
+  if (table->free_head < 0 && !open_file_table_grow(table)) {
+    return -1;
+  }
+  uint32_t slot = (uint32_t) table->free_head;
+  open_file_t *open_file = &table->slots[slot];
+  table->free_head = open_file->next_free;
+  open_file->file = file;
+  open_file->offset = 0;
+  open_file->flags = flags;
+  open_file->next_free = -1;
+  table->count++;
+  file->open_count++;
+  return OPEN_FILE_CREATE_FD(slot, open_file->generation);
+}
+
+open_file_t *open_file_table_get(open_file_table_t *table, int fd) {
+  if (fd < 0) {
+    return NULL;
+  }
+  uint32_t slot = open_file_extract_slot(fd);
+  if (slot >= table->capacity) {
+    return NULL;
+  }
+  open_file_t *open_file = &table->slots[slot];
+  if (!open_file->file || open_file->generation != open_file_extract_generation(fd)) {
+    return NULL;
+  }
+  return open_file;
+}
+
+bool open_file_table_close(open_file_table_t *table, int fd) {
+  open_file_t *open_file = open_file_table_get(table, fd);
+  if (!open_file) {
+    return false;
+  }
+  open_file->file->open_count--;
+  open_file->file = NULL;
+  open_file->generation = (open_file->generation + 1) & OPEN_FILE_GENERATION_MASK;
+  open_file->next_free = table->free_head;
+  table->free_head = (int32_t) open_file_extract_slot(fd);
+  table->count--;
+  return true;
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+
+#include "slab.h"
+
+#define SLAB_ALIGN sizeof(void *)
+#define SLAB_LINE_SIZE 64 // slabs start on a cache line
+#define SLAB_HEADER_SIZE SLAB_LINE_SIZE // the link to the previous slab, the first object starts a line
+
+void slab_pool_init(slab_pool_t *pool, size_t object_size, bool shared) {
+  if (object_size < sizeof(void *)) {
+    object_size = sizeof(void *);
+  }
+  pool->object_size = (object_size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+  pool->free_list = NULL;
+  pool->next = NULL;
+  pool->end = NULL;
+  pool->slabs = NULL;
+  pool->num_slabs = 0;
+  pool->num_objects = 0;
+  pool->shared = shared;
+  if (shared) {
+    pthread_mutex_init(&pool->lock, NULL);
+  }
+}
+
+void slab_pool_destroy(slab_pool_t *pool) {
+  void *slab = pool->slabs;
+  while (slab) {
+    void *previous = *(void **) slab;
+    free(slab);
+    slab = previous;
+  }
+  if (pool->shared) {
+    pthread_mutex_destroy(&pool->lock);
+  }
+  pool->slabs = NULL;
+  pool->free_list = NULL;
+  pool->next = NULL;
+  pool->end = NULL;
+  pool->num_slabs = 0;
+  pool->num_objects = 0;
+}
+
+// starts a new slab, objects bigger than a slab get one of their own
+static bool slab_pool_grow(slab_pool_t *pool) {
+  size_t size = SLAB_HEADER_SIZE + pool->object_size > SLAB_SIZE ? SLAB_HEADER_SIZE + pool->object_size : SLAB_SIZE;
+  unsigned char *slab = NULL;
+  if (posix_memalign((void **) &slab, SLAB_LINE_SIZE, size)) {
+    return false;
+  }
+  *(void **) slab = pool->slabs;
+  pool->slabs = slab;
+  pool->num_slabs++;
+  pool->next = slab + SLAB_HEADER_SIZE;
+  pool->end = slab + size;
+  return true;
+}
+
+void *slab_pool_alloc(slab_pool_t *pool) {
+  if (pool->shared) {
+    pthread_mutex_lock(&pool->lock);
+  }
+  void *object = pool->free_list;
+  if (object) {
+    pool->free_list = *(void **) object;
+  } else if ((size_t) (pool->end - pool->next) >= pool->object_size || slab_pool_grow(pool)) {
+    object = pool->next;
+    pool->next += pool->object_size;
+  }
+  if (object) {
+    pool->num_objects++;
+  }
+  if (pool->shared) {
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return object;
+}
+
+void slab_pool_release(slab_pool_t *pool, void *object) {
+  if (!object) return;
+  if (pool->shared) {
+    pthread_mutex_lock(&pool->lock);
+  }
+  *(void **) object = pool->free_list;
+  pool->free_list = object;
+  pool->num_objects--;
+  if (pool->shared) {
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "inode_table.h"
+#include "bit_utils.h"
+
+inline static image_snapshot_t *snapshot_table_copy(image_t *image, uint32_t copy) {
+  return (image_snapshot_t *) (image->base + image->header->snapshot_offset + copy * image->header->snapshot_size);
+}
+
+inline static uint64_t *snapshot_kept_copy(image_t *image, uint32_t copy) {
+  return (uint64_t *) (image->base + image->header->kept_offset + copy * image->header->bitmap_size);
+}
+
+// ors the snapshot's bitmap into words, false if the blob ends early
+static bool snapshot_bitmap_or(snapshot_table_t *table, const image_snapshot_t *entry, uint64_t *words) {
+  inode_blob_reader_t reader;
+  inode_blob_reader_init(&reader, table->image, entry->bitmap);
+  for (size_t i = 0; i < table->num_words; i++) {
+    uint64_t word;
+    if (!inode_blob_read(&reader, &word, sizeof(word))) {
+      return false;
+    }
+    words[i] |= word;
+  }
+  return true;
+}
+
+// the held bitmap from the snapshots left in the table
+static void snapshot_table_hold(snapshot_table_t *table) {
+  memset(table->held, 0, table->num_words * sizeof(uint64_t));
+  for (uint32_t i = 0; i < table->count; i++) {
+    snapshot_bitmap_or(table, &table->entries[i], table->held);
+  }
+}
+
+// the held and kept bitmaps go with the last snapshot
+static void snapshot_table_drop(snapshot_table_t *table) {
+  block_allocator_share(table->blocks, NULL, NULL);
+  free(table->held);
+  free(table->kept);
+  table->held = NULL;
+  table->kept = NULL;
+}
+
+snapshot_table_t *snapshot_table_new(image_t *image, block_allocator_t *blocks) {
+  image_header_t *header = image->header;
+  snapshot_table_t *table = calloc(1, sizeof(snapshot_table_t));
+  table->image = image;
+  table->blocks = blocks;
+  table->num_words = (header->num_blocks + BITMAP_BITS_PER_WORD - 1) / BITMAP_BITS_PER_WORD;
+  table->count = header->num_snapshots;
+  table->released = array_list_new();
+  table->blobs = array_list_new();
+  memcpy(table->entries, snapshot_table_copy(image, header->tables_active), table->count * sizeof(image_snapshot_t));
+  if (!table->count) {
+    return table;
+  }
+  table->held = calloc(table->num_words, sizeof(uint64_t));
+  table->kept = malloc(table->num_words * sizeof(uint64_t));
+  memcpy(table->kept, snapshot_kept_copy(image, header->tables_active), table->num_words * sizeof(uint64_t));
+  uint32_t capacity = header->block_size - (uint32_t) sizeof(image_blob_t);
+  for (uint32_t i = 0; i < table->count; i++) {
+    image_snapshot_t *entry = &table->entries[i];
+    bool listed = entry->inodes == IMAGE_NO_BLOCK ||
+                  (entry->inodes < header->num_blocks && entry->inodes_last < header->num_blocks &&
+                   entry->inodes_tail <= capacity);
+    if (!listed || !snapshot_bitmap_or(table, entry, table->held)) {
+      snapshot_table_free(table);
+      return NULL;
+    }
+  }
+  block_allocator_share(blocks, table->held, table->kept);
+  return table;
+}
+
+void snapshot_table_free(snapshot_table_t *table) {
+  if (!table) return;
+  if (table->held) {
+    snapshot_table_drop(table);
+  }
+  array_list_free(table->released);
+  array_list_free(table->blobs);
+  free(table);
+}
+
+int snapshot_table_find(const snapshot_table_t *table, const char *name) {
+  for (uint32_t i = 0; i < table->count; i++) {
+    if (!strncmp(table->entries[i].name, name, IMAGE_SNAPSHOT_NAME_SIZE)) {
+      return (int) i;
+    }
+  }
+  return -1;
+}
+
+bool snapshot_table_add(snapshot_table_t *table, const char *name, uint64_t generation, uint64_t next_id,
+                        uint64_t num_files) {
+  if (table->count == IMAGE_MAX_SNAPSHOTS) {
+    return false;
+  }
+  if (!table->held) {
+    table->held = calloc(table->num_words, sizeof(uint64_t));
+    table->kept = calloc(table->num_words, sizeof(uint64_t));
+    block_allocator_share(table->blocks, table->held, table->kept);
+  }
+  // the blocks of other snapshots and their blobs are used too, but not by the tree
+  const uint64_t *used = inode_table_current_bitmap(table->image);
+  uint64_t *bitmap = malloc(table->num_words * sizeof(uint64_t));
+  for (size_t i = 0; i < table->num_words; i++) {
+    bitmap[i] = used[i] & ~table->kept[i];
+  }
+  inode_blob_writer_t writer;
+  inode_blob_writer_init(&writer, table->image, table->blocks, 0);
+  writer.kept = true;
+  if (!inode_blob_write(&writer, bitmap, table->num_words * sizeof(uint64_t))) {
+    inode_blob_release(table->image, table->blocks, writer.first);
+    free(bitmap);
+    if (!table->count) {
+      snapshot_table_drop(table);
+    }
+    return false;
+  }
+  image_snapshot_t *entry = &table->entries[table->count++];
+  memset(entry, 0, sizeof(image_snapshot_t));
+  strncpy(entry->name, name, IMAGE_SNAPSHOT_NAME_SIZE);
+  entry->generation = generation;
+  entry->next_id = next_id;
+  entry->num_files = num_files;
+  entry->inodes = IMAGE_NO_BLOCK;
+  entry->inodes_last = IMAGE_NO_BLOCK;
+  entry->bitmap = writer.first;
+  for (size_t i = 0; i < table->num_words; i++) {
+    table->held[i] |= bitmap[i];
+  }
+  free(bitmap);
+  return true;
+}
+
+void snapshot_table_remove(snapshot_table_t *table, uint32_t index) {
+  image_snapshot_t entry = table->entries[index];
+  table->count--;
+  memmove(&table->entries[index], &table->entries[index + 1], (table->count - index) * sizeof(image_snapshot_t));
+  snapshot_table_hold(table);
+  uint64_t *bitmap = calloc(table->num_words, sizeof(uint64_t));
+  snapshot_bitmap_or(table, &entry, bitmap);
+  // kept blocks of this snapshot alone, gathered into runs
+  uint64_t start = 0;
+  uint64_t length = 0;
+  for (size_t i = 0; i < table->num_words; i++) {
+    uint64_t word = bitmap[i] & table->kept[i] & ~table->held[i];
+    while (word) {
+      uint64_t block = i * BITMAP_BITS_PER_WORD + bit_ctz64(word);
+      word &= word - 1;
+      if (length && start + length == block) {
+        length++;
+        continue;
+      }
+      if (length) {
+        array_list_push(table->released, start);
+        array_list_push(table->released, length);
+      }
+      start = block;
+      length = 1;
+    }
+  }
+  if (length) {
+    array_list_push(table->released, start);
+    array_list_push(table->released, length);
+  }
+  free(bitmap);
+  array_list_push(table->blobs, entry.bitmap);
+  if (entry.inodes != IMAGE_NO_BLOCK) {
+    // a crash may have left blocks chained past the last one, they are free already
+    inode_blob_writer_t writer;
+    inode_blob_writer_init(&writer, table->image, table->blocks, 0);
+    inode_blob_writer_resume(&writer, entry.inodes, entry.inodes_last, entry.inodes_tail);
+    array_list_push(table->blobs, entry.inodes);
+  }
+}
+
+bool snapshot_table_preserve(snapshot_table_t *table, uint64_t id, const image_inode_t *current) {
+  if (!(current->flags & IMAGE_INODE_USED)) {
+    return true;
+  }
+  image_snapshot_inode_t copy = {.id = id, .inode = *current};
+  // newest first, the snapshots taken before the slot was written stop the loop
+  for (uint32_t i = table->count; i-- > 0 && table->entries[i].generation > current->generation;) {
+    image_snapshot_t *entry = &table->entries[i];
+    inode_blob_writer_t writer;
+    inode_blob_writer_init(&writer, table->image, table->blocks, (uint32_t) id);
+    writer.kept = true;
+    if (entry->inodes != IMAGE_NO_BLOCK) {
+      inode_blob_writer_resume(&writer, entry->inodes, entry->inodes_last, entry->inodes_tail);
+    }
+    if (!inode_blob_write(&writer, &copy, sizeof(copy))) {
+      if (entry->inodes == IMAGE_NO_BLOCK) {
+        inode_blob_release(table->image, table->blocks, writer.first);
+      } else {
+        inode_blob_truncate(table->image, table->blocks, entry->inodes_last, entry->inodes_tail);
+      }
+      return false;
+    }
+    entry->inodes = writer.first;
+    entry->inodes_last = writer.block;
+    entry->inodes_tail = inode_blob_writer_tail(&writer);
+    entry->num_inodes++;
+  }
+  return true;
+}
+
+void snapshot_table_release(snapshot_table_t *table) {
+  array_list_t *released = table->released;
+  for (uint32_t i = 0; i < released->size; i += 2) {
+    block_allocator_release(table->blocks, (uint32_t) released->array[i], (uint32_t) released->array[i + 1]);
+  }
+  released->size = 0;
+  for (uint32_t i = 0; i < table->blobs->size; i++) {
+    inode_blob_release(table->image, table->blocks, (uint32_t) table->blobs->array[i]);
+  }
+  table->blobs->size = 0;
+  if (!table->count && table->held) {
+    snapshot_table_drop(table);
+  }
+}
+
+void snapshot_table_save(snapshot_table_t *table) {
+  image_t *image = table->image;
+  uint32_t next = image->header->tables_active ^ 1;
+  memcpy(snapshot_table_copy(image, next), table->entries, table->count * sizeof(image_snapshot_t));
+  // without snapshots the kept copies are never read, their pages stay untouched
+  if (table->kept) {
+    memcpy(snapshot_kept_copy(image, next), table->kept, table->num_words * sizeof(uint64_t));
+  }
+}
+
+static int snapshot_inode_compare(const void *a, const void *b) {
+  uint64_t id_a = ((const image_snapshot_inode_t *) a)->id;
+  uint64_t id_b = ((const image_snapshot_inode_t *) b)->id;
+  return id_a < id_b ? -1 : id_a > id_b;
+}
+
+snapshot_view_t *snapshot_view_new(image_t *image, const image_snapshot_t *entry) {
+  image_header_t *header = image->header;
+  if (entry->num_inodes > header->num_blocks * header->block_size / sizeof(image_snapshot_inode_t)) {
+    return NULL;
+  }
+  snapshot_view_t *view = malloc(sizeof(snapshot_view_t));
+  view->image = image;
+  view->generation = entry->generation;
+  view->num_inodes = entry->num_inodes;
+  view->inodes = malloc((view->num_inodes ? view->num_inodes : 1) * sizeof(image_snapshot_inode_t));
+  inode_blob_reader_t reader;
+  inode_blob_reader_init(&reader, image, entry->inodes);
+  if (!inode_blob_read(&reader, view->inodes, view->num_inodes * sizeof(image_snapshot_inode_t))) {
+    snapshot_view_free(view);
+    return NULL;
+  }
+  qsort(view->inodes, view->num_inodes, sizeof(image_snapshot_inode_t), snapshot_inode_compare);
+  return view;
+}
+
+void snapshot_view_free(snapshot_view_t *view) {
+  if (!view) return;
+  free(view->inodes);
+  free(view);
+}
+
+const image_inode_t *snapshot_view_slot(const snapshot_view_t *view, uint64_t id) {
+  static const image_inode_t free_slot;
+  image_snapshot_inode_t key = {.id = id};
+  const image_snapshot_inode_t *copy =
+      bsearch(&key, view->inodes, view->num_inodes, sizeof(image_snapshot_inode_t), snapshot_inode_compare);
+  if (copy) {
+    return &copy->inode;
+  }
+  // a slot written since belongs to the tree, the snapshot got a copy of what it replaced
+  const image_inode_t *current = inode_table_current(view->image, id);
+  return current->generation < view->generation ? current : &free_slot;
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+#include "bit_utils.h"
+
+static const char *fs_stats_op_names[FS_NUM_OPS] = {
+    [FS_OP_MKFS] = "mkfs",
+    [FS_OP_MOUNT] = "mount",
+    [FS_OP_UNMOUNT] = "unmount",
+    [FS_OP_FSTAT] = "fstat",
+    [FS_OP_LS] = "ls",
+    [FS_OP_CREATE] = "create",
+    [FS_OP_LINK] = "link",
+    [FS_OP_UNLINK] = "unlink",
+    [FS_OP_TRUNCATE] = "truncate",
+    [FS_OP_OPEN] = "open",
+    [FS_OP_CLOSE] = "close",
+    [FS_OP_ADVISE] = "advise",
+    [FS_OP_READ] = "read",
+    [FS_OP_WRITE] = "write",
+    [FS_OP_PREAD] = "pread",
+    [FS_OP_PWRITE] = "pwrite",
+    [FS_OP_READV] = "readv",
+    [FS_OP_WRITEV] = "writev",
+    [FS_OP_READ_VIEW] = "read_view",
+    [FS_OP_CD] = "cd",
+    [FS_OP_MKDIR] = "mkdir",
+    [FS_OP_RMDIR] = "rmdir",
+    [FS_OP_SYMLINK] = "symlink",
+    [FS_OP_DCACHE_STATS] = "dcache_stats",
+    [FS_OP_SYNC] = "sync",
+    [FS_OP_SET_CACHE_BUDGET] = "set_cache_budget",
+    [FS_OP_BCACHE_STATS] = "bcache_stats",
+    [FS_OP_SET_COMMIT_INTERVAL] = "set_commit_interval",
+    [FS_OP_JOURNAL_STATS] = "journal_stats",
+    [FS_OP_FRAG_REPORT] = "frag_report",
+    [FS_OP_COMPACT] = "compact",
+    [FS_OP_SNAPSHOT] = "snapshot",
+    [FS_OP_SNAPSHOT_DELETE] = "snapshot_delete",
+    [FS_OP_MOUNT_SNAPSHOT] = "mount_snapshot",
+};
+
+const char *fs_stats_op_name(fs_op_t op) {
+  return op < FS_NUM_OPS ? fs_stats_op_names[op] : "unknown";
+}
+
+uint64_t fs_stats_percentile(const fs_op_stats_t *op_stats, double percentile) {
+  uint64_t rank = (uint64_t) (percentile * (double) op_stats->calls + 0.999999);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < FS_STATS_BUCKETS; i++) {
+    seen += op_stats->histogram[i];
+    if (seen && seen >= rank) {
+      return i + 1 < FS_STATS_BUCKETS ? 1ULL << (i + 1) : UINT64_MAX;
+    }
+  }
+  return 0;
+}
+
+#ifdef FS_STATS
+
+// a thread's counters outlive it, so that a snapshot still sees what it did
+typedef struct fs_stats_block {
+  fs_stats_t stats;
+  struct fs_stats_block *next;
+} fs_stats_block_t;
+
+__thread fs_stats_t *fs_stats_thread;
+static fs_stats_block_t *fs_stats_blocks;
+static pthread_mutex_t fs_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+fs_stats_t *fs_stats_thread_init() {
+  fs_stats_block_t *block = calloc(1, sizeof(fs_stats_block_t));
+  pthread_mutex_lock(&fs_stats_lock);
+  block->next = fs_stats_blocks;
+  fs_stats_blocks = block;
+  pthread_mutex_unlock(&fs_stats_lock);
+  fs_stats_thread = &block->stats;
+  return fs_stats_thread;
+}
+
+uint64_t fs_stats_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// these return a handle, a count or a byte count, negative on failure; the rest FS_SUCCESS or an error
+inline static bool fs_stats_failed(fs_op_t op, int64_t status) {
+  switch (op) {
+    case FS_OP_OPEN:
+    case FS_OP_PREAD:
+    case FS_OP_PWRITE:
+    case FS_OP_READV:
+    case FS_OP_WRITEV:
+    case FS_OP_READ_VIEW:
+      return status < 0;
+    default:
+      return status != 0;
+  }
+}
+
+void fs_stats_record(fs_op_t op, uint64_t elapsed_ns, int64_t status, uint64_t bytes) {
+  fs_op_stats_t *op_stats = &fs_stats_local()->ops[op];
+  uint32_t bucket = elapsed_ns ? 63 - bit_clz64(elapsed_ns) : 0;
+  if (bucket >= FS_STATS_BUCKETS) {
+    bucket = FS_STATS_BUCKETS - 1;
+  }
+  fs_stats_add(&op_stats->calls, 1);
+  fs_stats_add(&op_stats->errors, fs_stats_failed(op, status));
+  fs_stats_add(&op_stats->bytes, bytes);
+  fs_stats_add(&op_stats->total_ns, elapsed_ns);
+  fs_stats_add(&op_stats->histogram[bucket], 1);
+}
+
+void fs_stats_collect(fs_stats_t *stats) {
+  memset(stats, 0, sizeof(fs_stats_t));
+  // the blocks are arrays of counters, added up word by word
+  uint64_t *sum = (uint64_t *) stats;
+  pthread_mutex_lock(&fs_stats_lock);
+  for (fs_stats_block_t *block = fs_stats_blocks; block; block = block->next) {
+    uint64_t *counters = (uint64_t *) &block->stats;
+    for (size_t i = 0; i < sizeof(fs_stats_t) / sizeof(uint64_t); i++) {
+      sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&fs_stats_lock);
+}
+
+#endif // FS_STATS